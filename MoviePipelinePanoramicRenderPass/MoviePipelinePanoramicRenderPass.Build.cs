@@ -11,7 +11,9 @@ public class MoviePipelinePanoramicRenderPass : ModuleRules
 				"Core",
 				"CoreUObject",
 				"Engine",
-				"Json"
+				"Json",
+				"ImageWrapper",
+				"ImageWriteQueue"
 			}
 		);
 
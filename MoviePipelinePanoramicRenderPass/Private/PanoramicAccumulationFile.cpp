@@ -0,0 +1,309 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicAccumulationFile.h"
+#include "HAL/FileManager.h"
+#include "Misc/Compression.h"
+#include "Misc/Paths.h"
+#include "Async/ParallelFor.h"
+#include "MovieRenderPipelineCoreModule.h"
+#include <atomic>
+
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		static const uint32 AccumulationFileMagic = 0x50414343; // 'PACC'
+		static const int32 AccumulationFileVersion = 2;
+		// Pixel arrays are compressed in independent blocks so they can be (de)compressed in parallel and never overflow 32 bit sizes.
+		static const int64 AccumulationBlockBytes = 16 * 1024 * 1024;
+
+		static bool WriteCompressedBlocks(FArchive& Ar, const uint8* InData, int64 InNumBytes)
+		{
+			const int32 NumBlocks = (int32)((InNumBytes + AccumulationBlockBytes - 1) / AccumulationBlockBytes);
+			TArray<TArray<uint8>> CompressedBlocks;
+			TArray<int32> UncompressedSizes;
+			CompressedBlocks.SetNum(NumBlocks);
+			UncompressedSizes.SetNum(NumBlocks);
+
+			ParallelFor(NumBlocks, [&](int32 BlockIndex)
+			{
+				const int64 Offset = BlockIndex * AccumulationBlockBytes;
+				const int32 BlockSize = (int32)FMath::Min<int64>(InNumBytes - Offset, AccumulationBlockBytes);
+				int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, BlockSize);
+				TArray<uint8>& Compressed = CompressedBlocks[BlockIndex];
+				Compressed.SetNumUninitialized(CompressedSize);
+				if (FCompression::CompressMemory(NAME_Zlib, Compressed.GetData(), CompressedSize, InData + Offset, BlockSize) && CompressedSize < BlockSize)
+				{
+					Compressed.SetNum(CompressedSize, false);
+				}
+				else
+				{
+					// Store incompressible blocks raw, a compressed size equal to the block size marks them.
+					Compressed.SetNumUninitialized(BlockSize, false);
+					FMemory::Memcpy(Compressed.GetData(), InData + Offset, BlockSize);
+				}
+				UncompressedSizes[BlockIndex] = BlockSize;
+			});
+
+			int32 NumBlocksToWrite = NumBlocks;
+			Ar << NumBlocksToWrite;
+			for (int32 BlockIndex = 0; BlockIndex < NumBlocks; BlockIndex++)
+			{
+				int32 CompressedSize = CompressedBlocks[BlockIndex].Num();
+				Ar << UncompressedSizes[BlockIndex];
+				Ar << CompressedSize;
+				Ar.Serialize(CompressedBlocks[BlockIndex].GetData(), CompressedSize);
+			}
+			return !Ar.IsError();
+		}
+
+		static bool ReadCompressedBlocks(FArchive& Ar, uint8* OutData, int64 InNumBytes)
+		{
+			int32 NumBlocks = 0;
+			Ar << NumBlocks;
+			if (NumBlocks < 0 || (int64)NumBlocks * AccumulationBlockBytes < InNumBytes)
+			{
+				return false;
+			}
+
+			TArray<TArray<uint8>> CompressedBlocks;
+			TArray<int32> UncompressedSizes;
+			CompressedBlocks.SetNum(NumBlocks);
+			UncompressedSizes.SetNum(NumBlocks);
+			for (int32 BlockIndex = 0; BlockIndex < NumBlocks; BlockIndex++)
+			{
+				int32 CompressedSize = 0;
+				Ar << UncompressedSizes[BlockIndex];
+				Ar << CompressedSize;
+				if (Ar.IsError() || CompressedSize < 0 || CompressedSize > AccumulationBlockBytes)
+				{
+					return false;
+				}
+				CompressedBlocks[BlockIndex].SetNumUninitialized(CompressedSize);
+				Ar.Serialize(CompressedBlocks[BlockIndex].GetData(), CompressedSize);
+			}
+			if (Ar.IsError())
+			{
+				return false;
+			}
+
+			std::atomic<bool> bSucceeded(true);
+			ParallelFor(NumBlocks, [&](int32 BlockIndex)
+			{
+				const int64 Offset = BlockIndex * AccumulationBlockBytes;
+				const int32 BlockSize = UncompressedSizes[BlockIndex];
+				if (BlockSize != FMath::Min<int64>(InNumBytes - Offset, AccumulationBlockBytes))
+				{
+					bSucceeded = false;
+					return;
+				}
+				const TArray<uint8>& Compressed = CompressedBlocks[BlockIndex];
+				if (Compressed.Num() == BlockSize)
+				{
+					FMemory::Memcpy(OutData + Offset, Compressed.GetData(), BlockSize);
+				}
+				else if (!FCompression::UncompressMemory(NAME_Zlib, OutData + Offset, BlockSize, Compressed.GetData(), Compressed.Num()))
+				{
+					bSucceeded = false;
+				}
+			});
+			return bSucceeded.load();
+		}
+	}
+}
+
+bool FPanoramicAccumulationFile::Save(const FString& InFilename) const
+{
+	TUniquePtr<FArchive> Ar = TUniquePtr<FArchive>(IFileManager::Get().CreateFileWriter(*InFilename));
+	if (!Ar)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to open panoramic accumulation file for writing: %s"), *InFilename);
+		return false;
+	}
+
+	uint32 Magic = MoviePipeline::Panoramic::AccumulationFileMagic;
+	int32 Version = MoviePipeline::Panoramic::AccumulationFileVersion;
+	FIntPoint LocalOutputSize = OutputSize;
+	int32 LocalNumEyes = NumEyes;
+	int32 LocalOutputFrameNumber = OutputFrameNumber;
+	bool bLocalIncludeAlpha = bIncludeAlpha;
+	int32 LocalNumShards = NumShards;
+	int32 LocalShardIndex = ShardIndex;
+	int32 LocalNumPanes = NumPanes;
+	bool bLocalPreNormalized = bPreNormalized;
+	FString LocalPassName = PassName;
+	int32 NumRegions = Regions.Num();
+
+	*Ar << Magic << Version << LocalOutputSize << LocalNumEyes << LocalOutputFrameNumber << bLocalIncludeAlpha;
+	*Ar << LocalNumShards << LocalShardIndex << LocalNumPanes << bLocalPreNormalized << LocalPassName << NumRegions;
+
+	for (const FPanoramicAccumulationRegion& Region : Regions)
+	{
+		int32 EyeIndex = Region.EyeIndex;
+		FIntPoint Min = Region.Min;
+		FIntPoint Size = Region.Size;
+		bool bHasWeight = Region.Weight.Num() > 0;
+		*Ar << EyeIndex << Min << Size << bHasWeight;
+
+		check(Region.Color.Num() == (int64)Size.X * Size.Y);
+		MoviePipeline::Panoramic::WriteCompressedBlocks(*Ar, (const uint8*)Region.Color.GetData(), Region.Color.Num() * sizeof(FLinearColor));
+		if (bHasWeight)
+		{
+			check(Region.Weight.Num() == Region.Color.Num());
+			MoviePipeline::Panoramic::WriteCompressedBlocks(*Ar, (const uint8*)Region.Weight.GetData(), Region.Weight.Num() * sizeof(float));
+		}
+	}
+
+	const bool bSucceeded = !Ar->IsError() && Ar->Close();
+	if (!bSucceeded)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to write panoramic accumulation file: %s"), *InFilename);
+	}
+	return bSucceeded;
+}
+
+bool FPanoramicAccumulationFile::Load(const FString& InFilename, bool bInHeaderOnly)
+{
+	TUniquePtr<FArchive> Ar = TUniquePtr<FArchive>(IFileManager::Get().CreateFileReader(*InFilename));
+	if (!Ar)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to open panoramic accumulation file: %s"), *InFilename);
+		return false;
+	}
+
+	uint32 Magic = 0;
+	int32 Version = 0;
+	*Ar << Magic << Version;
+	if (Magic != MoviePipeline::Panoramic::AccumulationFileMagic || Version != MoviePipeline::Panoramic::AccumulationFileVersion)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("%s is not a panoramic accumulation file of version %d."), *InFilename, MoviePipeline::Panoramic::AccumulationFileVersion);
+		return false;
+	}
+
+	int32 NumRegions = 0;
+	*Ar << OutputSize << NumEyes << OutputFrameNumber << bIncludeAlpha;
+	*Ar << NumShards << ShardIndex << NumPanes << bPreNormalized << PassName << NumRegions;
+	if (Ar->IsError() || NumRegions < 0)
+	{
+		return false;
+	}
+	if (bInHeaderOnly)
+	{
+		return true;
+	}
+
+	Regions.Reset(NumRegions);
+	for (int32 RegionIndex = 0; RegionIndex < NumRegions; RegionIndex++)
+	{
+		FPanoramicAccumulationRegion& Region = Regions.AddDefaulted_GetRef();
+		bool bHasWeight = false;
+		*Ar << Region.EyeIndex << Region.Min << Region.Size << bHasWeight;
+		if (Ar->IsError() || Region.Size.X < 0 || Region.Size.Y < 0)
+		{
+			return false;
+		}
+
+		const int64 NumPixels = (int64)Region.Size.X * Region.Size.Y;
+		Region.Color.SetNumUninitialized(NumPixels);
+		if (!MoviePipeline::Panoramic::ReadCompressedBlocks(*Ar, (uint8*)Region.Color.GetData(), NumPixels * sizeof(FLinearColor)))
+		{
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("Corrupt color data in panoramic accumulation file: %s"), *InFilename);
+			return false;
+		}
+		if (bHasWeight)
+		{
+			Region.Weight.SetNumUninitialized(NumPixels);
+			if (!MoviePipeline::Panoramic::ReadCompressedBlocks(*Ar, (uint8*)Region.Weight.GetData(), NumPixels * sizeof(float)))
+			{
+				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Corrupt weight data in panoramic accumulation file: %s"), *InFilename);
+				return false;
+			}
+		}
+	}
+	return !Ar->IsError();
+}
+
+bool FPanoramicAccumulationFile::IsCompatibleWith(const FPanoramicAccumulationFile& InOther) const
+{
+	return OutputSize == InOther.OutputSize
+		&& NumEyes == InOther.NumEyes
+		&& OutputFrameNumber == InOther.OutputFrameNumber
+		&& bIncludeAlpha == InOther.bIncludeAlpha
+		&& NumShards == InOther.NumShards
+		&& bPreNormalized == InOther.bPreNormalized
+		&& PassName == InOther.PassName;
+}
+
+void FPanoramicAccumulationFile::AccumulateInto(TArray64<FLinearColor>& InOutColor, TArray64<float>& InOutWeight) const
+{
+	const int64 EyePixelCount = (int64)OutputSize.X * OutputSize.Y;
+	check(InOutColor.Num() == EyePixelCount * NumEyes);
+	check(InOutWeight.Num() == InOutColor.Num());
+
+	for (const FPanoramicAccumulationRegion& Region : Regions)
+	{
+		const int64 EyeOffset = Region.EyeIndex > 0 ? EyePixelCount * Region.EyeIndex : 0;
+		const bool bWeightInAlpha = Region.Weight.Num() == 0;
+
+		// Rows never overlap inside a region, so each one can be added on its own.
+		ParallelFor(Region.Size.Y, [&](int32 RegionY)
+		{
+			const int32 OutputPixelY = Region.Min.Y + RegionY;
+			if (OutputPixelY < 0 || OutputPixelY >= OutputSize.Y)
+			{
+				return;
+			}
+			for (int32 RegionX = 0; RegionX < Region.Size.X; RegionX++)
+			{
+				const int32 OriginalX = Region.Min.X + RegionX;
+				const int32 OutputPixelX = ((OriginalX % OutputSize.X) + OutputSize.X) % OutputSize.X;
+				const int64 SourceIndex = RegionX + ((int64)RegionY * Region.Size.X);
+				const int64 DestIndex = OutputPixelX + ((int64)OutputPixelY * OutputSize.X) + EyeOffset;
+
+				const FLinearColor& Color = Region.Color[SourceIndex];
+				InOutColor[DestIndex] += Color;
+				InOutWeight[DestIndex] += bWeightInAlpha ? Color.A : Region.Weight[SourceIndex];
+			}
+		});
+	}
+}
+
+void FPanoramicAccumulationFile::Normalize(TArray64<FLinearColor>& InOutColor, const TArray64<float>& InWeight, bool bInIncludeAlpha, bool bInPreNormalized)
+{
+	check(InWeight.Num() == InOutColor.Num());
+	const int64 ChunkSize = 64 * 1024;
+	const int32 NumChunks = (int32)((InOutColor.Num() + ChunkSize - 1) / ChunkSize);
+	ParallelFor(NumChunks, [&](int32 ChunkIndex)
+	{
+		const int64 EndIndex = FMath::Min<int64>((ChunkIndex + 1) * ChunkSize, InOutColor.Num());
+		for (int64 PixelIndex = ChunkIndex * ChunkSize; PixelIndex < EndIndex; PixelIndex++)
+		{
+			FLinearColor& Pixel = InOutColor[PixelIndex];
+			if (bInPreNormalized)
+			{
+				// Pixels no shard covered sum up to black already.
+				Pixel.A = bInIncludeAlpha ? Pixel.A : 1.f;
+				continue;
+			}
+			const float Weight = InWeight[PixelIndex];
+			if (Weight <= 0.f)
+			{
+				Pixel = FLinearColor(0.f, 0.f, 0.f, bInIncludeAlpha ? 0.f : 1.f);
+				continue;
+			}
+			Pixel.R /= Weight;
+			Pixel.G /= Weight;
+			Pixel.B /= Weight;
+			Pixel.A = bInIncludeAlpha ? Pixel.A / Weight : 1.f;
+		}
+	});
+}
+
+FString FPanoramicAccumulationFile::GetShardFilename(const FString& InDirectory, const FString& InPassName, int32 InOutputFrameNumber, int32 InShardIndex, int32 InNumShards)
+{
+	return FPaths::Combine(InDirectory, FString::Printf(TEXT("%s.%04d.Shard%dof%d.%s"), *InPassName, InOutputFrameNumber, InShardIndex, InNumShards, GetFileExtension()));
+}
+
+FString FPanoramicAccumulationFile::GetPaneCheckpointFilename(const FString& InDirectory, const FString& InPassName, int32 InOutputFrameNumber, int32 InStepIndex)
+{
+	return FPaths::Combine(InDirectory, FString::Printf(TEXT("%s.%04d.Step%d.%s"), *InPassName, InOutputFrameNumber, InStepIndex, GetFileExtension()));
+}
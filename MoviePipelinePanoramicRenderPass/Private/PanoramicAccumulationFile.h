@@ -0,0 +1,62 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "CoreMinimal.h"
+
+// A weight-carrying piece of a panoramic accumulation: the weighted color sums and the total blend weight
+// for every pixel of a rectangle of the equirectangular map, exactly as FPanoramicBlender keeps them before normalization.
+struct FPanoramicAccumulationRegion
+{
+	// -1 if no stereo, 0 left eye, 1 right eye.
+	int32 EyeIndex = -1;
+	// Rectangle in output pixels. X may run past the map width, it wraps around horizontally like the blender does.
+	FIntPoint Min = FIntPoint::ZeroValue;
+	FIntPoint Size = FIntPoint::ZeroValue;
+	// Weighted color sums. When Weight is empty the total weight is carried in Color.A (no alpha accumulation), except in
+	// pre-normalized files: their colors are final and A is the real alpha when alpha is included.
+	TArray64<FLinearColor> Color;
+	TArray64<float> Weight;
+};
+
+// Compact on-disk container for accumulation regions, used to split one panoramic frame across several processes.
+// Each shard writes the regions it touched, the merge step sums every shard of a frame and normalizes.
+struct FPanoramicAccumulationFile
+{
+	// Size of a single eye of the equirectangular map.
+	FIntPoint OutputSize = FIntPoint::ZeroValue;
+	// 1 for mono, 2 for stereo (stacked top/bottom).
+	int32 NumEyes = 1;
+	int32 OutputFrameNumber = 0;
+	bool bIncludeAlpha = false;
+	int32 NumShards = 1;
+	int32 ShardIndex = 0;
+	// How many panes were blended into this file.
+	int32 NumPanes = 0;
+	// The colors were weighted with weights that already sum to one across the rig, so the sum of every
+	// file of a frame is final and only the alpha needs fixing up.
+	bool bPreNormalized = false;
+	FString PassName;
+
+	TArray<FPanoramicAccumulationRegion> Regions;
+
+	bool Save(const FString& InFilename) const;
+	// With bInHeaderOnly only the description above is read, Regions stay empty.
+	bool Load(const FString& InFilename, bool bInHeaderOnly = false);
+
+	// Checks that another file describes the same frame of the same rig, so the two can be summed.
+	bool IsCompatibleWith(const FPanoramicAccumulationFile& InOther) const;
+
+	// Adds every region into a full (eyes stacked) color and weight map of OutputSize.X * OutputSize.Y * NumEyes pixels.
+	void AccumulateInto(TArray64<FLinearColor>& InOutColor, TArray64<float>& InOutWeight) const;
+
+	// Divides the summed colors by their weight, pixels nobody contributed to stay black. Pre-normalized colors are final
+	// as summed, their weight isn't looked at: with alpha included it is only the summed alpha, which is 0 where covered
+	// pixels are transparent.
+	static void Normalize(TArray64<FLinearColor>& InOutColor, const TArray64<float>& InWeight, bool bInIncludeAlpha, bool bInPreNormalized);
+
+	// Extension used for accumulation files on disk.
+	static const TCHAR* GetFileExtension() { return TEXT("panoacc"); }
+	static FString GetShardFilename(const FString& InDirectory, const FString& InPassName, int32 InOutputFrameNumber, int32 InShardIndex, int32 InNumShards);
+	// Checkpoint of a single rig step (both eyes) of a frame, see UPanoramicPass::bCheckpointPanes.
+	static FString GetPaneCheckpointFilename(const FString& InDirectory, const FString& InPassName, int32 InOutputFrameNumber, int32 InStepIndex);
+};
@@ -0,0 +1,144 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicAccumulatorQueue.h"
+#include "MoviePipelineImagePassBase.h"
+#include "MovieRenderPipelineCoreModule.h"
+#include "MovieRenderOverlappedImage.h"
+
+FPanoramicAccumulatorQueue::FPanoramicAccumulatorQueue(int32 InNumAccumulators, int32 InMaxWaitingPanes)
+	: MaxWaitingPanes(FMath::Max(InMaxWaitingPanes, 0))
+{
+	for (int32 Index = 0; Index < InNumAccumulators; Index++)
+	{
+		FreeAccumulators.Add(MakeShared<FImageOverlappedAccumulator, ESPMode::ThreadSafe>());
+	}
+}
+
+TSharedRef<FPanoramicAccumulatorQueue::FPaneAccumulation, ESPMode::ThreadSafe> FPanoramicAccumulatorQueue::GetPaneAccumulation_GameThread(int32 InOutputFrameNumber, const FMoviePipelinePassIdentifier& InPanePassIdentifier)
+{
+	const TPair<int32, FMoviePipelinePassIdentifier> Key(InOutputFrameNumber, InPanePassIdentifier);
+	while (true)
+	{
+		{
+			FScopeLock ScopeLock(&Mutex);
+			if (const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>* Existing = ActivePanes.Find(Key))
+			{
+				return *Existing;
+			}
+			if (FreeAccumulators.Num() > 0 || WaitingPanes.Num() < MaxWaitingPanes)
+			{
+				TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe> Pane = MakeShared<FPaneAccumulation, ESPMode::ThreadSafe>();
+				Pane->OutputFrameNumber = InOutputFrameNumber;
+				Pane->PanePassIdentifier = InPanePassIdentifier;
+				ActivePanes.Add(Key, Pane);
+				if (FreeAccumulators.Num() > 0)
+				{
+					Bind_Locked(Pane, FreeAccumulators.Pop(EAllowShrinking::No));
+				}
+				else
+				{
+					WaitingPanes.Add(Pane);
+				}
+				return Pane;
+			}
+		}
+		// Accumulators are freed by the final work of a pane on a task thread.
+		FPlatformProcess::SleepNoStats(0.001f);
+	}
+}
+
+void FPanoramicAccumulatorQueue::Execute(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane, FAccumulatorWork&& InWork, bool bInFinal)
+{
+	FScopeLock ScopeLock(&Mutex);
+	if (InPane->bFinalQueued)
+	{
+		return;
+	}
+	InPane->bFinalQueued = bInFinal;
+	if (!InPane->Accumulator.IsValid())
+	{
+		InPane->PendingWork.Emplace(MoveTemp(InWork), bInFinal);
+		return;
+	}
+	Dispatch_Locked(InPane, MoveTemp(InWork), bInFinal);
+}
+
+void FPanoramicAccumulatorQueue::Bind_Locked(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane, const FAccumulatorPtr& InAccumulator)
+{
+	InPane->Accumulator = InAccumulator;
+	TArray<TPair<FAccumulatorWork, bool>> PendingWork = MoveTemp(InPane->PendingWork);
+	InPane->PendingWork.Reset();
+	for (TPair<FAccumulatorWork, bool>& Work : PendingWork)
+	{
+		Dispatch_Locked(InPane, MoveTemp(Work.Key), Work.Value);
+	}
+}
+
+void FPanoramicAccumulatorQueue::Dispatch_Locked(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane, FAccumulatorWork&& InWork, bool bInFinal)
+{
+	// Same ordering as the pipeline's own accumulation: every piece of work of a pane waits for the previous one.
+	FMoviePipelineBackgroundAccumulateTask Task;
+	Task.LastCompletionEvent = InPane->LastEvent;
+	FGraphEventRef Event = Task.Execute([Queue = AsShared(), Pane = InPane, Accumulator = InPane->Accumulator, Work = MoveTemp(InWork), bInFinal]() mutable
+	{
+		Work(Accumulator);
+		if (bInFinal)
+		{
+			Queue->Release(Pane);
+		}
+	});
+	InPane->LastEvent = Event;
+	Events.RemoveAll([](const FGraphEventRef& InEvent) { return InEvent->IsComplete(); });
+	Events.Add(Event);
+}
+
+void FPanoramicAccumulatorQueue::Release(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane)
+{
+	FScopeLock ScopeLock(&Mutex);
+	ActivePanes.Remove(TPair<int32, FMoviePipelinePassIdentifier>(InPane->OutputFrameNumber, InPane->PanePassIdentifier));
+	FAccumulatorPtr Accumulator = MoveTemp(InPane->Accumulator);
+	InPane->Accumulator.Reset();
+	InPane->LastEvent = nullptr;
+	if (WaitingPanes.Num() > 0)
+	{
+		TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe> NextPane = WaitingPanes[0];
+		WaitingPanes.RemoveAt(0);
+		Bind_Locked(NextPane, Accumulator);
+	}
+	else
+	{
+		FreeAccumulators.Add(Accumulator);
+	}
+}
+
+void FPanoramicAccumulatorQueue::Flush()
+{
+	// Finishing a pane can start the work of a waiting one, so wait until nothing new was handed to the task graph.
+	while (true)
+	{
+		FGraphEventArray PendingEvents;
+		{
+			FScopeLock ScopeLock(&Mutex);
+			Events.RemoveAll([](const FGraphEventRef& InEvent) { return InEvent->IsComplete(); });
+			PendingEvents = Events;
+		}
+		if (PendingEvents.Num() == 0)
+		{
+			break;
+		}
+		FTaskGraphInterface::Get().WaitUntilTasksComplete(PendingEvents);
+	}
+
+	FScopeLock ScopeLock(&Mutex);
+	if (WaitingPanes.Num() > 0)
+	{
+		UE_LOG(LogMovieRenderPipeline, Log, TEXT("Dropped %d panoramic panes that were still waiting for an accumulator."), WaitingPanes.Num());
+	}
+	WaitingPanes.Reset();
+	ActivePanes.Reset();
+}
+
+int32 FPanoramicAccumulatorQueue::GetNumWaitingPanes() const
+{
+	FScopeLock ScopeLock(&Mutex);
+	return WaitingPanes.Num();
+}
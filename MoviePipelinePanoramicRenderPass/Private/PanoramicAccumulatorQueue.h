@@ -0,0 +1,70 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "MovieRenderPipelineDataTypes.h"
+
+class FImageOverlappedAccumulator;
+
+// Hands a fixed set of accumulators to the panes of every pass as they become free, instead of stalling the game thread
+// (and with it the submission of GPU work for panes that could go ahead) until one is.
+// Each pane of a pass in a frame is an FPaneAccumulation. Its work runs in order on task threads once it has an accumulator,
+// work that comes in before that waits with the pane. Panes get accumulators in the order they were created, so the panes
+// of a frame are always bound before the panes of the next one.
+class FPanoramicAccumulatorQueue : public TSharedFromThis<FPanoramicAccumulatorQueue, ESPMode::ThreadSafe>
+{
+public:
+	typedef TSharedPtr<FImageOverlappedAccumulator, ESPMode::ThreadSafe> FAccumulatorPtr;
+	typedef TUniqueFunction<void(const FAccumulatorPtr&)> FAccumulatorWork;
+
+	struct FPaneAccumulation
+	{
+		int32 OutputFrameNumber = 0;
+		FMoviePipelinePassIdentifier PanePassIdentifier;
+
+	private:
+		friend class FPanoramicAccumulatorQueue;
+		// Null until the pane is bound.
+		FAccumulatorPtr Accumulator;
+		// The last work of the pane that was handed to the task graph, the next one waits for it.
+		FGraphEventRef LastEvent;
+		// Work that came in before the pane had an accumulator, with whether it was the final one.
+		TArray<TPair<FAccumulatorWork, bool>> PendingWork;
+		// Work after the final one is dropped.
+		bool bFinalQueued = false;
+	};
+
+	// InMaxWaitingPanes: how many panes may wait for an accumulator before creating another one blocks.
+	FPanoramicAccumulatorQueue(int32 InNumAccumulators, int32 InMaxWaitingPanes);
+
+	// The accumulation of a pane of a pass in a frame, created the first time it is asked for. Only blocks while
+	// no accumulator is free and MaxWaitingPanes panes already wait for one.
+	TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe> GetPaneAccumulation_GameThread(int32 InOutputFrameNumber, const FMoviePipelinePassIdentifier& InPanePassIdentifier);
+
+	// Runs InWork on a task thread with the pane's accumulator, after the pane's earlier work. The final work frees the
+	// accumulator for the next waiting pane. Any thread.
+	void Execute(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane, FAccumulatorWork&& InWork, bool bInFinal);
+
+	// Waits for all work that has an accumulator, including work that gets one in the meantime. Work of panes that are
+	// still waiting then is dropped, their final samples will never come.
+	void Flush();
+
+	int32 GetNumWaitingPanes() const;
+
+private:
+	// Both need Mutex.
+	void Bind_Locked(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane, const FAccumulatorPtr& InAccumulator);
+	void Dispatch_Locked(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane, FAccumulatorWork&& InWork, bool bInFinal);
+	void Release(const TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>& InPane);
+
+	TArray<FAccumulatorPtr> FreeAccumulators;
+	// Oldest first.
+	TArray<TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>> WaitingPanes;
+	// Panes whose final work hasn't run yet, by output frame number and pane pass.
+	TMap<TPair<int32, FMoviePipelinePassIdentifier>, TSharedRef<FPaneAccumulation, ESPMode::ThreadSafe>> ActivePanes;
+	// Work handed to the task graph that may not be done yet.
+	FGraphEventArray Events;
+	int32 MaxWaitingPanes;
+	mutable FCriticalSection Mutex;
+};
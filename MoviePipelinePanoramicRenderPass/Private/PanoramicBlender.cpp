@@ -1,179 +1,421 @@
 // Copyright MonsterGuoGuo. All Rights Reserved.2023
 #include "PanoramicBlender.h"
 #include "PanoramicPass.h"
+#include "PanoramicAccumulationFile.h"
+#include "PanoramicFrameStream.h"
+#include "PanoramicReprojection.h"
 #include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Hash/CityHash.h"
+#include "HAL/FileManager.h"
+#include "Modules/ModuleManager.h"
+#include "IImageWrapperModule.h"
+#include "MovieRenderPipelineCoreModule.h"
 // Constructor (fill in output combiner, fill in output resolution)
-FPanoramicBlender::FPanoramicBlender(TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> InOutputMerger, const FIntPoint InOutputResolution)
+FPanoramicBlender::FPanoramicBlender(TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> InOutputMerger, const FIntPoint InOutputResolution, const FPanoramicBlenderOptions& InOptions)
 	: OutputMerger(InOutputMerger)
+	, Options(InOptions)
+	, NextSequenceNumber(0)
+	, NumActiveBlendWorkers(0)
+	, bAbandoned(false)
 {
 	OutputEquirectangularMapSize = InOutputResolution;
+	MaxBlendWorkers = Options.MaxConcurrentBlends > 0 ? Options.MaxConcurrentBlends : FMath::Max(FTaskGraphInterface::Get().GetNumWorkerThreads() / 2, 1);
+	if (Options.bStreamToSharedMemory)
+	{
+		// Without the region the render carries on, the frames still reach the regular outputs.
+		FrameStream = FPanoramicFrameStream::Create(Options.StreamName, Options.StreamSlotCount, Options.StreamSlotSize, Options.StreamTimeoutSeconds);
+	}
+	if (IsWritingLightingProducts() && Options.LightingProducts.EnvironmentMapSize.GetMin() > 0)
+	{
+		// Environment maps are encoded on the blend workers, where modules can't be loaded.
+		FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+	}
 }
 /**************************** Color mapping *************************/
-// Color linear interpolation, make the picture more soft
-static FLinearColor GetColorBilinearFiltered(const FImagePixelData* InSampleData, const FVector2D& InSamplePixelCoords, bool& OutClipped, bool bIncludeAlpha = false)
+namespace MoviePipeline
 {
-	// Pixel coordinates assume that 0.5, 0.5 is the center of the pixel, so we subtract half to make it indexable.
-	const FVector2D PixelCoordinateIndex = InSamplePixelCoords - 0.5f;
-	
-	// Get surrounding pixels indices
-	FIntPoint LowerLeftPixelIndex = FIntPoint(FMath::RoundToInt(PixelCoordinateIndex.X), FMath::RoundToInt(PixelCoordinateIndex.Y));
-	FIntPoint LowerRightPixelIndex = FIntPoint(LowerLeftPixelIndex + FIntPoint(1, 0));
-	FIntPoint UpperLeftPixelIndex = FIntPoint(LowerLeftPixelIndex + FIntPoint(0, 1));
-	FIntPoint UpperRightPixelIndex = FIntPoint(LowerLeftPixelIndex + FIntPoint(1, 1));
-	// Clamp pixels indices to pixels array bounds.
-	// ToDo: Is this needed? Should we handle wrap around for the bottom right pixel? What gives
-	auto ClampPixelCoords = [&](FIntPoint& InOutPixelCoords, const FIntPoint& InArraySize)
-	{
-		if (InOutPixelCoords.X > InArraySize.X - 1 ||
-			InOutPixelCoords.Y > InArraySize.Y - 1 ||
-			InOutPixelCoords.X < 0 ||
-			InOutPixelCoords.Y < 0)
-		{
-			OutClipped = true;
-		}
-		InOutPixelCoords = FIntPoint(FMath::Clamp(InOutPixelCoords.X, 0, InArraySize.X - 1), FMath::Clamp(InOutPixelCoords.Y, 0, InArraySize.Y - 1));
-	};
-	
-	ClampPixelCoords(LowerLeftPixelIndex, InSampleData->GetSize());
-	ClampPixelCoords(LowerRightPixelIndex, InSampleData->GetSize());
-	ClampPixelCoords(UpperLeftPixelIndex, InSampleData->GetSize());
-	ClampPixelCoords(UpperRightPixelIndex, InSampleData->GetSize());
-
-	// Fetch the colors for the four pixels. We convert to FLinearColor here so that our accumulation
-	// is done in linear space with enough precision. The samples are probably in F16 color right now.
-	FLinearColor LowerLeftPixelColor;
-	FLinearColor LowerRightPixelColor;
-	FLinearColor UpperLeftPixelColor;
-	FLinearColor UpperRightPixelColor;
-	
-	int64 SizeInBytes = 0;
-	const void* SrcRawDataPtr = nullptr;
-	InSampleData->GetRawData(SrcRawDataPtr, SizeInBytes);
-
-	switch (InSampleData->GetType())
+	namespace Panoramic
 	{
-		case EImagePixelType::Float16:
+		static FORCEINLINE FLinearColor GetPixel(const void* InRawData, EImagePixelType InPixelType, int64 InPixelIndex)
 		{
-			const FFloat16Color* ColorDataF16 = static_cast<const FFloat16Color*>(SrcRawDataPtr);
-			LowerLeftPixelColor = FLinearColor(ColorDataF16[LowerLeftPixelIndex.X + (LowerLeftPixelIndex.Y * InSampleData->GetSize().X)]);
-			LowerRightPixelColor = FLinearColor(ColorDataF16[LowerRightPixelIndex.X + (LowerRightPixelIndex.Y * InSampleData->GetSize().X)]);
-			UpperLeftPixelColor = FLinearColor(ColorDataF16[UpperLeftPixelIndex.X + (UpperLeftPixelIndex.Y * InSampleData->GetSize().X)]);
-			UpperRightPixelColor = FLinearColor(ColorDataF16[UpperRightPixelIndex.X + (UpperRightPixelIndex.Y * InSampleData->GetSize().X)]);
+			switch (InPixelType)
+			{
+				case EImagePixelType::Float16:
+					return FLinearColor(static_cast<const FFloat16Color*>(InRawData)[InPixelIndex]);
+				case EImagePixelType::Float32:
+					return static_cast<const FLinearColor*>(InRawData)[InPixelIndex];
+				default:
+				// Not implemented
+					check(0);
+					return FLinearColor::Black;
+			}
 		}
-		break;
-		case EImagePixelType::Float32:
+
+		// Index of the texel closest to a sample position, clamped to the pane.
+		static FORCEINLINE int64 GetNearestPixelIndex(const FPanoramicSampleTap& InTap, const FIntPoint& InSampleSize)
 		{
-			const FLinearColor* ColorDataF32 = static_cast<const FLinearColor*>(SrcRawDataPtr);
-			LowerLeftPixelColor = ColorDataF32[LowerLeftPixelIndex.X + (LowerLeftPixelIndex.Y * InSampleData->GetSize().X)];
-			LowerRightPixelColor = ColorDataF32[LowerRightPixelIndex.X + (LowerRightPixelIndex.Y * InSampleData->GetSize().X)];
-			UpperLeftPixelColor = ColorDataF32[UpperLeftPixelIndex.X + (UpperLeftPixelIndex.Y * InSampleData->GetSize().X)];
-			UpperRightPixelColor = ColorDataF32[UpperRightPixelIndex.X + (UpperRightPixelIndex.Y * InSampleData->GetSize().X)];
+			const FIntPoint NearestTexel = InTap.GetNearestTexel();
+			const int32 X = FMath::Clamp(NearestTexel.X, 0, InSampleSize.X - 1);
+			const int32 Y = FMath::Clamp(NearestTexel.Y, 0, InSampleSize.Y - 1);
+			return X + (int64)Y * InSampleSize.X;
 		}
-		break;
-		default:
-		// Not implemented
-			check(0);
+
+		// The texels and kernel weights of a separable filtered lookup. Only depends on the sample position, so a lookup shared
+		// by several images (both stereo eyes) computes it once and fetches from each of them.
+		struct FFilterFootprint
+		{
+			FFilterFootprint(const FPanoramicSampleTap& InTap, const FPanoramicResampleKernel& InKernel, const FIntPoint& InSampleSize)
+			{
+				NumTaps = InKernel.NumTaps;
+				const float* KernelWeightsX = InKernel.GetWeights(InTap.PhaseX);
+				const float* KernelWeightsY = InKernel.GetWeights(InTap.PhaseY);
+				// Clamp the taps to the pixels array bounds. The reprojection only keeps positions whose bilinear footprint is
+				// inside the pane, so only the outer taps of the wider kernels ever get clamped (repeating the edge texels).
+				for (int32 TapIndex = 0; TapIndex < NumTaps; TapIndex++)
+				{
+					TexelX[TapIndex] = FMath::Clamp(InTap.BaseX + InKernel.GetFirstTapOffset() + TapIndex, 0, InSampleSize.X - 1);
+					RowOffsetY[TapIndex] = (int64)FMath::Clamp(InTap.BaseY + InKernel.GetFirstTapOffset() + TapIndex, 0, InSampleSize.Y - 1) * InSampleSize.X;
+					WeightX[TapIndex] = KernelWeightsX[TapIndex];
+					WeightY[TapIndex] = KernelWeightsY[TapIndex];
+				}
+			}
+
+			// We convert to FLinearColor here so that our accumulation is done in linear space with enough precision.
+			// The samples are probably in F16 color right now.
+			FORCEINLINE FLinearColor Sample(const void* InRawData, EImagePixelType InPixelType, bool bInIncludeAlpha) const
+			{
+				FLinearColor FilteredPixelColor = FLinearColor(0.f, 0.f, 0.f, 0.f);
+				for (int32 TapY = 0; TapY < NumTaps; TapY++)
+				{
+					FLinearColor RowColor = FLinearColor(0.f, 0.f, 0.f, 0.f);
+					for (int32 TapX = 0; TapX < NumTaps; TapX++)
+					{
+						RowColor += GetPixel(InRawData, InPixelType, RowOffsetY[TapY] + TexelX[TapX]) * WeightX[TapX];
+					}
+					FilteredPixelColor += RowColor * WeightY[TapY];
+				}
+				// Force final color alpha to opaque if requested
+				if (!bInIncludeAlpha)
+				{
+					FilteredPixelColor.A = 1.0f;
+				}
+				return FilteredPixelColor;
+			}
+
+			int32 NumTaps;
+			int32 TexelX[FPanoramicResampleKernel::MaxTaps];
+			int64 RowOffsetY[FPanoramicResampleKernel::MaxTaps];
+			float WeightX[FPanoramicResampleKernel::MaxTaps];
+			float WeightY[FPanoramicResampleKernel::MaxTaps];
+		};
+
+		// Box filtered mip levels of an incoming pane, for the spots where many of its texels fall into one output pixel.
+		struct FPaneMipChain
+		{
+			void Build(const void* InRawData, EImagePixelType InPixelType, const FIntPoint& InSampleSize, int32 InNumLevels)
+			{
+				LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendPerTaskOutput"));
+				Sizes.SetNum(InNumLevels);
+				Levels.SetNum(InNumLevels);
+				Sizes[0] = InSampleSize;
+				for (int32 Level = 1; Level < InNumLevels; Level++)
+				{
+					const FIntPoint PreviousSize = Sizes[Level - 1];
+					const TArray<FLinearColor>& PreviousLevel = Levels[Level - 1];
+					const FIntPoint LevelSize = FIntPoint(FMath::Max((PreviousSize.X + 1) / 2, 1), FMath::Max((PreviousSize.Y + 1) / 2, 1));
+					Sizes[Level] = LevelSize;
+					TArray<FLinearColor>& LevelPixels = Levels[Level];
+					LevelPixels.SetNumUninitialized(LevelSize.X * LevelSize.Y);
+
+					ParallelFor(LevelSize.Y, [&](int32 Y)
+					{
+						// Odd sizes repeat their last row/column.
+						const int32 Y0 = FMath::Min(Y * 2, PreviousSize.Y - 1);
+						const int32 Y1 = FMath::Min(Y * 2 + 1, PreviousSize.Y - 1);
+						for (int32 X = 0; X < LevelSize.X; X++)
+						{
+							const int32 X0 = FMath::Min(X * 2, PreviousSize.X - 1);
+							const int32 X1 = FMath::Min(X * 2 + 1, PreviousSize.X - 1);
+							auto FetchPrevious = [&](int32 InX, int32 InY)
+							{
+								const int64 Index = InX + (int64)InY * PreviousSize.X;
+								return Level == 1 ? GetPixel(InRawData, InPixelType, Index) : PreviousLevel[Index];
+							};
+							LevelPixels[X + Y * LevelSize.X] = (FetchPrevious(X0, Y0) + FetchPrevious(X1, Y0) + FetchPrevious(X0, Y1) + FetchPrevious(X1, Y1)) * 0.25f;
+						}
+					});
+				}
+			}
+
+			// Bilinear lookup of a tap's position in one of the prefiltered levels (1 or more).
+			FLinearColor SampleBilinear(int32 InLevel, const FPanoramicSampleTap& InTap) const
+			{
+				const FIntPoint& LevelSize = Sizes[InLevel];
+				const TArray<FLinearColor>& LevelPixels = Levels[InLevel];
+				const float U = (InTap.BaseX + 0.5f + (float)InTap.PhaseX / FPanoramicSampleTap::NumPhases) * LevelSize.X / Sizes[0].X - 0.5f;
+				const float V = (InTap.BaseY + 0.5f + (float)InTap.PhaseY / FPanoramicSampleTap::NumPhases) * LevelSize.Y / Sizes[0].Y - 0.5f;
+				const int32 BaseX = FMath::FloorToInt(U);
+				const int32 BaseY = FMath::FloorToInt(V);
+				const float FracX = U - BaseX;
+				const float FracY = V - BaseY;
+				const int32 X0 = FMath::Clamp(BaseX, 0, LevelSize.X - 1);
+				const int32 X1 = FMath::Clamp(BaseX + 1, 0, LevelSize.X - 1);
+				const int32 Y0 = FMath::Clamp(BaseY, 0, LevelSize.Y - 1);
+				const int32 Y1 = FMath::Clamp(BaseY + 1, 0, LevelSize.Y - 1);
+				return FMath::Lerp(FMath::Lerp(LevelPixels[X0 + Y0 * LevelSize.X], LevelPixels[X1 + Y0 * LevelSize.X], FracX),
+					FMath::Lerp(LevelPixels[X0 + Y1 * LevelSize.X], LevelPixels[X1 + Y1 * LevelSize.X], FracX), FracY);
+			}
+
+			// Level 0 is the pane itself and stays empty here.
+			TArray<TArray<FLinearColor>> Levels;
+			TArray<FIntPoint> Sizes;
+		};
 	}
+}
 
-	// Interpolate between the 4 pixels based on the exact sub-pixel offset of the incoming coordinate (which may not be centered)
-	const float FracX = FMath::Frac(InSamplePixelCoords.X);
-	const float FracY = FMath::Frac(InSamplePixelCoords.Y);
-	FLinearColor InterpolatedPixelColor = FMath::Lerp(FMath::Lerp(LowerLeftPixelColor,LowerRightPixelColor,FracX),
-	 									FMath::Lerp(UpperLeftPixelColor,UpperRightPixelColor,FracX),FracY);
-	// Force final color alpha to opaque if requested
-	if (!bIncludeAlpha)
+/**************************** Held frames *************************/
+namespace MoviePipeline
+{
+	namespace Panoramic
 	{
-		InterpolatedPixelColor.A = 1.0f;
-	}
+		// Hash of every byte of a pane. Sampling only some of the pixels would miss small changes in otherwise held shots
+		// (a particle, a blinking light) and repeat a stale frame, so the pane is hashed in full, in parallel blocks of rows.
+		static uint64 HashPanePixels(const FImagePixelData& InPixelData)
+		{
+			const void* RawData = nullptr;
+			int64 RawSizeInBytes = 0;
+			InPixelData.GetRawData(RawData, RawSizeInBytes);
+			const FIntPoint Size = InPixelData.GetSize();
+			if (!RawData || Size.Y <= 0)
+			{
+				return 0;
+			}
 
-	return InterpolatedPixelColor;
-}
+			constexpr int32 RowsPerBlock = 64;
+			const int64 RowBytes = RawSizeInBytes / Size.Y;
+			const int32 NumBlocks = (Size.Y + RowsPerBlock - 1) / RowsPerBlock;
+			TArray<uint64> BlockHashes;
+			BlockHashes.SetNumUninitialized(NumBlocks);
+			ParallelFor(NumBlocks, [&](int32 BlockIndex)
+			{
+				const int64 BlockBegin = (int64)BlockIndex * RowsPerBlock * RowBytes;
+				const int64 BlockEnd = FMath::Min(BlockBegin + RowsPerBlock * RowBytes, RawSizeInBytes);
+				BlockHashes[BlockIndex] = CityHash64(static_cast<const char*>(RawData) + BlockBegin, (uint32)(BlockEnd - BlockBegin));
+			});
+			const uint64 Seed = ((uint64)Size.X << 32) ^ ((uint64)Size.Y << 8) ^ (uint64)InPixelData.GetType();
+			return CityHash64WithSeed(reinterpret_cast<const char*>(BlockHashes.GetData()), NumBlocks * sizeof(uint64), Seed);
+		}
+
+		template<typename PixelType>
+		static TUniquePtr<FImagePixelData> CopyPixels(const FImagePixelData& InPixelData, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload)
+		{
+			const TImagePixelData<PixelType>& Source = static_cast<const TImagePixelData<PixelType>&>(InPixelData);
+			return MakeUnique<TImagePixelData<PixelType>>(Source.GetSize(), TArray64<PixelType>(Source.Pixels), InPayload);
+		}
 
+		// A copy of a finished panorama with another payload. Panoramas only come in the output pixel types.
+		static TUniquePtr<FImagePixelData> CopyPixelData(const FImagePixelData& InPixelData, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload)
+		{
+			LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendFrameOutput"));
+			switch (InPixelData.GetType())
+			{
+				case EImagePixelType::Float16:
+					return CopyPixels<FFloat16Color>(InPixelData, InPayload);
+				case EImagePixelType::Color:
+					return CopyPixels<FColor>(InPixelData, InPayload);
+				case EImagePixelType::Float32:
+				default:
+					return CopyPixels<FLinearColor>(InPixelData, InPayload);
+			}
+		}
+	}
+}
 
 DECLARE_CYCLE_STAT(TEXT("STAT_MoviePipeline_PanoBlend"), STAT_MoviePipeline_PanoBlend, STATGROUP_MoviePipeline);
 
 // The callback function _ data after rendering the render channel allows running on any thread
 void FPanoramicBlender::OnCompleteRenderPassDataAvailable_AnyThread(TUniquePtr<FImagePixelData>&& InData)
+{
+	// We don't blend here, this is called from the accumulation tasks and blending inline would compete with them
+	// (and with encoding) for the same task graph. Instead the pane is queued for our own bounded set of workers.
+	FPanoramicImagePixelDataPayload* DataPayload = InData->GetPayload<FPanoramicImagePixelDataPayload>();
+	check(DataPayload);
+
+	// Accumulation tasks that were already running when the render was abandoned still deliver their pane, drop it right away.
+	if (bAbandoned)
+	{
+		return;
+	}
+
+	// Panes of a frame that repeats the previous one are held back, the first one that doesn't releases them all.
+	TArray<TUniquePtr<FImagePixelData>, TInlineAllocator<1>> PanesToBlend;
+	PanesToBlend.Add(MoveTemp(InData));
+	if (IsHeldFrameDetectionEnabled())
+	{
+		FilterRepeatedPanes(PanesToBlend);
+		if (PanesToBlend.Num() == 0)
+		{
+			return;
+		}
+	}
+
+	bool bLaunchWorker = false;
+	{
+		FScopeLock ScopeLock(&QueuedWorkMutex);
+		for (TUniquePtr<FImagePixelData>& PaneData : PanesToBlend)
+		{
+			FPanoramicBlendWorkItem WorkItem;
+			WorkItem.OutputFrameNumber = PaneData->GetPayload<FPanoramicImagePixelDataPayload>()->SampleState.OutputState.OutputFrameNumber;
+			WorkItem.SequenceNumber = NextSequenceNumber++;
+			WorkItem.PixelData = MoveTemp(PaneData);
+			QueuedWork.HeapPush(MoveTemp(WorkItem), FOlderFrameFirst());
+		}
+
+		if (NumActiveBlendWorkers < MaxBlendWorkers)
+		{
+			NumActiveBlendWorkers++;
+			bLaunchWorker = true;
+			BlendWorkerEvents.RemoveAll([](const FGraphEventRef& Event) { return Event->IsComplete(); });
+		}
+	}
+
+	if (bLaunchWorker)
+	{
+		FGraphEventRef WorkerEvent = FFunctionGraphTask::CreateAndDispatchWhenReady([this]()
+		{
+			BlendWorker_AnyThread();
+		}, TStatId(), nullptr, ENamedThreads::AnyHiPriThreadNormalTask);
+
+		FScopeLock ScopeLock(&QueuedWorkMutex);
+		BlendWorkerEvents.Add(WorkerEvent);
+	}
+}
+
+void FPanoramicBlender::BlendWorker_AnyThread()
+{
+	while (true)
+	{
+		FPanoramicBlendWorkItem WorkItem;
+		{
+			FScopeLock ScopeLock(&QueuedWorkMutex);
+			if (QueuedWork.Num() == 0)
+			{
+				NumActiveBlendWorkers--;
+				return;
+			}
+			// Always the oldest frame, newer frames can't starve a nearly finished one.
+			QueuedWork.HeapPop(WorkItem, FOlderFrameFirst());
+		}
+		// In stereo the first eye of a step waits for the other one, both are blended in one pass over the shared reprojection.
+		// Mono polar panes are blended into both eyes on their own, they have no other eye to wait for. Splatted samples
+		// of the two eyes may not carry the same jitter, they are blended one at a time.
+		const FPanoramicImagePixelDataPayload* DataPayload = WorkItem.PixelData->GetPayload<FPanoramicImagePixelDataPayload>();
+		if (DataPayload->Pane.EyeIndex == -1 || DataPayload->Pane.IsSharedByEyes() || DataPayload->bSplatSample)
+		{
+			BlendPanes_AnyThread(MakeArrayView(&WorkItem.PixelData, 1));
+			continue;
+		}
+
+		TUniquePtr<FImagePixelData> StereoPanes[2];
+		{
+			FScopeLock ScopeLock(&QueuedWorkMutex);
+			const TPair<FIntPoint, FMoviePipelinePassIdentifier> StereoKey(FIntPoint(WorkItem.OutputFrameNumber, DataPayload->Pane.GetStepIndex()), DataPayload->PassIdentifier);
+			TUniquePtr<FImagePixelData>* OtherEye = ParkedStereoPanes.Find(StereoKey);
+			if (!OtherEye)
+			{
+				ParkedStereoPanes.Add(StereoKey, MoveTemp(WorkItem.PixelData));
+				continue;
+			}
+			const int32 EyeIndex = DataPayload->Pane.EyeIndex;
+			StereoPanes[EyeIndex] = MoveTemp(WorkItem.PixelData);
+			StereoPanes[1 - EyeIndex] = MoveTemp(*OtherEye);
+			ParkedStereoPanes.Remove(StereoKey);
+		}
+		BlendPanes_AnyThread(StereoPanes);
+	}
+}
+
+int32 FPanoramicBlender::GetNumOutstandingFrames() const
+{
+	// Frames that only have queued panes haven't been added to PendingData yet, but are still outstanding.
+	TSet<int32> OutstandingFrameNumbers;
+	{
+		FScopeLock ScopeLock(&QueuedWorkMutex);
+		for (const FPanoramicBlendWorkItem& WorkItem : QueuedWork)
+		{
+			OutstandingFrameNumbers.Add(WorkItem.OutputFrameNumber);
+		}
+		for (const TPair<TPair<FIntPoint, FMoviePipelinePassIdentifier>, TUniquePtr<FImagePixelData>>& KVP : ParkedStereoPanes)
+		{
+			OutstandingFrameNumbers.Add(KVP.Key.Key.X);
+		}
+	}
+	{
+		// Held back frames don't have an output frame either.
+		FScopeLock ScopeLock(&HeldFramesMutex);
+		for (const TPair<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>>& KVP : HeldFrames)
+		{
+			if (KVP.Value->HeldPanes.Num() > 0)
+			{
+				OutstandingFrameNumbers.Add(KVP.Key.Key);
+			}
+		}
+	}
+	FScopeLock ScopeLock(&GlobalQueueDataMutex);
+	for (const TPair<TPair<FMoviePipelineFrameOutputState, FMoviePipelinePassIdentifier>, TSharedPtr<FPanoramicOutputFrame>>& KVP : PendingData)
+	{
+		OutstandingFrameNumbers.Add(KVP.Key.Key.OutputFrameNumber);
+	}
+	return OutstandingFrameNumbers.Num();
+}
+
+void FPanoramicBlender::BlendPanes_AnyThread(TArrayView<TUniquePtr<FImagePixelData>> InPanes)
 {
 	SCOPE_CYCLE_COUNTER(STAT_MoviePipeline_PanoBlend);
 	
 	// This function is called whenever a sample is received from the GPU (after summing),
 	// and it needs to process multiple samples from multiple frames at the same time.
 	// The first step is to search to see if we're already printing a frame for this sample
+	// In stereo InPanes holds both eyes of one rig step, they share the reprojection and are blended in a single pass.
+	check(InPanes.Num() > 0);
+	if (bAbandoned)
+	{
+		return;
+	}
 
 	// Output frame
 	TSharedPtr<FPanoramicOutputFrame> OutputFrame = nullptr;
-	// The hybrid data object, which has a bunch of data in it, is used to make panoramas
-	TSharedPtr<FPanoramicBlendData> BlendDataTarget = nullptr;
+	// The hybrid data objects, one per eye, which have a bunch of data in them, are used to make panoramas
+	TArray<TSharedPtr<FPanoramicBlendData>, TInlineAllocator<2>> BlendDataTargets;
 
-	// Panoramic image data load
-	FPanoramicImagePixelDataPayload* DataPayload = InData->GetPayload<FPanoramicImagePixelDataPayload>();
+	// Panoramic image data load, the first pane stands for all of them as they only differ by eye
+	FPanoramicImagePixelDataPayload* DataPayload = InPanes[0]->GetPayload<FPanoramicImagePixelDataPayload>();
 	check(DataPayload);
 
 	// Mixing start time
 	const double BlendStartTime = FPlatformTime::Seconds();
 	
-	//We compute all of this on the task thread right away because it's read-only
-	//and we need the information it computes to allocate memory when we start working on a sample.
-	FIntPoint SampleSize = DataPayload->Pane.Resolution;
 	// 是否启用半透明
 	const bool bIncludeAlpha = DataPayload->Pane.bIncludeAlpha;
-	// SampleRotation
-	FTransform ActorTransform= FTransform(DataPayload->Pane.OriginalCameraRotation,DataPayload->Pane.OriginalCameraLocation,FVector(1.f, 1.f, 1.f));
-	FRotator CameraRotation = FRotator(DataPayload->Pane.CameraRotation);
-	FRotator SampleRotation = ActorTransform.InverseTransformRotation(CameraRotation.Quaternion()).Rotator();
-	
-	// Half horizontal FOV Angle of sample
-	const float SampleHalfHorizontalFoVDegrees = 0.5f * DataPayload->Pane.HorizontalFieldOfView;  
-	// half the vertical FOV angle of the sample
-	const float SampleHalfVerticalFoVDegrees = 0.5f * DataPayload->Pane.VerticalFieldOfView;
-
-	// Calculate the semi-horizontal FOVcoss value
-	const float SampleHalfHorizontalFoVCosine = FMath::Cos(FMath::DegreesToRadians(SampleHalfHorizontalFoVDegrees));
-	// Calculate the semi-vertical FOVcoss value
-	const float SampleHalfVerticalFoVCosine = FMath::Cos(FMath::DegreesToRadians(SampleHalfVerticalFoVDegrees));
-	
-	// Now calculate the direction in which the panoramic pane (represented by this example) was originally oriented.
-	// Radian of the sample Z axis
-	const float SampleYawRad = FMath::DegreesToRadians(SampleRotation.Yaw);
-	// Radian of the X axis of the sample
-	const float SamplePitchRad = FMath::DegreesToRadians(SampleRotation.Pitch);
-	
-	// Sample direction vector, Z axis rotation theta, scalar. Based on world coordinates
-	const FVector SampleDirectionOnTheta = FVector(FMath::Cos(SampleYawRad), FMath::Sin(SampleYawRad), 0);
-	// Sample direction vector, Y axis rotation φ, quantized. Based on world coordinates
-	const FVector SampleDirectionOnPhi = FVector(FMath::Cos(SamplePitchRad), 0.f, FMath::Sin(SamplePitchRad));
-	
-	// Now construct a projection matrix that represents the samples that match the original perspective.
-	const FMatrix SampleProjectionMatrix = FReversedZPerspectiveMatrix(FMath::DegreesToRadians(SampleHalfHorizontalFoVDegrees), SampleSize.X, SampleSize.Y, DataPayload->Pane.NearClippingPlane);
 
-	// For a given output size, figure out how many degrees each pixel represents.
-	const float EquiRectMapThetaStep = 360.f / (float)OutputEquirectangularMapSize.X; 
-	const float EquiRectMapPhiStep = 180.f / (float)OutputEquirectangularMapSize.Y;
-	
-	/************************** The maximum and minimum value of the Z axis direction ************************************/
-	
-	// What is calculated here is the maximum and minimum Yaw of the sample: there is a problem here. When it rotates to 45 degrees, it is diagonally.
-	float SampleYawMin = SampleRotation.Yaw - SampleHalfHorizontalFoVDegrees;
-	float SampleYawMax = SampleRotation.Yaw + SampleHalfHorizontalFoVDegrees;
-	int32 PixelIndexHorzMinBound = FMath::FloorToInt(((SampleYawMin) + 180.f) / EquiRectMapThetaStep);
-	int32 PixelIndexHorzMaxBound = FMath::FloorToInt(((SampleYawMax) + 180.f) / EquiRectMapThetaStep); 
-
-	
-	// About restrictions in the vertical direction
-	float SamplePitchMin = FMath::Max(SampleRotation.Pitch - SampleHalfVerticalFoVDegrees, -90.f); // Clamped to [-90, 90]
-	float SamplePitchMax = FMath::Min(SampleRotation.Pitch + SampleHalfVerticalFoVDegrees, 90.f); // Clamped to [-90, 90]
-	int32 PixelIndexVertMinBound = FMath::Max((OutputEquirectangularMapSize.Y) - FMath::FloorToInt((SamplePitchMax + 90.f) / EquiRectMapPhiStep), 0);
-	int32 PixelIndexVertMaxBound = FMath::Min((OutputEquirectangularMapSize.Y) - FMath::FloorToInt((SamplePitchMin + 90.f) / EquiRectMapPhiStep), OutputEquirectangularMapSize.Y);
+	// Where this pane lands and how much it weighs there only depends on the rig, so it is precomputed once for all frames.
+	TSharedPtr<const FPanoramicRigReprojection, ESPMode::ThreadSafe> Rig = GetRigReprojection(DataPayload->Pane);
+	// Every pane is blended into the eye it was rendered for. A pane shared by the eyes is blended into both, each eye with
+	// its own reprojection of it since the pane is turned differently relative to each eye's camera.
+	const bool bSharedByEyes = DataPayload->Pane.IsSharedByEyes();
+	const int32 NumTargets = bSharedByEyes ? 2 : InPanes.Num();
 
 	// Check the pending items
+	// Set if we started the frame, its bands are allocated by us once the lock is released.
+	bool bAllocateBands = false;
 	{
 		// When we iterate/add the PendingData array, a quick lock is performed so that a second sample does not appear during the iteration.
 		FScopeLock ScopeLock(&GlobalQueueDataMutex);
 		
-		for (TPair<FMoviePipelineFrameOutputState, TSharedPtr<FPanoramicOutputFrame>>& KVP : PendingData)
+		for (TPair<TPair<FMoviePipelineFrameOutputState, FMoviePipelinePassIdentifier>, TSharedPtr<FPanoramicOutputFrame>>& KVP : PendingData)
 		{
-			if (KVP.Key.OutputFrameNumber == DataPayload->SampleState.OutputState.OutputFrameNumber)
+			if (KVP.Key.Key.OutputFrameNumber == DataPayload->SampleState.OutputState.OutputFrameNumber && KVP.Key.Value == DataPayload->PassIdentifier)
 			{
 				OutputFrame = KVP.Value;
 				break;
@@ -183,219 +425,495 @@ void FPanoramicBlender::OnCompleteRenderPassDataAvailable_AnyThread(TUniquePtr<F
 		if (!OutputFrame)
 		{
 			// Start a new output frame in Panorama Mixed frame = Number of output frames for sample state in data load
-			OutputFrame = PendingData.Add(DataPayload->SampleState.OutputState, MakeShared<FPanoramicOutputFrame>());
+			OutputFrame = PendingData.Add(TPair<FMoviePipelineFrameOutputState, FMoviePipelinePassIdentifier>(DataPayload->SampleState.OutputState, DataPayload->PassIdentifier), MakeShared<FPanoramicOutputFrame>());
+			OutputFrame->PassIdentifier = DataPayload->PassIdentifier;
+			if (const EPanoramicAOVBlendMode* AOVBlendMode = Options.AOVBlendModes.Find(DataPayload->PassIdentifier))
+			{
+				OutputFrame->bIsAOV = true;
+				OutputFrame->AOVBlendMode = *AOVBlendMode;
+				OutputFrame->bPlanarDepth = Options.PlanarDepthAOVs.Contains(DataPayload->PassIdentifier);
+			}
 			int32 EyeMultiplier = DataPayload->Pane.EyeIndex == -1 ? 1 : 2;
-			int32 TotalSampleCount = DataPayload->Pane.NumHorizontalSteps * DataPayload->Pane.NumVerticalSteps * EyeMultiplier;
-			OutputFrame->NumSamplesTotal = TotalSampleCount;
+			// Every step of our shard is blended into every eye, shared panes once per eye. With sharding only the panes
+			// of our own shard will ever arrive.
+			int32 FirstStep, LastStep;
+			DataPayload->Pane.GetPaneShardRange(FirstStep, LastStep);
+			int32 TotalSampleCount = (LastStep - FirstStep) * EyeMultiplier;
+			if (DataPayload->bSplatSample)
 			{
-				// Log macro
-				LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendFrameOutput"));
-				// An array of (panoramic pixels) mapped by an isometric cylinder of the output frame. 
-				// Set the number of arrays and fill the data bits to 0
-				OutputFrame->OutputEquirectangularMap.SetNumZeroed(OutputEquirectangularMapSize.X * OutputEquirectangularMapSize.Y * EyeMultiplier);
-				if(bIncludeAlpha)
-				{
-					OutputFrame->AlphaArray.SetNumZeroed(OutputEquirectangularMapSize.X * OutputEquirectangularMapSize.Y * EyeMultiplier);
-				}
+				TotalSampleCount *= DataPayload->SampleState.SpatialSampleCount * DataPayload->SampleState.TemporalSampleCount;
 			}
+			OutputFrame->NumSamplesTotal = TotalSampleCount;
+			OutputFrame->EyeRowBounds.Init(FIntPoint(MAX_int32, 0), EyeMultiplier);
+			// Only the empty bands go in here, zeroing a frame's worth of them would hold every other pane at this lock.
+			OutputFrame->Bands.SetNum(GetNumBandsPerEye() * EyeMultiplier);
+			bAllocateBands = true;
 		}
 	}
+	if (bAllocateBands)
+	{
+		// Log macro
+		LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendFrameOutput"));
+		// An array of (panoramic pixels) mapped by an isometric cylinder of the output frame, split into bands of rows.
+		// Fill the data bits to 0
+		const int32 NumBandsPerEye = GetNumBandsPerEye();
+		const bool bSelectionWeights = OutputFrame->bIsAOV && OutputFrame->AOVBlendMode == EPanoramicAOVBlendMode::NearestMaxWeight;
+		// The OS places a page on the memory node of the thread that writes it first. Zeroing every band on a different
+		// worker spreads the frame over all nodes of a multi socket machine, instead of putting all of it next to the
+		// thread that happened to start the frame, so blending and finalize use the bandwidth of every memory controller.
+		ParallelFor(OutputFrame->Bands.Num(), [&](int32 BandIndex)
+		{
+			LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendFrameOutput"));
+			FPanoramicAccumulationBand& Band = OutputFrame->Bands[BandIndex];
+			Band.Height = GetBandHeight(BandIndex % NumBandsPerEye);
+			const int32 NumBandPixels = Band.Height * OutputEquirectangularMapSize.X;
+			Band.Color.SetNumZeroed(NumBandPixels);
+			if (bSelectionWeights)
+			{
+				Band.SelectionWeight.SetNumZeroed(NumBandPixels);
+			}
+		});
+		OutputFrame->BandsReadyEvent->Trigger();
+	}
 	
 	// Now that we know which output frame we are contributing to,
 	// we will ask it for our own copy of the data so that we can mix without worrying about other threads.
 
 	// Check whether there is something in the output frame object, add it if not, and create a storage space by the way.
 	check(OutputFrame);
+	const bool bSelectMaxWeight = OutputFrame->bIsAOV && OutputFrame->AOVBlendMode == EPanoramicAOVBlendMode::NearestMaxWeight;
 	{
 		FScopeLock ScopeLock(&GlobalQueueDataMutex);
-		BlendDataTarget = MakeShared<FPanoramicBlendData>();
-		BlendDataTarget->EyeIndex = DataPayload->Pane.EyeIndex;
-		BlendDataTarget->bFinished = false;
-		BlendDataTarget->OriginalDataPayload = StaticCastSharedRef<FPanoramicImagePixelDataPayload>(DataPayload->Copy());
-		// In fact, this is just adding in, if you find this array of eyes
-		TArray<TSharedPtr<FPanoramicBlendData>>& EyeArray = OutputFrame->BlendedData.FindOrAdd(DataPayload->Pane.EyeIndex);
-		EyeArray.Add(BlendDataTarget);
+		for (int32 TargetIndex = 0; TargetIndex < NumTargets; TargetIndex++)
+		{
+			const FPanoramicImagePixelDataPayload* PanePayload = InPanes[bSharedByEyes ? 0 : TargetIndex]->GetPayload<FPanoramicImagePixelDataPayload>();
+			TSharedPtr<FPanoramicBlendData> BlendDataTarget = MakeShared<FPanoramicBlendData>();
+			BlendDataTarget->EyeIndex = bSharedByEyes ? TargetIndex : PanePayload->Pane.EyeIndex;
+			BlendDataTarget->SourcePaneIndex = bSharedByEyes ? 0 : TargetIndex;
+			BlendDataTarget->Reprojection = &Rig->GetPane(PanePayload->Pane.HorizontalStepIndex, PanePayload->Pane.VerticalStepIndex, BlendDataTarget->EyeIndex);
+			BlendDataTarget->WeightScale = PanePayload->bSplatSample ? 1.f / (PanePayload->SampleState.SpatialSampleCount * PanePayload->SampleState.TemporalSampleCount) : 1.f;
+			BlendDataTarget->bFinished = false;
+			BlendDataTarget->OriginalDataPayload = StaticCastSharedRef<FPanoramicImagePixelDataPayload>(PanePayload->Copy());
+			// In fact, this is just adding in, if you find this array of eyes
+			TArray<TSharedPtr<FPanoramicBlendData>>& EyeArray = OutputFrame->BlendedData.FindOrAdd(BlendDataTarget->EyeIndex);
+			EyeArray.Add(BlendDataTarget);
+			BlendDataTargets.Add(BlendDataTarget);
+		}
 	}
 	
-	// Ok, so our BlendDataTarget is now the only copy of the data we want to process ourselves.
-	BlendDataTarget->BlendStartTime = BlendStartTime;
-	// Build a rectangle that describes which part of the output Map we will render to
-	BlendDataTarget->OutputBoundsMin = FIntPoint(PixelIndexHorzMinBound, PixelIndexVertMinBound);
-	BlendDataTarget->OutputBoundsMax = FIntPoint(PixelIndexHorzMaxBound, PixelIndexVertMaxBound);
+	// Ok, so our BlendDataTargets are now the only copy of the data we want to process ourselves.
+	for (const TSharedPtr<FPanoramicBlendData>& BlendDataTarget : BlendDataTargets)
+	{
+		BlendDataTarget->BlendStartTime = BlendStartTime;
+		// Build a rectangle that describes which part of the output Map we will render to
+		BlendDataTarget->OutputBoundsMin = BlendDataTarget->Reprojection->Projection.OutputBoundsMin;
+		BlendDataTarget->OutputBoundsMax = BlendDataTarget->Reprojection->Projection.OutputBoundsMax;
 
-	// Mixed data object (Pane) pixel width and height, which is equivalent to the process of drawing a grid.
-	BlendDataTarget->PixelWidth = BlendDataTarget->OutputBoundsMax.X - BlendDataTarget->OutputBoundsMin.X;
-	BlendDataTarget->PixelHeight = BlendDataTarget->OutputBoundsMax.Y - BlendDataTarget->OutputBoundsMin.Y;
+		// Mixed data object (Pane) pixel width and height, which is equivalent to the process of drawing a grid.
+		BlendDataTarget->PixelWidth = BlendDataTarget->OutputBoundsMax.X - BlendDataTarget->OutputBoundsMin.X;
+		BlendDataTarget->PixelHeight = BlendDataTarget->OutputBoundsMax.Y - BlendDataTarget->OutputBoundsMin.Y;
 
-	// These need to be zeroed as we don't always touch every pixel in the rect with blending
-	// and they get +=
-	{
-		LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendPerTaskOutput"));
-		BlendDataTarget->Data.SetNumZeroed((BlendDataTarget->PixelWidth) * (BlendDataTarget->PixelHeight));
-		if(bIncludeAlpha)
+		// These need to be zeroed as we don't always touch every pixel in the rect with blending
+		// and they get +=
 		{
-			BlendDataTarget->AlphaArray.SetNumZeroed((BlendDataTarget->PixelWidth) * (BlendDataTarget->PixelHeight));
+			LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendPerTaskOutput"));
+			BlendDataTarget->Data.SetNumZeroed((int64)BlendDataTarget->PixelWidth * BlendDataTarget->PixelHeight);
 		}
-		
 	}
 
 	/***************************************** Pixel processing process ******************************************************/
 	
-	// Finally, we can perform the actual blending, which we mix into the intermediate buffer rather than the final output array to avoid multiple threads contending for pixels
-	for (int32 Y = PixelIndexVertMinBound; Y < PixelIndexVertMaxBound; Y++)
+	// Finally, we can perform the actual blending, which we mix into the intermediate buffer rather than the final output array to avoid multiple threads contending for pixels.
+	// The weights are already normalized across the rig, so what we add up here is the final value.
+	// Each eye's panorama is relative to its own converged camera, so both eyes sample their pane at the same coordinate:
+	// the tap and filter footprint are looked up once and only the texel fetches and weights are per eye.
+	TArray<const void*, TInlineAllocator<2>> PaneRawData;
+	for (const TUniquePtr<FImagePixelData>& PaneData : InPanes)
+	{
+		int64 SizeInBytes = 0;
+		const void* RawData = nullptr;
+		PaneData->GetRawData(RawData, SizeInBytes);
+		PaneRawData.Add(RawData);
+	}
+	TArray<const void*, TInlineAllocator<2>> TargetRawData;
+	for (const TSharedPtr<FPanoramicBlendData>& BlendDataTarget : BlendDataTargets)
+	{
+		TargetRawData.Add(PaneRawData[BlendDataTarget->SourcePaneIndex]);
+	}
+	const FIntPoint SampleSize = InPanes[0]->GetSize();
+	const EImagePixelType SamplePixelType = InPanes[0]->GetType();
+
+	const FPanoramicResampleKernel& Kernel = Rig->GetKernel();
+	// A splatted sample was rendered with its projection shifted by SpatialShift pixels, what the un-jittered pane shows at a
+	// position it shows that much further right and down. Every tap moves with it, the rig's weights don't change.
+	const bool bSplatSample = DataPayload->bSplatSample;
+	const FIntPoint SplatTapOffset = bSplatSample ? FIntPoint(
+		FMath::RoundToInt(DataPayload->SampleState.SpatialShiftX * FPanoramicSampleTap::NumPhases),
+		FMath::RoundToInt(DataPayload->SampleState.SpatialShiftY * FPanoramicSampleTap::NumPhases)) : FIntPoint::ZeroValue;
+	// Normalized weight of every entry of every target, the eyes of a step may weigh it differently next to shared rows.
+	// The merge of selected layers needs them too.
+	TArray<const float*, TInlineAllocator<2>> EntryWeights;
+	TArray<TArray64<float>, TInlineAllocator<2>> StreamedWeights;
+	StreamedWeights.SetNum(NumTargets);
+	for (const TSharedPtr<FPanoramicBlendData>& BlendDataTarget : BlendDataTargets)
+	{
+		EntryWeights.Add(BlendDataTarget->Reprojection->GetWeights(BlendDataTarget->EyeIndex));
+	}
+	// A previous run already blended this step, its checkpoint stands in for sampling the pane. One that doesn't fit the
+	// rig leaves the step empty rather than failing the frame.
+	const bool bRestoreFromCheckpoint = DataPayload->bRestoreFromCheckpoint;
+	if (bRestoreFromCheckpoint)
 	{
-		for (int32 X = PixelIndexHorzMinBound; X < PixelIndexHorzMaxBound; X++)
+		RestorePaneCheckpoint(BlendDataTargets, StreamedWeights, *DataPayload);
+		for (int32 TargetIndex = 0; TargetIndex < NumTargets && bSelectMaxWeight; TargetIndex++)
 		{
-			// These X-ray coordinates are in the output resolution space, and this is where we want to mix them.
-			// Our X limit may be OOB, but we wrap horizontally, so we need to find the appropriate X index.
-			const int32 OutputPixelX = ((X % OutputEquirectangularMapSize.X) + OutputEquirectangularMapSize.X) % OutputEquirectangularMapSize.X;
-			const int32 OutputPixelY = Y;
-			
-			// Obtain the spherical coordinates (Theta and Phi) corresponding to the X and Y of the isometric map coordinates,
-			// converted to the [-180,180] and [-90, 90] coordinate Spaces, respectively.
-			// The half-pixel offset is used so that the center of the pixel is treated as that coordinate, and Phi increases in the opposite direction to Y.
-			// Add or subtract 0.5 to shift to the center of the pixel
-			const float Theta = EquiRectMapThetaStep * (((float)OutputPixelX) + 0.5f) - 180.f;
-			const float Phi = EquiRectMapPhiStep * (((float)OutputEquirectangularMapSize.Y - OutputPixelY) + 0.5f) - 90.f;
-
-			// Now convert the spherical coordinates into an actual direction (on the output map)
-		
-			// Convert to radians for subsequent calculations
-			const float ThetaDeg = FMath::DegreesToRadians(Theta);
-			const float PhiDeg = FMath::DegreesToRadians(Phi);
-			// The output direction of the pixel
-			const FVector OutputDirection(FMath::Cos(PhiDeg) * FMath::Cos(ThetaDeg), FMath::Cos(PhiDeg) * FMath::Sin(ThetaDeg), FMath::Sin(PhiDeg));
-			// Pixel output direction Theta
-			const FVector OutputDirectionTheta = FVector(FMath::Cos(ThetaDeg), FMath::Sin(ThetaDeg), 0);
-			// Pixel output direction Phi
-			const FVector OutputDirectionPhi = FVector(FMath::Cos(PhiDeg), 0.f, FMath::Sin(PhiDeg));
-
-			// Now we can compute how much the sample should influence this pixel. It is weighted by angular distance to the direction
-			// so that the edges have less influence (where they'd be more distorted anyways).
-			// ToDo: This only considers the whole Pano Pane and not per pixel of sample?
-			const float DirectionThetaDot = FVector::DotProduct(OutputDirectionTheta, SampleDirectionOnTheta);
-			const float DirectionPhiDot = FVector::DotProduct(OutputDirectionPhi, SampleDirectionOnPhi);
-			const float WeightTheta = FMath::Max(DirectionThetaDot - SampleHalfHorizontalFoVCosine, 0.0f) / (1.0f - SampleHalfHorizontalFoVCosine);
-			const float WeightPhi = FMath::Max(DirectionPhiDot - SampleHalfVerticalFoVCosine, 0.0f) / (1.0f - SampleHalfVerticalFoVCosine);
-			const float SampleWeight = WeightTheta * WeightPhi;
-			const float SampleWeightSquared = SampleWeight* SampleWeight; // Exponential falloff produces a nicer blending result.
-
-			// The sample weight may be very small and not worth influencing this pixel.
-			if (SampleWeightSquared > KINDA_SMALL_NUMBER)
-			{
-				FVector4 DirectionInSampleWorldSpace = FVector4(SampleRotation.UnrotateVector(OutputDirection), 1.0f);
-				static const FMatrix UnrealCoordinateConversion = FMatrix(
-					FPlane(0, 0, 1, 0),
-					FPlane(1, 0, 0, 0),
-					FPlane(0, 1, 0, 0),
-					FPlane(0, 0, 0, 1));
-				DirectionInSampleWorldSpace = UnrealCoordinateConversion.TransformFVector4(DirectionInSampleWorldSpace);
-				// Then project that direction into sample clip space
-				FVector4 DirectionInSampleClipSpace = SampleProjectionMatrix.TransformFVector4(DirectionInSampleWorldSpace);
-
-				// Converted into normalized device space (Divide by w for perspective)
-				FVector DirectionInSampleNDSpace = FVector(DirectionInSampleClipSpace) / DirectionInSampleClipSpace.W;
-
-				// Get the final pixel coordinates (direction in screen space)
-				FVector2D DirectionInSampleScreenSpace = ((FVector2D(DirectionInSampleNDSpace) + 1.0f) / 2.0f) * FVector2D(SampleSize.X, SampleSize.Y);
-				
-				// Flip the Y value due to Y's zero coordinate being top left.
-				DirectionInSampleScreenSpace.Y = ((float)SampleSize.Y - DirectionInSampleScreenSpace.Y) - 1.0f;
-				// What is calculated here is the position of the pixels in the screen at the pixel coordinates (from the sample) execute a bilinear color sample, weight it,
-				// and add it to the output map. We store the weights separately so that we can preserve the alpha channel of the main image.
-				bool bClipped = false;
-				FLinearColor SampleColor = GetColorBilinearFiltered(InData.Get(), DirectionInSampleScreenSpace, bClipped, bIncludeAlpha);
-				
-				if (!bClipped)
+			EntryWeights[TargetIndex] = StreamedWeights[TargetIndex].GetData();
+		}
+	}
+	else if (Rig->IsStreaming() && bSelectMaxWeight)
+	{
+		for (int32 TargetIndex = 0; TargetIndex < NumTargets; TargetIndex++)
+		{
+			StreamedWeights[TargetIndex].SetNumZeroed(BlendDataTargets[TargetIndex]->Data.Num());
+			EntryWeights[TargetIndex] = StreamedWeights[TargetIndex].GetData();
+		}
+	}
+	// Parts of this pane are denser than the output: prefilter it once for the whole pane, deep enough for every eye it goes to.
+	TArray<MoviePipeline::Panoramic::FPaneMipChain, TInlineAllocator<2>> PaneMips;
+	int32 NumPaneMipLevels = 1;
+	for (const TSharedPtr<FPanoramicBlendData>& BlendDataTarget : BlendDataTargets)
+	{
+		NumPaneMipLevels = FMath::Max(NumPaneMipLevels, BlendDataTarget->Reprojection->NumMipLevels);
+	}
+	if (!bRestoreFromCheckpoint && !Rig->IsStreaming() && !bSelectMaxWeight && Options.bMipFiltering && NumPaneMipLevels > 1)
+	{
+		PaneMips.SetNum(InPanes.Num());
+		for (int32 PaneIndex = 0; PaneIndex < InPanes.Num(); PaneIndex++)
+		{
+			PaneMips[PaneIndex].Build(PaneRawData[PaneIndex], SamplePixelType, SampleSize, NumPaneMipLevels);
+		}
+	}
+
+	// A shared pane has a reprojection per eye, it is sampled once for each.
+	const int32 NumSamplingPasses = bSharedByEyes ? 2 : 1;
+	for (int32 SamplingPass = 0; SamplingPass < NumSamplingPasses && !bRestoreFromCheckpoint; SamplingPass++)
+	{
+		const int32 TargetBegin = bSharedByEyes ? SamplingPass : 0;
+		const int32 TargetEnd = bSharedByEyes ? SamplingPass + 1 : NumTargets;
+		const FPanoramicPaneReprojection& PaneReprojection = *BlendDataTargets[TargetBegin]->Reprojection;
+		auto GetSampleTap = [&PaneReprojection, bSplatSample, SplatTapOffset](int64 InEntryIndex)
+		{
+			const FPanoramicSampleTap& Tap = PaneReprojection.SampleTaps[InEntryIndex];
+			return bSplatSample ? Tap.GetOffset(SplatTapOffset) : Tap;
+		};
+		const int64 NumEntries = (int64)PaneReprojection.Projection.GetPixelWidth() * PaneReprojection.Projection.GetPixelHeight();
+
+		// Panes are sampled in bands of AccumulationBandHeight rows, an abandoned render stops at the next band.
+		const int64 NumEntriesPerBand = (int64)PaneReprojection.Projection.GetPixelWidth() * AccumulationBandHeight;
+		for (int64 BandBegin = 0; BandBegin < NumEntries; BandBegin += NumEntriesPerBand)
+		{
+			if (bAbandoned)
+			{
+				// Dropping our references frees the scratch buffers, the output frame already left PendingData.
+				return;
+			}
+			const int64 BandEnd = FMath::Min(BandBegin + NumEntriesPerBand, NumEntries);
+			if (Rig->IsStreaming())
+			{
+				// Low memory rigs have no tables: project the pane one row at a time and normalize with the eye's coverage.
+				const FPanoramicPaneProjection& Projection = PaneReprojection.Projection;
+				const int32 PixelWidth = Projection.GetPixelWidth();
+				TArray<float> RowWeights;
+				TArray<FPanoramicSampleTap> RowTaps;
+				RowWeights.SetNumUninitialized(PixelWidth);
+				RowTaps.SetNumUninitialized(PixelWidth);
+				for (int32 LocalY = (int32)(BandBegin / PixelWidth); LocalY < (int32)(BandEnd / PixelWidth); LocalY++)
+				{
+					const int32 OutputPixelY = LocalY + Projection.OutputBoundsMin.Y;
+					Projection.ProjectRow(OutputPixelY, RowWeights.GetData(), RowTaps.GetData());
+					for (int32 LocalX = 0; LocalX < PixelWidth; LocalX++)
+					{
+						if (RowWeights[LocalX] <= 0.f)
+						{
+							continue;
+						}
+						const int32 OutputPixelX = ((LocalX + Projection.OutputBoundsMin.X) % OutputEquirectangularMapSize.X + OutputEquirectangularMapSize.X) % OutputEquirectangularMapSize.X;
+						const int64 EntryIndex = LocalX + (int64)LocalY * PixelWidth;
+						const FPanoramicSampleTap Tap = bSplatSample ? RowTaps[LocalX].GetOffset(SplatTapOffset) : RowTaps[LocalX];
+						auto GetSampleWeight = [&](int32 InTargetIndex)
+						{
+							return RowWeights[LocalX] * Rig->GetInverseCoverage(OutputPixelX, OutputPixelY, BlendDataTargets[InTargetIndex]->EyeIndex);
+						};
+						if (bSelectMaxWeight)
+						{
+							const int64 NearestIndex = MoviePipeline::Panoramic::GetNearestPixelIndex(Tap, SampleSize);
+							for (int32 TargetIndex = TargetBegin; TargetIndex < TargetEnd; TargetIndex++)
+							{
+								StreamedWeights[TargetIndex][EntryIndex] = GetSampleWeight(TargetIndex);
+								BlendDataTargets[TargetIndex]->Data[EntryIndex] = MoviePipeline::Panoramic::GetPixel(TargetRawData[TargetIndex], SamplePixelType, NearestIndex);
+							}
+						}
+						else if (Kernel.bNearest)
+						{
+							const int64 NearestIndex = MoviePipeline::Panoramic::GetNearestPixelIndex(Tap, SampleSize);
+							for (int32 TargetIndex = TargetBegin; TargetIndex < TargetEnd; TargetIndex++)
+							{
+								FLinearColor SampleColor = MoviePipeline::Panoramic::GetPixel(TargetRawData[TargetIndex], SamplePixelType, NearestIndex);
+								if (!bIncludeAlpha)
+								{
+									SampleColor.A = 1.0f;
+								}
+								BlendDataTargets[TargetIndex]->Data[EntryIndex] += SampleColor * GetSampleWeight(TargetIndex);
+							}
+						}
+						else
+						{
+							const MoviePipeline::Panoramic::FFilterFootprint Footprint(Tap, Kernel, SampleSize);
+							for (int32 TargetIndex = TargetBegin; TargetIndex < TargetEnd; TargetIndex++)
+							{
+								BlendDataTargets[TargetIndex]->Data[EntryIndex] += Footprint.Sample(TargetRawData[TargetIndex], SamplePixelType, bIncludeAlpha) * GetSampleWeight(TargetIndex);
+							}
+						}
+					}
+				}
+			}
+			else if (bSelectMaxWeight)
+			{
+				// Values that can't be mixed (depth, IDs) take the nearest texel unweighted, the merge keeps the most weighted pane.
+				for (int64 EntryIndex = BandBegin; EntryIndex < BandEnd; EntryIndex++)
+				{
+					if (PaneReprojection.Weights[EntryIndex] > 0.f)
+					{
+						const int64 NearestIndex = MoviePipeline::Panoramic::GetNearestPixelIndex(GetSampleTap(EntryIndex), SampleSize);
+						for (int32 TargetIndex = TargetBegin; TargetIndex < TargetEnd; TargetIndex++)
+						{
+							BlendDataTargets[TargetIndex]->Data[EntryIndex] = MoviePipeline::Panoramic::GetPixel(TargetRawData[TargetIndex], SamplePixelType, NearestIndex);
+						}
+					}
+				}
+			}
+			else if (PaneMips.Num() > 0)
+			{
+				// Blend between the two levels around each pixel's footprint like trilinear filtering.
+				// Where the pane isn't denser the selected filter reads the pane itself.
+				const int32 NumMipLevels = PaneReprojection.NumMipLevels;
+				for (int64 EntryIndex = BandBegin; EntryIndex < BandEnd; EntryIndex++)
+				{
+					if (PaneReprojection.Weights[EntryIndex] <= 0.f)
+					{
+						continue;
+					}
+					const FPanoramicSampleTap Tap = GetSampleTap(EntryIndex);
+					const float Lod = Tap.GetLod();
+					const int32 Level = FMath::Min(FMath::FloorToInt(Lod), NumMipLevels - 1);
+					const float LevelFraction = Level < NumMipLevels - 1 ? Lod - Level : 0.f;
+
+					TOptional<MoviePipeline::Panoramic::FFilterFootprint> Footprint;
+					if (Level == 0 && !Kernel.bNearest)
+					{
+						Footprint.Emplace(Tap, Kernel, SampleSize);
+					}
+					for (int32 TargetIndex = TargetBegin; TargetIndex < TargetEnd; TargetIndex++)
+					{
+						FLinearColor SampleColor;
+						if (Level > 0)
+						{
+							SampleColor = PaneMips[BlendDataTargets[TargetIndex]->SourcePaneIndex].SampleBilinear(Level, Tap);
+						}
+						else if (Footprint.IsSet())
+						{
+							SampleColor = Footprint->Sample(TargetRawData[TargetIndex], SamplePixelType, true);
+						}
+						else
+						{
+							SampleColor = MoviePipeline::Panoramic::GetPixel(TargetRawData[TargetIndex], SamplePixelType, MoviePipeline::Panoramic::GetNearestPixelIndex(Tap, SampleSize));
+						}
+						if (LevelFraction > 0.f)
+						{
+							SampleColor = FMath::Lerp(SampleColor, PaneMips[BlendDataTargets[TargetIndex]->SourcePaneIndex].SampleBilinear(Level + 1, Tap), LevelFraction);
+						}
+						if (!bIncludeAlpha)
+						{
+							SampleColor.A = 1.0f;
+						}
+						BlendDataTargets[TargetIndex]->Data[EntryIndex] += SampleColor * EntryWeights[TargetIndex][EntryIndex];
+					}
+				}
+			}
+			else if (Kernel.bNearest)
+			{
+				// Drafts: a single fetch per pixel, still weighted across the panes.
+				for (int64 EntryIndex = BandBegin; EntryIndex < BandEnd; EntryIndex++)
+				{
+					if (PaneReprojection.Weights[EntryIndex] > 0.f)
+					{
+						const int64 NearestIndex = MoviePipeline::Panoramic::GetNearestPixelIndex(GetSampleTap(EntryIndex), SampleSize);
+						for (int32 TargetIndex = TargetBegin; TargetIndex < TargetEnd; TargetIndex++)
+						{
+							FLinearColor SampleColor = MoviePipeline::Panoramic::GetPixel(TargetRawData[TargetIndex], SamplePixelType, NearestIndex);
+							if (!bIncludeAlpha)
+							{
+								SampleColor.A = 1.0f;
+							}
+							BlendDataTargets[TargetIndex]->Data[EntryIndex] += SampleColor * EntryWeights[TargetIndex][EntryIndex];
+						}
+					}
+				}
+			}
+			else
+			{
+				for (int64 EntryIndex = BandBegin; EntryIndex < BandEnd; EntryIndex++)
 				{
-					// When we calculate the actual output position, we need to move X/Y. This is because until now, the math has been done in the output resolution space, but each sample is only assigned a large enough color plot.
-					// It will be moved back to the correct position.
-					int32 SampleOutputX = OutputPixelX - BlendDataTarget->OutputBoundsMin.X;
-					// Mod this again by our output map so we don't OOB on it. It'll wrap weirdly in the output map but should restore fine.
-					SampleOutputX = ((SampleOutputX % (BlendDataTarget->PixelWidth)) + (BlendDataTarget->PixelWidth)) % (BlendDataTarget->PixelWidth); // Positive Mod
-					int32 SampleOutputY = Y;
-					SampleOutputY -= BlendDataTarget->OutputBoundsMin.Y;
-						
-					const int32 FinalIndex = SampleOutputX + (SampleOutputY * (BlendDataTarget->PixelWidth));
-					BlendDataTarget->Data[FinalIndex] += SampleColor * SampleWeightSquared;
-					if(bIncludeAlpha)
+					if (PaneReprojection.Weights[EntryIndex] > 0.f)
 					{
-						BlendDataTarget->AlphaArray[FinalIndex] += SampleWeightSquared;
+						const MoviePipeline::Panoramic::FFilterFootprint Footprint(GetSampleTap(EntryIndex), Kernel, SampleSize);
+						for (int32 TargetIndex = TargetBegin; TargetIndex < TargetEnd; TargetIndex++)
+						{
+							const FLinearColor SampleColor = Footprint.Sample(TargetRawData[TargetIndex], SamplePixelType, bIncludeAlpha);
+							BlendDataTargets[TargetIndex]->Data[EntryIndex] += SampleColor * EntryWeights[TargetIndex][EntryIndex];
+						}
 					}
-					// OutputEquirectangularMap[OutputPixelX + (OutputPixelY * OutputEquirectangularMapSize.X)] += SampleColor * SampleWeightSquared; // ToDo move to weight map.
 				}
 			}
 		}
 	}
-	
-	BlendDataTarget->BlendEndTime = FPlatformTime::Seconds();
 
-	/************************************ The main work in this section is pixel mapping **************************************/
-	// Mix the new sample into the output map as soon as possible so that we can free up the temporary memory occupied by the sample.
-	// This part is single-threaded (as opposed to other tasks).
+	// Planar depth measures along each pane's own forward axis, so overlapping panes disagree. The distance along the
+	// output direction is the same in every pane. Scaling the weighted samples scales the values, weights are untouched.
+	// Checkpoints hold the converted values.
+	if (OutputFrame->bPlanarDepth && !bRestoreFromCheckpoint)
 	{
-		// Lock access to our output map
-		FScopeLock ScopeLock(&OutputDataMutex);
-		
-		int32 EyeOffset = 0;
-		// If the window number of the original data payload of the mixed data target is not equal to -1
-		if (BlendDataTarget->OriginalDataPayload->Pane.EyeIndex != -1)
-		{
-			EyeOffset = (OutputEquirectangularMapSize.X * OutputEquirectangularMapSize.Y) * BlendDataTarget->OriginalDataPayload->Pane.EyeIndex;
-		}
-		// Traversal of sample Y when the position of sample Y is < less than the mixed data target. High pixel;
-		for (int32 SampleY = 0; SampleY < BlendDataTarget->PixelHeight; SampleY++)
-		{
-			for (int32 SampleX = 0; SampleX < BlendDataTarget->PixelWidth; SampleX++)
-			{
-				int32 OriginalX = SampleX + BlendDataTarget->OutputBoundsMin.X;
-				int32 OriginalY = SampleY + BlendDataTarget->OutputBoundsMin.Y;
-				
-				const int32 OutputPixelX = ((OriginalX % OutputEquirectangularMapSize.X) + OutputEquirectangularMapSize.X) % OutputEquirectangularMapSize.X;
-				const int32 OutputPixelY = OriginalY;
-				
-				int32 SourceIndex = SampleX + (SampleY * (BlendDataTarget->PixelWidth));
-				int32 DestIndex = OutputPixelX + (OutputPixelY * OutputEquirectangularMapSize.X);
-				OutputFrame->OutputEquirectangularMap[DestIndex + EyeOffset] += BlendDataTarget->Data[SourceIndex];
-				if(bIncludeAlpha)
+		for (const TSharedPtr<FPanoramicBlendData>& BlendDataTarget : BlendDataTargets)
+		{
+			const FPanoramicPaneProjection& Projection = BlendDataTarget->Reprojection->Projection;
+			const int32 PixelWidth = BlendDataTarget->PixelWidth;
+			ParallelFor(BlendDataTarget->PixelHeight, [&](int32 LocalY)
+			{
+				FLinearColor* Row = BlendDataTarget->Data.GetData() + (int64)LocalY * PixelWidth;
+				for (int32 LocalX = 0; LocalX < PixelWidth; LocalX++)
 				{
-					OutputFrame->AlphaArray[DestIndex + EyeOffset] += BlendDataTarget->AlphaArray[SourceIndex];
+					const float Scale = Projection.GetRadialDepthScale(LocalX + BlendDataTarget->OutputBoundsMin.X, LocalY + BlendDataTarget->OutputBoundsMin.Y);
+					Row[LocalX].R *= Scale;
+					Row[LocalX].G *= Scale;
+					Row[LocalX].B *= Scale;
 				}
-			}
+			});
 		}
-		
- 		bool bDebugSamples = DataPayload->SampleState.bWriteSampleToDisk;
-		if (bDebugSamples)
+	}
+
+	if (Options.bCheckpointPanes && !bRestoreFromCheckpoint)
+	{
+		WritePaneCheckpoint(BlendDataTargets, bSelectMaxWeight ? TArrayView<const float* const>(EntryWeights) : TArrayView<const float* const>(), *DataPayload);
+	}
+
+	const double BlendEndTime = FPlatformTime::Seconds();
+
+	/************************************ The main work in this section is pixel mapping **************************************/
+	// Mix the new samples into the output map as soon as possible so that we can free up the temporary memory occupied by the samples.
+	// Every band has a lock of its own, so panes of the same frame are merged at the same time as long as they cover different rows.
+	{
+		// The pane that started the frame may still be zeroing its bands, our own blending above didn't need them.
+		OutputFrame->BandsReadyEvent->Wait();
+		// Stereo eyes are stacked, the bands of the right eye follow the ones of the left eye, so every eye is written to its own contiguous half.
+		const int32 NumBandsPerEye = GetNumBandsPerEye();
+		for (int32 TargetIndex = 0; TargetIndex < NumTargets; TargetIndex++)
 		{
-			// Write each blended sample to the output as a debug sample so we can inspect the job blending is doing for each pane.
-			// Hack up the debug output name a bit so they're unique.
-			if (BlendDataTarget->OriginalDataPayload->Pane.EyeIndex >= 0)
+			const TSharedPtr<FPanoramicBlendData>& BlendDataTarget = BlendDataTargets[TargetIndex];
+			if (bAbandoned)
 			{
-				BlendDataTarget->OriginalDataPayload->Debug_OverrideFilename = FString::Printf(TEXT("/%s_PaneX_%d_PaneY_%dEye_%d-Blended.%d"),
-					*BlendDataTarget->OriginalDataPayload->PassIdentifier.Name, BlendDataTarget->OriginalDataPayload->Pane.HorizontalStepIndex,
-					BlendDataTarget->OriginalDataPayload->Pane.VerticalStepIndex, DataPayload->Pane.EyeIndex, BlendDataTarget->OriginalDataPayload->SampleState.OutputState.OutputFrameNumber);
+				return;
 			}
-			else
+			BlendDataTarget->BlendEndTime = BlendEndTime;
+			const int32 EyeBandOffset = BlendDataTarget->EyeIndex != -1 ? NumBandsPerEye * BlendDataTarget->EyeIndex : 0;
+			const float* TargetEntryWeights = EntryWeights[TargetIndex];
+			const FLinearColor* SourceColor = BlendDataTarget->Data.GetData();
+			const float WeightScale = BlendDataTarget->WeightScale;
+			const int32 PixelWidth = BlendDataTarget->PixelWidth;
+			const int32 FirstBand = BlendDataTarget->OutputBoundsMin.Y / AccumulationBandHeight;
+			const int32 EndBand = BlendDataTarget->PixelHeight > 0 ? (BlendDataTarget->OutputBoundsMax.Y - 1) / AccumulationBandHeight + 1 : FirstBand;
+			for (int32 BandIndexInEye = FirstBand; BandIndexInEye < EndBand; BandIndexInEye++)
+			{
+				FPanoramicAccumulationBand& Band = OutputFrame->Bands[EyeBandOffset + BandIndexInEye];
+				const int32 BandFirstRow = BandIndexInEye * AccumulationBandHeight;
+				const int32 FirstSampleY = FMath::Max(BandFirstRow, BlendDataTarget->OutputBoundsMin.Y) - BlendDataTarget->OutputBoundsMin.Y;
+				const int32 EndSampleY = FMath::Min(BandFirstRow + Band.Height, BlendDataTarget->OutputBoundsMax.Y) - BlendDataTarget->OutputBoundsMin.Y;
+
+				FScopeLock BandLock(&Band.Mutex);
+				// Walk the pane in runs of columns that stay inside one tile (so never across the horizontal seam either),
+				// all rows of a run go to the same contiguous tile.
+				for (int32 RunBegin = 0; RunBegin < PixelWidth;)
+				{
+					const int32 OriginalX = RunBegin + BlendDataTarget->OutputBoundsMin.X;
+					const int32 OutputPixelX = ((OriginalX % OutputEquirectangularMapSize.X) + OutputEquirectangularMapSize.X) % OutputEquirectangularMapSize.X;
+					const int32 TileBegin = OutputPixelX - OutputPixelX % AccumulationTileWidth;
+					const int32 TileWidth = GetTileWidth(TileBegin);
+					const int32 RunLength = FMath::Min(PixelWidth - RunBegin, TileBegin + TileWidth - OutputPixelX);
+					const int64 TileOffset = (int64)TileBegin * Band.Height;
+					FLinearColor* TileColor = Band.Color.GetData() + TileOffset;
+					float* TileSelectionWeight = bSelectMaxWeight ? Band.SelectionWeight.GetData() + TileOffset : nullptr;
+
+					for (int32 SampleY = FirstSampleY; SampleY < EndSampleY; SampleY++)
+					{
+						const int32 RowInBand = SampleY + BlendDataTarget->OutputBoundsMin.Y - BandFirstRow;
+						const int32 DestRowIndex = RowInBand * TileWidth + (OutputPixelX - TileBegin);
+						const int64 SourceRowIndex = RunBegin + (int64)SampleY * PixelWidth;
+						if (bSelectMaxWeight)
+						{
+							for (int32 RunX = 0; RunX < RunLength; RunX++)
+							{
+								const float SampleWeight = TargetEntryWeights[SourceRowIndex + RunX];
+								if (SampleWeight > TileSelectionWeight[DestRowIndex + RunX])
+								{
+									TileSelectionWeight[DestRowIndex + RunX] = SampleWeight;
+									TileColor[DestRowIndex + RunX] = SourceColor[SourceRowIndex + RunX];
+								}
+							}
+							continue;
+						}
+						for (int32 RunX = 0; RunX < RunLength; RunX++)
+						{
+							TileColor[DestRowIndex + RunX] += SourceColor[SourceRowIndex + RunX] * WeightScale;
+						}
+					}
+					RunBegin += RunLength;
+				}
+			}
+
 			{
-				BlendDataTarget->OriginalDataPayload->Debug_OverrideFilename = FString::Printf(TEXT("/%s_PaneX_%d_PaneY_%d-Blended.%d"),
-					*BlendDataTarget->OriginalDataPayload->PassIdentifier.Name, BlendDataTarget->OriginalDataPayload->Pane.HorizontalStepIndex,
-					BlendDataTarget->OriginalDataPayload->Pane.VerticalStepIndex, BlendDataTarget->OriginalDataPayload->SampleState.OutputState.OutputFrameNumber);
+				FScopeLock ScopeLock(&OutputDataMutex);
+				FIntPoint& RowBounds = OutputFrame->EyeRowBounds[FMath::Max(BlendDataTarget->EyeIndex, 0)];
+				RowBounds.X = FMath::Min(RowBounds.X, BlendDataTarget->OutputBoundsMin.Y);
+				RowBounds.Y = FMath::Max(RowBounds.Y, BlendDataTarget->OutputBoundsMax.Y);
 			}
+			
+			bool bDebugSamples = DataPayload->SampleState.bWriteSampleToDisk;
+			if (bDebugSamples)
+			{
+				// Write each blended sample to the output as a debug sample so we can inspect the job blending is doing for each pane.
+				// Hack up the debug output name a bit so they're unique.
+				if (BlendDataTarget->OriginalDataPayload->Pane.EyeIndex >= 0)
+				{
+					BlendDataTarget->OriginalDataPayload->Debug_OverrideFilename = FString::Printf(TEXT("/%s_PaneX_%d_PaneY_%dEye_%d-Blended.%d"),
+						*BlendDataTarget->OriginalDataPayload->PassIdentifier.Name, BlendDataTarget->OriginalDataPayload->Pane.HorizontalStepIndex,
+						BlendDataTarget->OriginalDataPayload->Pane.VerticalStepIndex, BlendDataTarget->EyeIndex, BlendDataTarget->OriginalDataPayload->SampleState.OutputState.OutputFrameNumber);
+				}
+				else
+				{
+					BlendDataTarget->OriginalDataPayload->Debug_OverrideFilename = FString::Printf(TEXT("/%s_PaneX_%d_PaneY_%d-Blended.%d"),
+						*BlendDataTarget->OriginalDataPayload->PassIdentifier.Name, BlendDataTarget->OriginalDataPayload->Pane.HorizontalStepIndex,
+						BlendDataTarget->OriginalDataPayload->Pane.VerticalStepIndex, BlendDataTarget->OriginalDataPayload->SampleState.OutputState.OutputFrameNumber);
+				}
 
-			// Now that the sample has been blended pass it (and the memory it owned, we already read from it) to the debug output step.
-			TUniquePtr<TImagePixelData<FLinearColor>> FinalPixelData = MakeUnique<TImagePixelData<FLinearColor>>(FIntPoint(BlendDataTarget->PixelWidth, BlendDataTarget->PixelHeight), TArray64<FLinearColor>(MoveTemp(BlendDataTarget->Data)), BlendDataTarget->OriginalDataPayload);
-			ensure(OutputMerger.IsValid());
-			OutputMerger.Pin()->OnSingleSampleDataAvailable_AnyThread(MoveTemp(FinalPixelData));
-		}
-		else
-		{
-			// Ensure we reset the memory we allocated, to minimize concurrent allocations.
-			BlendDataTarget->Data.Reset();
-			BlendDataTarget->Data.Empty();
-			if(bIncludeAlpha)
+				// Now that the sample has been blended pass it (and the memory it owned, we already read from it) to the debug output step.
+				TUniquePtr<TImagePixelData<FLinearColor>> FinalPixelData = MakeUnique<TImagePixelData<FLinearColor>>(FIntPoint(BlendDataTarget->PixelWidth, BlendDataTarget->PixelHeight), MoveTemp(BlendDataTarget->Data), BlendDataTarget->OriginalDataPayload);
+				ensure(OutputMerger.IsValid());
+				OutputMerger.Pin()->OnSingleSampleDataAvailable_AnyThread(MoveTemp(FinalPixelData));
+			}
+			else
 			{
-				BlendDataTarget->AlphaArray.Reset();
-				BlendDataTarget->AlphaArray.Empty();
+				// Ensure we reset the memory we allocated, to minimize concurrent allocations.
+				BlendDataTarget->Data.Reset();
+				BlendDataTarget->Data.Empty();
 			}
 		}
 	}
@@ -406,7 +924,10 @@ void FPanoramicBlender::OnCompleteRenderPassDataAvailable_AnyThread(TUniquePtr<F
 	{
 		FScopeLock ScopeLock(&GlobalQueueDataMutex);
 		// Data blending complete
-		BlendDataTarget->bFinished = true;
+		for (const TSharedPtr<FPanoramicBlendData>& BlendDataTarget : BlendDataTargets)
+		{
+			BlendDataTarget->bFinished = true;
+		}
 		
 		// Check if all samples "are from GPU" and "have been mixed"
 		int32 NumFinishedSamples = 0;
@@ -426,38 +947,764 @@ void FPanoramicBlender::OnCompleteRenderPassDataAvailable_AnyThread(TUniquePtr<F
 	/*************************** Color in if it's the last one ************************/
 	if (bIsLastSample)
 	{
+		// Selected AOVs can't be summed across shards, they only make sense in unsharded renders.
+		if (Options.NumPaneShards > 1 && !bSelectMaxWeight)
 		{
-			// Now that we have accumulated the values of all the pixels, we need to scale them
-			for (int32 PixelIndex = 0; PixelIndex < OutputFrame->OutputEquirectangularMap.Num(); PixelIndex++)
-			{
-				FLinearColor& Pixel = OutputFrame->OutputEquirectangularMap[PixelIndex];
-				if(bIncludeAlpha)
-				{
-					float& AlphaNum = OutputFrame->AlphaArray[PixelIndex];
-					Pixel.R /= AlphaNum;
-					Pixel.G /= AlphaNum;
-					Pixel.B /= AlphaNum;
-					Pixel.A /= AlphaNum;
-				}
-				else
-				{
-					Pixel.R /= Pixel.A;
-					Pixel.G /= Pixel.A;
-					Pixel.B /= Pixel.A;
-					Pixel.A = 1;
-				}
-			}
+			// The merge step needs the accumulation before it is converted to the output pixel type.
+			WriteShardAccumulation(*OutputFrame, *DataPayload);
 		}
+		// Convert to the output pixel type and release the accumulation in one sweep, filtering the smaller sizes on the way.
 		TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe> NewPayload = DataPayload->Copy();
-		int32 OutputSizeX = OutputEquirectangularMapSize.X;
-		int32 OutputSizeY = DataPayload->Pane.EyeIndex >= 0 ? OutputEquirectangularMapSize.Y * 2 : OutputEquirectangularMapSize.Y;
-		TUniquePtr<TImagePixelData<FLinearColor>> FinalPixelData = MakeUnique<TImagePixelData<FLinearColor>>(FIntPoint(OutputSizeX, OutputSizeY), TArray64<FLinearColor>(MoveTemp(OutputFrame->OutputEquirectangularMap)), NewPayload);
+		TArray<TUniquePtr<FImagePixelData>> AdditionalPixelData;
+		TUniquePtr<FImagePixelData> FinalPixelData = FinalizeOutputFrame(*OutputFrame, bIncludeAlpha, NewPayload, AdditionalPixelData);
+		if (bAbandoned)
+		{
+			// Finalize stopped part way, nothing of this frame is handed on.
+			return;
+		}
+		if (FrameStream.IsValid() && !OutputFrame->bIsAOV && FinalPixelData.IsValid())
+		{
+			// Only the master color goes to the encoder, the pixels are copied so the regular outputs still get the frame.
+			FrameStream->Enqueue(MoviePipeline::Panoramic::CopyPixelData(*FinalPixelData, NewPayload), DataPayload->SampleState.OutputState.OutputFrameNumber,
+				OutputFrame->EyeRowBounds.Num(), DataPayload->PassIdentifier.Name);
+		}
 		
-		if(ensure(OutputMerger.IsValid()))
+		if (IsHeldFrameDetectionEnabled() && FinalPixelData.IsValid())
 		{
-			OutputMerger.Pin()->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(FinalPixelData));
+			// Copied before the outputs take it, the next frame may repeat it. Frames already waiting for it are handed on.
+			SetHeldFrameOutput(*DataPayload, *FinalPixelData, AdditionalPixelData);
+		}
+		
+		if(ensure(OutputMerger.IsValid()))
+		{
+			OutputMerger.Pin()->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(FinalPixelData));
+			for (TUniquePtr<FImagePixelData>& PixelData : AdditionalPixelData)
+			{
+				OutputMerger.Pin()->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(PixelData));
+			}
+		}
+		if (Options.bCheckpointPanes)
+		{
+			// The frame is in the outputs' hands now, a re-render of it should render it again.
+			DeletePaneCheckpoints(*DataPayload);
+		}
+		FScopeLock ScopeLock(&GlobalQueueDataMutex);
+		PendingData.Remove(TPair<FMoviePipelineFrameOutputState, FMoviePipelinePassIdentifier>(DataPayload->SampleState.OutputState, DataPayload->PassIdentifier));
+	}
+}
+
+TSharedPtr<const FPanoramicRigReprojection, ESPMode::ThreadSafe> FPanoramicBlender::GetRigReprojection(const FPanoPane& InPane)
+{
+	FPanoramicRigReprojection::FRigDesc Desc = FPanoramicRigReprojection::FRigDesc::FromPane(InPane, OutputEquirectangularMapSize, Options.ResampleFilter, Options.bMipFiltering);
+	Desc.bStreaming = Options.bStreamingReprojection;
+
+	// The first pane builds it while the other workers wait, it is needed by all of them anyway.
+	FScopeLock ScopeLock(&RigReprojectionMutex);
+	if (!RigReprojection.IsValid() || RigReprojection->GetDesc() != Desc)
+	{
+		ensureMsgf(!RigReprojection.IsValid(), TEXT("Panoramic rig changed during a render, rebuilding the reprojection."));
+		TSharedPtr<FPanoramicRigReprojection, ESPMode::ThreadSafe> NewRig = MakeShared<FPanoramicRigReprojection, ESPMode::ThreadSafe>();
+		const double BuildStartTime = FPlatformTime::Seconds();
+		NewRig->Build(Desc);
+		UE_LOG(LogMovieRenderPipeline, Log, TEXT("Built panoramic reprojection for %dx%d panes in %.2f seconds."), Desc.NumHorizontalSteps, Desc.NumVerticalSteps, FPlatformTime::Seconds() - BuildStartTime);
+		RigReprojection = NewRig;
+	}
+	return RigReprojection;
+}
+
+void FPanoramicBlender::FilterRepeatedPanes(TArray<TUniquePtr<FImagePixelData>, TInlineAllocator<1>>& InOutPanes)
+{
+	check(InOutPanes.Num() == 1);
+	const FPanoramicImagePixelDataPayload* DataPayload = InOutPanes[0]->GetPayload<FPanoramicImagePixelDataPayload>();
+	const int32 OutputFrameNumber = DataPayload->SampleState.OutputState.OutputFrameNumber;
+	// Restored steps carry no pixels to compare, and debug samples are only written by blending.
+	const bool bComparable = !DataPayload->bRestoreFromCheckpoint && !DataPayload->SampleState.bWriteSampleToDisk;
+	const uint64 PaneHash = bComparable ? MoviePipeline::Panoramic::HashPanePixels(*InOutPanes[0]) : 0;
+
+	TArray<FRepeatedFrame> RepeatedFrames;
+	{
+		FScopeLock ScopeLock(&HeldFramesMutex);
+		TSharedPtr<FHeldFrame>& Frame = HeldFrames.FindOrAdd(TPair<int32, FMoviePipelinePassIdentifier>(OutputFrameNumber, DataPayload->PassIdentifier));
+		if (!Frame.IsValid())
+		{
+			Frame = MakeShared<FHeldFrame>();
+			Frame->NumPanesTotal = DataPayload->Pane.GetNumPanesInShard();
+			for (const TPair<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>>& KVP : HeldFrames)
+			{
+				if (KVP.Key.Value == DataPayload->PassIdentifier && KVP.Key.Key < OutputFrameNumber)
+				{
+					Frame->ReferenceFrameNumber = FMath::Max(Frame->ReferenceFrameNumber, KVP.Key.Key);
+				}
+			}
+			Frame->bRepeatsReference = Frame->ReferenceFrameNumber != INDEX_NONE;
+		}
+
+		const int32 PaneIndex = DataPayload->Pane.GetAbsoluteIndex();
+		const TSharedPtr<FHeldFrame>* Reference = HeldFrames.Find(TPair<int32, FMoviePipelinePassIdentifier>(Frame->ReferenceFrameNumber, DataPayload->PassIdentifier));
+		// A reference whose panorama was released can't be repeated, the frame is blended like any other.
+		const uint64* ReferenceHash = Reference && !(*Reference)->bOutputDiscarded ? (*Reference)->PaneHashes.Find(PaneIndex) : nullptr;
+		Frame->NumPanesArrived++;
+		if (bComparable)
+		{
+			Frame->PaneHashes.Add(PaneIndex, PaneHash);
+		}
+
+		if (!Frame->bRepeatsReference || !bComparable || !ReferenceHash || *ReferenceHash != PaneHash)
+		{
+			if (Frame->bRepeatsReference)
+			{
+				// The frame changed after all, everything held back so far gets blended with this pane.
+				Frame->bRepeatsReference = false;
+				for (TUniquePtr<FImagePixelData>& HeldPane : Frame->HeldPanes)
+				{
+					InOutPanes.Add(MoveTemp(HeldPane));
+				}
+				Frame->HeldPanes.Empty();
+				// We were the frame the reference's panorama was kept for.
+				if (Reference && IsHeldFrameOutputRejected(DataPayload->PassIdentifier, Frame->ReferenceFrameNumber))
+				{
+					(*Reference)->Output.Reset();
+					(*Reference)->bOutputDiscarded = true;
+				}
+			}
+		}
+		else
+		{
+			Frame->HeldPanes.Add(MoveTemp(InOutPanes[0]));
+			InOutPanes.Reset();
+			if (Frame->NumPanesArrived == Frame->NumPanesTotal)
+			{
+				if ((*Reference)->Output.IsValid())
+				{
+					FRepeatedFrame& RepeatedFrame = RepeatedFrames.AddDefaulted_GetRef();
+					RepeatedFrame.FramePayload = StaticCastSharedRef<FPanoramicImagePixelDataPayload>(Frame->HeldPanes[0]->GetPayload<FPanoramicImagePixelDataPayload>()->Copy());
+					RepeatedFrame.Output = (*Reference)->Output;
+					Frame->Output = (*Reference)->Output;
+					Frame->HeldPanes.Empty();
+					ResolveAwaitingFrames(DataPayload->PassIdentifier, OutputFrameNumber, RepeatedFrames);
+				}
+				else
+				{
+					Frame->bAwaitingReference = true;
+				}
+			}
+		}
+		PruneHeldFrames(DataPayload->PassIdentifier);
+	}
+	EmitRepeatedFrames(RepeatedFrames);
+}
+
+void FPanoramicBlender::SetHeldFrameOutput(const FPanoramicImagePixelDataPayload& InPayload, const FImagePixelData& InMasterPixelData, TArrayView<const TUniquePtr<FImagePixelData>> InAdditionalPixelData)
+{
+	const int32 OutputFrameNumber = InPayload.SampleState.OutputState.OutputFrameNumber;
+	{
+		// Nothing waits for or compares against frames that are gone already, they don't need a copy. Neither does a frame
+		// the next one already differs from.
+		FScopeLock ScopeLock(&HeldFramesMutex);
+		TSharedPtr<FHeldFrame>* Frame = HeldFrames.Find(TPair<int32, FMoviePipelinePassIdentifier>(OutputFrameNumber, InPayload.PassIdentifier));
+		if (!Frame)
+		{
+			return;
+		}
+		if (IsHeldFrameOutputRejected(InPayload.PassIdentifier, OutputFrameNumber))
+		{
+			(*Frame)->bOutputDiscarded = true;
+			return;
+		}
+	}
+
+	TSharedPtr<FHeldFrameOutput, ESPMode::ThreadSafe> Output = MakeShared<FHeldFrameOutput, ESPMode::ThreadSafe>();
+	Output->Images.Add(MoviePipeline::Panoramic::CopyPixelData(InMasterPixelData, InMasterPixelData.GetPayload<FPanoramicImagePixelDataPayload>()->Copy()));
+	for (const TUniquePtr<FImagePixelData>& PixelData : InAdditionalPixelData)
+	{
+		Output->Images.Add(MoviePipeline::Panoramic::CopyPixelData(*PixelData, PixelData->GetPayload<FPanoramicImagePixelDataPayload>()->Copy()));
+	}
+
+	TArray<FRepeatedFrame> RepeatedFrames;
+	{
+		FScopeLock ScopeLock(&HeldFramesMutex);
+		TSharedPtr<FHeldFrame>* Frame = HeldFrames.Find(TPair<int32, FMoviePipelinePassIdentifier>(OutputFrameNumber, InPayload.PassIdentifier));
+		if (Frame && IsHeldFrameOutputRejected(InPayload.PassIdentifier, OutputFrameNumber))
+		{
+			// The next frame differed while we were copying.
+			(*Frame)->bOutputDiscarded = true;
+		}
+		else if (Frame)
+		{
+			(*Frame)->Output = Output;
+			ResolveAwaitingFrames(InPayload.PassIdentifier, OutputFrameNumber, RepeatedFrames);
+			PruneHeldFrames(InPayload.PassIdentifier);
+		}
+	}
+	EmitRepeatedFrames(RepeatedFrames);
+}
+
+bool FPanoramicBlender::IsHeldFrameOutputRejected(const FMoviePipelinePassIdentifier& InPassIdentifier, int32 InFrameNumber) const
+{
+	// Frames compare against the latest earlier frame, so only the next frame of the pass can refer to this one.
+	bool bCompared = false;
+	bool bRepeated = false;
+	for (const TPair<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>>& KVP : HeldFrames)
+	{
+		if (KVP.Key.Value == InPassIdentifier && KVP.Value->ReferenceFrameNumber == InFrameNumber)
+		{
+			bCompared = true;
+			bRepeated |= KVP.Value->bRepeatsReference;
+		}
+	}
+	return bCompared && !bRepeated;
+}
+
+void FPanoramicBlender::ResolveAwaitingFrames(const FMoviePipelinePassIdentifier& InPassIdentifier, int32 InFrameNumber, TArray<FRepeatedFrame>& OutRepeatedFrames)
+{
+	// A frame that repeats a frame that repeats another one waits for the first, so the chain is followed.
+	for (int32 ReferenceFrameNumber = InFrameNumber; ReferenceFrameNumber != INDEX_NONE;)
+	{
+		const TSharedPtr<FHeldFrame> Reference = HeldFrames.FindRef(TPair<int32, FMoviePipelinePassIdentifier>(ReferenceFrameNumber, InPassIdentifier));
+		int32 NextFrameNumber = INDEX_NONE;
+		for (TPair<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>>& KVP : HeldFrames)
+		{
+			FHeldFrame& Frame = *KVP.Value;
+			if (KVP.Key.Value == InPassIdentifier && Frame.bAwaitingReference && Frame.ReferenceFrameNumber == ReferenceFrameNumber)
+			{
+				FRepeatedFrame& RepeatedFrame = OutRepeatedFrames.AddDefaulted_GetRef();
+				RepeatedFrame.FramePayload = StaticCastSharedRef<FPanoramicImagePixelDataPayload>(Frame.HeldPanes[0]->GetPayload<FPanoramicImagePixelDataPayload>()->Copy());
+				RepeatedFrame.Output = Reference->Output;
+				Frame.Output = Reference->Output;
+				Frame.HeldPanes.Empty();
+				Frame.bAwaitingReference = false;
+				NextFrameNumber = KVP.Key.Key;
+				// Frames pick the latest earlier one as their reference, only one can be waiting for each.
+				break;
+			}
+		}
+		ReferenceFrameNumber = NextFrameNumber;
+	}
+}
+
+void FPanoramicBlender::PruneHeldFrames(const FMoviePipelinePassIdentifier& InPassIdentifier)
+{
+	// New frames compare against the latest complete frame (or a later one), earlier frames are only kept while
+	// a frame still compares against them or waits for their panorama.
+	auto IsComplete = [](const FHeldFrame& InFrame) { return InFrame.NumPanesArrived == InFrame.NumPanesTotal; };
+	int32 LatestCompleteFrameNumber = INDEX_NONE;
+	TSet<int32> ReferencedFrameNumbers;
+	for (const TPair<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>>& KVP : HeldFrames)
+	{
+		if (KVP.Key.Value != InPassIdentifier)
+		{
+			continue;
+		}
+		const FHeldFrame& Frame = *KVP.Value;
+		if (IsComplete(Frame))
+		{
+			LatestCompleteFrameNumber = FMath::Max(LatestCompleteFrameNumber, KVP.Key.Key);
+		}
+		if (Frame.bRepeatsReference && (!IsComplete(Frame) || Frame.bAwaitingReference))
+		{
+			ReferencedFrameNumbers.Add(Frame.ReferenceFrameNumber);
+		}
+	}
+
+	for (TMap<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>>::TIterator It = HeldFrames.CreateIterator(); It; ++It)
+	{
+		const FHeldFrame& Frame = *It->Value;
+		if (It->Key.Value == InPassIdentifier && It->Key.Key < LatestCompleteFrameNumber && IsComplete(Frame)
+			&& Frame.HeldPanes.Num() == 0 && !Frame.bAwaitingReference && !ReferencedFrameNumbers.Contains(It->Key.Key))
+		{
+			It.RemoveCurrent();
 		}
-		PendingData.Remove(DataPayload->SampleState.OutputState);
+	}
+}
+
+void FPanoramicBlender::EmitRepeatedFrames(TArrayView<const FRepeatedFrame> InRepeatedFrames)
+{
+	TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> PinnedOutputMerger = OutputMerger.Pin();
+	for (const FRepeatedFrame& RepeatedFrame : InRepeatedFrames)
+	{
+		if (bAbandoned || !ensure(PinnedOutputMerger.IsValid()))
+		{
+			return;
+		}
+		UE_LOG(LogMovieRenderPipeline, Verbose, TEXT("Panoramic frame %d of %s repeats the previous frame, handing on its panorama again."),
+			RepeatedFrame.FramePayload->SampleState.OutputState.OutputFrameNumber, *RepeatedFrame.FramePayload->PassIdentifier.Name);
+
+		if (IsWritingLightingProducts() && !Options.AOVBlendModes.Contains(RepeatedFrame.FramePayload->PassIdentifier))
+		{
+			// The panorama's payload still describes the frame it was blended for, whose sidecars are on disk already.
+			const FPanoramicImagePixelDataPayload* SourcePayload = RepeatedFrame.Output->Images[0]->GetPayload<FPanoramicImagePixelDataPayload>();
+			FPanoramicLightingProducts::CopySidecars(Options.LightingProducts, Options.LightingDirectory, RepeatedFrame.FramePayload->PassIdentifier.Name,
+				RepeatedFrame.FramePayload->Pane.EyeIndex == -1 ? 1 : 2, SourcePayload->SampleState.OutputState.OutputFrameNumber, RepeatedFrame.FramePayload->SampleState.OutputState.OutputFrameNumber);
+		}
+
+		for (int32 ImageIndex = 0; ImageIndex < RepeatedFrame.Output->Images.Num(); ImageIndex++)
+		{
+			// Every size keeps its own pass, only the frame it belongs to changes.
+			const FImagePixelData& Image = *RepeatedFrame.Output->Images[ImageIndex];
+			TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> NewPayload = StaticCastSharedRef<FPanoramicImagePixelDataPayload>(Image.GetPayload<FPanoramicImagePixelDataPayload>()->Copy());
+			NewPayload->SampleState = RepeatedFrame.FramePayload->SampleState;
+			TUniquePtr<FImagePixelData> PixelData = MoviePipeline::Panoramic::CopyPixelData(Image, NewPayload);
+			if (ImageIndex == 0 && FrameStream.IsValid() && !Options.AOVBlendModes.Contains(NewPayload->PassIdentifier))
+			{
+				const int32 NumEyes = NewPayload->Pane.EyeIndex == -1 ? 1 : 2;
+				FrameStream->Enqueue(MoviePipeline::Panoramic::CopyPixelData(*PixelData, NewPayload), NewPayload->SampleState.OutputState.OutputFrameNumber, NumEyes, NewPayload->PassIdentifier.Name);
+			}
+			PinnedOutputMerger->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(PixelData));
+		}
+	}
+}
+
+DECLARE_CYCLE_STAT(TEXT("STAT_MoviePipeline_PanoFinalize"), STAT_MoviePipeline_PanoFinalize, STATGROUP_MoviePipeline);
+
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		// Cheap per pixel hash noise in [0, 1), stable between frames so the dither pattern doesn't crawl.
+		static FORCEINLINE float GetDitherNoise(uint32 InX, uint32 InY, uint32 InChannel)
+		{
+			uint32 Hash = InX * 0x8da6b343u ^ InY * 0xd8163841u ^ InChannel * 0xcb1ab31fu;
+			Hash ^= Hash >> 16;
+			Hash *= 0x7feb352du;
+			Hash ^= Hash >> 15;
+			return (Hash & 0xffffff) / 16777216.f;
+		}
+
+		static FORCEINLINE float LinearToSRGB(float InValue)
+		{
+			InValue = FMath::Clamp(InValue, 0.f, 1.f);
+			return InValue <= 0.0031308f ? InValue * 12.92f : 1.055f * FMath::Pow(InValue, 1.f / 2.4f) - 0.055f;
+		}
+
+		// Triangular dither of +-1 LSB applied in the encoded space, hides banding in skies without a visible noise floor.
+		static FORCEINLINE uint8 QuantizeDithered(float InEncoded, uint32 InX, uint32 InY, uint32 InChannel)
+		{
+			const float Dither = GetDitherNoise(InX, InY, InChannel) + GetDitherNoise(InX, InY, InChannel + 4) - 1.f;
+			return (uint8)FMath::Clamp(FMath::FloorToInt(InEncoded * 255.f + 0.5f + Dither), 0, 255);
+		}
+
+		template<typename PixelType>
+		static FORCEINLINE void ConvertPixel(const FLinearColor& InColor, PixelType& OutPixel, bool bInDither, uint32 InX, uint32 InY);
+
+		template<>
+		FORCEINLINE void ConvertPixel<FLinearColor>(const FLinearColor& InColor, FLinearColor& OutPixel, bool bInDither, uint32 InX, uint32 InY)
+		{
+			OutPixel = InColor;
+		}
+
+		template<>
+		FORCEINLINE void ConvertPixel<FFloat16Color>(const FLinearColor& InColor, FFloat16Color& OutPixel, bool bInDither, uint32 InX, uint32 InY)
+		{
+			OutPixel = FFloat16Color(InColor);
+		}
+
+		template<>
+		FORCEINLINE void ConvertPixel<FColor>(const FLinearColor& InColor, FColor& OutPixel, bool bInDither, uint32 InX, uint32 InY)
+		{
+			if (!bInDither)
+			{
+				OutPixel = InColor.ToFColor(true);
+				return;
+			}
+			OutPixel.R = QuantizeDithered(LinearToSRGB(InColor.R), InX, InY, 0);
+			OutPixel.G = QuantizeDithered(LinearToSRGB(InColor.G), InX, InY, 1);
+			OutPixel.B = QuantizeDithered(LinearToSRGB(InColor.B), InX, InY, 2);
+			OutPixel.A = QuantizeDithered(FMath::Clamp(InColor.A, 0.f, 1.f), InX, InY, 3);
+		}
+
+		// Area weighted (box) resample of an eyes stacked image, each eye resized on its own. Every destination pixel
+		// averages the source pixels under its footprint, with partial weights for the ones on its border.
+		// InGetSourceRow returns a stacked source row, it may copy the row to the scratch buffer it is given and return that.
+		static void BoxFilter(TFunctionRef<const FLinearColor*(int32, TArray<FLinearColor>&)> InGetSourceRow, const FIntPoint& InSourceEyeSize, int32 InNumEyes, const FIntPoint& InDestEyeSize, TArray64<FLinearColor>& OutPixels)
+		{
+			const double ScaleX = (double)InSourceEyeSize.X / InDestEyeSize.X;
+			const double ScaleY = (double)InSourceEyeSize.Y / InDestEyeSize.Y;
+			{
+				LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendFrameOutput"));
+				OutPixels.SetNumUninitialized((int64)InDestEyeSize.X * InDestEyeSize.Y * InNumEyes);
+			}
+
+			// Horizontal footprints are the same for every row.
+			TArray<int32> FirstSourceX;
+			TArray<int32> LastSourceX;
+			FirstSourceX.SetNumUninitialized(InDestEyeSize.X);
+			LastSourceX.SetNumUninitialized(InDestEyeSize.X);
+			for (int32 DestX = 0; DestX < InDestEyeSize.X; DestX++)
+			{
+				FirstSourceX[DestX] = FMath::Clamp(FMath::FloorToInt(DestX * ScaleX), 0, InSourceEyeSize.X - 1);
+				LastSourceX[DestX] = FMath::Clamp(FMath::CeilToInt((DestX + 1) * ScaleX) - 1, FirstSourceX[DestX], InSourceEyeSize.X - 1);
+			}
+
+			ParallelFor(InDestEyeSize.Y * InNumEyes, [&](int32 DestRow)
+			{
+				const int32 EyeSlot = DestRow / InDestEyeSize.Y;
+				const int32 DestY = DestRow % InDestEyeSize.Y;
+				const double Y0 = DestY * ScaleY;
+				const double Y1 = (DestY + 1) * ScaleY;
+				const int32 FirstSourceY = FMath::Clamp(FMath::FloorToInt(Y0), 0, InSourceEyeSize.Y - 1);
+				const int32 LastSourceY = FMath::Clamp(FMath::CeilToInt(Y1) - 1, FirstSourceY, InSourceEyeSize.Y - 1);
+
+				// Filter vertically into a single row first, then horizontally out of it.
+				TArray<FLinearColor> ColumnSums;
+				ColumnSums.SetNumZeroed(InSourceEyeSize.X);
+				TArray<FLinearColor> RowScratch;
+				float TotalWeightY = 0.f;
+				for (int32 SourceY = FirstSourceY; SourceY <= LastSourceY; SourceY++)
+				{
+					const float WeightY = FMath::Max((float)(FMath::Min<double>(SourceY + 1, Y1) - FMath::Max<double>(SourceY, Y0)), 0.f);
+					if (WeightY <= 0.f)
+					{
+						continue;
+					}
+					TotalWeightY += WeightY;
+					const FLinearColor* SourceRow = InGetSourceRow(EyeSlot * InSourceEyeSize.Y + SourceY, RowScratch);
+					for (int32 SourceX = 0; SourceX < InSourceEyeSize.X; SourceX++)
+					{
+						ColumnSums[SourceX] += SourceRow[SourceX] * WeightY;
+					}
+				}
+
+				FLinearColor* Dest = OutPixels.GetData() + (int64)DestRow * InDestEyeSize.X;
+				for (int32 DestX = 0; DestX < InDestEyeSize.X; DestX++)
+				{
+					const double X0 = DestX * ScaleX;
+					const double X1 = (DestX + 1) * ScaleX;
+					FLinearColor Sum = FLinearColor(0.f, 0.f, 0.f, 0.f);
+					float TotalWeight = 0.f;
+					for (int32 SourceX = FirstSourceX[DestX]; SourceX <= LastSourceX[DestX]; SourceX++)
+					{
+						const float WeightX = FMath::Max((float)(FMath::Min<double>(SourceX + 1, X1) - FMath::Max<double>(SourceX, X0)), 0.f);
+						Sum += ColumnSums[SourceX] * WeightX;
+						TotalWeight += WeightX;
+					}
+					TotalWeight *= TotalWeightY;
+					Dest[DestX] = TotalWeight > 0.f ? Sum / TotalWeight : FLinearColor(0.f, 0.f, 0.f, 0.f);
+				}
+			});
+		}
+	}
+}
+
+void FPanoramicBlender::CopyBandRow(const FPanoramicAccumulationBand& InBand, int32 InRowInBand, FLinearColor* OutRow) const
+{
+	for (int32 TileBegin = 0; TileBegin < OutputEquirectangularMapSize.X; TileBegin += AccumulationTileWidth)
+	{
+		const int32 TileWidth = GetTileWidth(TileBegin);
+		FMemory::Memcpy(OutRow + TileBegin, InBand.Color.GetData() + (int64)TileBegin * InBand.Height + InRowInBand * TileWidth, TileWidth * sizeof(FLinearColor));
+	}
+}
+
+template<typename PixelType>
+TUniquePtr<FImagePixelData> FPanoramicBlender::FinalizeBands(FPanoramicOutputFrame& InOutputFrame, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload, FPanoramicLightingProducts* InLightingProducts) const
+{
+	const int32 NumBandsPerEye = GetNumBandsPerEye();
+	const int32 NumEyes = InOutputFrame.Bands.Num() / NumBandsPerEye;
+	const FIntPoint FinalSize = FIntPoint(OutputEquirectangularMapSize.X, OutputEquirectangularMapSize.Y * NumEyes);
+	const bool bDither = Options.bDitherQuantizedOutput;
+
+	TArray64<PixelType> FinalPixels;
+	{
+		LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendFrameOutput"));
+		FinalPixels.SetNumUninitialized((int64)FinalSize.X * FinalSize.Y);
+	}
+
+	// Every band maps to its own rows of the stacked output, so bands are finalized independently and freed right away.
+	ParallelFor(InOutputFrame.Bands.Num(), [&](int32 BandIndex)
+	{
+		FPanoramicAccumulationBand& Band = InOutputFrame.Bands[BandIndex];
+		if (bAbandoned)
+		{
+			Band.Color.Empty();
+			Band.SelectionWeight.Empty();
+			return;
+		}
+		const int32 EyeSlot = BandIndex / NumBandsPerEye;
+		const int32 FirstRowInEye = (BandIndex % NumBandsPerEye) * AccumulationBandHeight;
+		const int32 FirstRow = EyeSlot * OutputEquirectangularMapSize.Y + FirstRowInEye;
+		PixelType* Dest = FinalPixels.GetData() + (int64)FirstRow * FinalSize.X;
+		FPanoramicLightingProducts::FBandPartial* LightingPartial = InLightingProducts ? &InLightingProducts->BeginBand(BandIndex, EyeSlot, FirstRowInEye, Band.Height) : nullptr;
+
+		// The rig weights sum to one, so the accumulation already holds final values. Without alpha, A holds the
+		// coverage and is simply forced opaque. Tiles are read in order and scattered to their rows.
+		const FLinearColor* Source = Band.Color.GetData();
+		for (int32 TileBegin = 0; TileBegin < FinalSize.X; TileBegin += AccumulationTileWidth)
+		{
+			const int32 TileWidth = GetTileWidth(TileBegin);
+			for (int32 RowInBand = 0; RowInBand < Band.Height; RowInBand++)
+			{
+				PixelType* DestRow = Dest + (int64)RowInBand * FinalSize.X + TileBegin;
+				for (int32 X = 0; X < TileWidth; X++)
+				{
+					FLinearColor Pixel = *Source++;
+					if (!bInIncludeAlpha)
+					{
+						Pixel.A = 1;
+					}
+					if (LightingPartial)
+					{
+						InLightingProducts->AddPixel(*LightingPartial, TileBegin + X, FirstRowInEye + RowInBand, Pixel);
+					}
+					MoviePipeline::Panoramic::ConvertPixel<PixelType>(Pixel, DestRow[X], bDither, TileBegin + X, FirstRow + RowInBand);
+				}
+			}
+		}
+
+		// This band is converted, give its memory back before the other bands are done.
+		Band.Color.Empty();
+		Band.SelectionWeight.Empty();
+	});
+
+	return MakeUnique<TImagePixelData<PixelType>>(FinalSize, MoveTemp(FinalPixels), InPayload);
+}
+
+template<typename PixelType>
+TUniquePtr<FImagePixelData> FPanoramicBlender::ConvertPixels(const TArray64<FLinearColor>& InPixels, const FIntPoint& InSize, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload) const
+{
+	const bool bDither = Options.bDitherQuantizedOutput;
+
+	TArray64<PixelType> FinalPixels;
+	{
+		LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoBlendFrameOutput"));
+		FinalPixels.SetNumUninitialized((int64)InSize.X * InSize.Y);
+	}
+
+	ParallelFor(InSize.Y, [&](int32 Row)
+	{
+		const FLinearColor* Source = InPixels.GetData() + (int64)Row * InSize.X;
+		PixelType* Dest = FinalPixels.GetData() + (int64)Row * InSize.X;
+		for (int32 X = 0; X < InSize.X; X++)
+		{
+			FLinearColor Pixel = Source[X];
+			if (!bInIncludeAlpha)
+			{
+				Pixel.A = 1;
+			}
+			MoviePipeline::Panoramic::ConvertPixel<PixelType>(Pixel, Dest[X], bDither, X, Row);
+		}
+	});
+
+	return MakeUnique<TImagePixelData<PixelType>>(InSize, MoveTemp(FinalPixels), InPayload);
+}
+
+TUniquePtr<FImagePixelData> FPanoramicBlender::ConvertToOutputPixelType(const TArray64<FLinearColor>& InPixels, const FIntPoint& InSize, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload) const
+{
+	switch (Options.OutputPixelType)
+	{
+		case EPanoramicOutputPixelType::Float16:
+			return ConvertPixels<FFloat16Color>(InPixels, InSize, bInIncludeAlpha, InPayload);
+		case EPanoramicOutputPixelType::Color8:
+			return ConvertPixels<FColor>(InPixels, InSize, bInIncludeAlpha, InPayload);
+		case EPanoramicOutputPixelType::Float32:
+		default:
+			return ConvertPixels<FLinearColor>(InPixels, InSize, bInIncludeAlpha, InPayload);
+	}
+}
+
+TUniquePtr<FImagePixelData> FPanoramicBlender::FinalizeOutputFrame(FPanoramicOutputFrame& InOutputFrame, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload, TArray<TUniquePtr<FImagePixelData>>& OutAdditionalOutputs) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_MoviePipeline_PanoFinalize);
+
+	const int32 NumBandsPerEye = GetNumBandsPerEye();
+	const int32 NumEyes = InOutputFrame.Bands.Num() / NumBandsPerEye;
+
+	// AOVs keep full precision (depth, IDs) and only come in the master size, filtering them down would mix values.
+	const EPanoramicOutputPixelType OutputPixelType = InOutputFrame.bIsAOV ? EPanoramicOutputPixelType::Float32 : Options.OutputPixelType;
+	const TArray<FIntPoint>& AdditionalOutputSizes = InOutputFrame.bIsAOV ? TArray<FIntPoint>() : Options.AdditionalOutputSizes;
+
+	// The largest additional size has to be filtered before finalizing the master releases the bands.
+	TArray64<FLinearColor> LevelPixels;
+	if (AdditionalOutputSizes.Num() > 0)
+	{
+		MoviePipeline::Panoramic::BoxFilter([&](int32 InStackedRow, TArray<FLinearColor>& RowScratch)
+		{
+			const int32 EyeSlot = InStackedRow / OutputEquirectangularMapSize.Y;
+			const int32 RowInEye = InStackedRow % OutputEquirectangularMapSize.Y;
+			const FPanoramicAccumulationBand& Band = InOutputFrame.Bands[EyeSlot * NumBandsPerEye + RowInEye / AccumulationBandHeight];
+			RowScratch.SetNumUninitialized(OutputEquirectangularMapSize.X);
+			CopyBandRow(Band, RowInEye % AccumulationBandHeight, RowScratch.GetData());
+			return (const FLinearColor*)RowScratch.GetData();
+		}, OutputEquirectangularMapSize, NumEyes, AdditionalOutputSizes[0], LevelPixels);
+	}
+
+	// Gathered while the bands are converted, they are gone afterwards.
+	TUniquePtr<FPanoramicLightingProducts> LightingProducts;
+	if (IsWritingLightingProducts() && !InOutputFrame.bIsAOV)
+	{
+		LightingProducts = MakeUnique<FPanoramicLightingProducts>(Options.LightingProducts, OutputEquirectangularMapSize, NumEyes, InOutputFrame.Bands.Num());
+	}
+
+	TUniquePtr<FImagePixelData> MasterPixelData;
+	switch (OutputPixelType)
+	{
+		case EPanoramicOutputPixelType::Float16:
+			MasterPixelData = FinalizeBands<FFloat16Color>(InOutputFrame, bInIncludeAlpha, InPayload, LightingProducts.Get());
+			break;
+		case EPanoramicOutputPixelType::Color8:
+			MasterPixelData = FinalizeBands<FColor>(InOutputFrame, bInIncludeAlpha, InPayload, LightingProducts.Get());
+			break;
+		case EPanoramicOutputPixelType::Float32:
+		default:
+			MasterPixelData = FinalizeBands<FLinearColor>(InOutputFrame, bInIncludeAlpha, InPayload, LightingProducts.Get());
+			break;
+	}
+
+	const FPanoramicImagePixelDataPayload& MasterPayload = static_cast<const FPanoramicImagePixelDataPayload&>(InPayload.Get());
+	if (LightingProducts.IsValid() && !bAbandoned)
+	{
+		LightingProducts->Write(Options.LightingDirectory, MasterPayload.PassIdentifier.Name, MasterPayload.SampleState.OutputState.OutputFrameNumber);
+	}
+	// Each smaller size is filtered from the previous one, so the pyramid only ever reads the master once.
+	for (int32 LevelIndex = 0; LevelIndex < AdditionalOutputSizes.Num(); LevelIndex++)
+	{
+		const FIntPoint LevelEyeSize = AdditionalOutputSizes[LevelIndex];
+		if (LevelIndex > 0)
+		{
+			const FIntPoint PreviousEyeSize = AdditionalOutputSizes[LevelIndex - 1];
+			TArray64<FLinearColor> PreviousPixels = MoveTemp(LevelPixels);
+			MoviePipeline::Panoramic::BoxFilter([&](int32 InStackedRow, TArray<FLinearColor>&)
+			{
+				return PreviousPixels.GetData() + (int64)InStackedRow * PreviousEyeSize.X;
+			}, PreviousEyeSize, NumEyes, LevelEyeSize, LevelPixels);
+		}
+
+		TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> LevelPayload = StaticCastSharedRef<FPanoramicImagePixelDataPayload>(MasterPayload.Copy());
+		LevelPayload->PassIdentifier = MoviePipeline::Panoramic::GetOutputSizePassIdentifier(MasterPayload.PassIdentifier, LevelEyeSize);
+		OutAdditionalOutputs.Add(ConvertToOutputPixelType(LevelPixels, FIntPoint(LevelEyeSize.X, LevelEyeSize.Y * NumEyes), bInIncludeAlpha, LevelPayload));
+	}
+
+	return MasterPixelData;
+}
+
+void FPanoramicBlender::WriteShardAccumulation(const FPanoramicOutputFrame& InOutputFrame, const FPanoramicImagePixelDataPayload& InPayload) const
+{
+	FPanoramicAccumulationFile ShardFile;
+	ShardFile.OutputSize = OutputEquirectangularMapSize;
+	ShardFile.NumEyes = InOutputFrame.EyeRowBounds.Num();
+	ShardFile.OutputFrameNumber = InPayload.SampleState.OutputState.OutputFrameNumber;
+	ShardFile.bIncludeAlpha = InPayload.Pane.bIncludeAlpha;
+	ShardFile.NumShards = Options.NumPaneShards;
+	ShardFile.ShardIndex = Options.PaneShardIndex;
+	ShardFile.NumPanes = InOutputFrame.NumSamplesTotal;
+	// Contributions are weighted with the rig's partition of unity, merging shards is a plain sum.
+	ShardFile.bPreNormalized = true;
+	ShardFile.PassName = InPayload.PassIdentifier.Name;
+
+	// Only the rows our panes touched are stored, full width so the horizontal wrap needs no special case.
+	for (int32 EyeSlot = 0; EyeSlot < InOutputFrame.EyeRowBounds.Num(); EyeSlot++)
+	{
+		const FIntPoint& RowBounds = InOutputFrame.EyeRowBounds[EyeSlot];
+		if (RowBounds.X >= RowBounds.Y)
+		{
+			continue;
+		}
+
+		FPanoramicAccumulationRegion& Region = ShardFile.Regions.AddDefaulted_GetRef();
+		Region.EyeIndex = ShardFile.NumEyes > 1 ? EyeSlot : -1;
+		Region.Min = FIntPoint(0, RowBounds.X);
+		Region.Size = FIntPoint(OutputEquirectangularMapSize.X, RowBounds.Y - RowBounds.X);
+
+		const int32 NumBandsPerEye = GetNumBandsPerEye();
+		for (int32 OutputPixelY = RowBounds.X; OutputPixelY < RowBounds.Y; OutputPixelY++)
+		{
+			const FPanoramicAccumulationBand& Band = InOutputFrame.Bands[EyeSlot * NumBandsPerEye + OutputPixelY / AccumulationBandHeight];
+			const int64 RowStart = Region.Color.Num();
+			Region.Color.AddUninitialized(OutputEquirectangularMapSize.X);
+			CopyBandRow(Band, OutputPixelY % AccumulationBandHeight, Region.Color.GetData() + RowStart);
+		}
+	}
+
+	IFileManager::Get().MakeDirectory(*Options.ShardDirectory, true);
+	const FString ShardFilename = FPanoramicAccumulationFile::GetShardFilename(Options.ShardDirectory, ShardFile.PassName, ShardFile.OutputFrameNumber, ShardFile.ShardIndex, ShardFile.NumShards);
+	if (ShardFile.Save(ShardFilename))
+	{
+		UE_LOG(LogMovieRenderPipeline, Log, TEXT("Wrote panoramic shard %d/%d of frame %d to %s"), ShardFile.ShardIndex + 1, ShardFile.NumShards, ShardFile.OutputFrameNumber, *ShardFilename);
+	}
+}
+
+void FPanoramicBlender::WritePaneCheckpoint(TArrayView<const TSharedPtr<FPanoramicBlendData>> InBlendDataTargets, TArrayView<const float* const> InEntryWeights, const FPanoramicImagePixelDataPayload& InPayload) const
+{
+	FPanoramicAccumulationFile Checkpoint;
+	Checkpoint.OutputSize = OutputEquirectangularMapSize;
+	Checkpoint.NumEyes = InPayload.Pane.EyeIndex == -1 ? 1 : 2;
+	Checkpoint.OutputFrameNumber = InPayload.SampleState.OutputState.OutputFrameNumber;
+	Checkpoint.bIncludeAlpha = InPayload.Pane.bIncludeAlpha;
+	Checkpoint.NumShards = Options.NumPaneShards;
+	Checkpoint.ShardIndex = Options.PaneShardIndex;
+	Checkpoint.NumPanes = InBlendDataTargets.Num();
+	Checkpoint.bPreNormalized = true;
+	Checkpoint.PassName = InPayload.PassIdentifier.Name;
+
+	// One region per eye covering the pane bounds. Selected layers store the weight of every entry, the merge compares them.
+	for (int32 TargetIndex = 0; TargetIndex < InBlendDataTargets.Num(); TargetIndex++)
+	{
+		const TSharedPtr<FPanoramicBlendData>& BlendDataTarget = InBlendDataTargets[TargetIndex];
+		FPanoramicAccumulationRegion& Region = Checkpoint.Regions.AddDefaulted_GetRef();
+		Region.EyeIndex = BlendDataTarget->EyeIndex;
+		Region.Min = BlendDataTarget->OutputBoundsMin;
+		Region.Size = FIntPoint(BlendDataTarget->PixelWidth, BlendDataTarget->PixelHeight);
+		Region.Color.Append(BlendDataTarget->Data.GetData(), BlendDataTarget->Data.Num());
+		if (InEntryWeights.Num() > 0)
+		{
+			Region.Weight.Append(InEntryWeights[TargetIndex], BlendDataTarget->Data.Num());
+		}
+	}
+
+	// Written next to the final name and moved in place, so a crash while writing never leaves a checkpoint that looks complete.
+	IFileManager::Get().MakeDirectory(*Options.CheckpointDirectory, true);
+	const FString CheckpointFilename = FPanoramicAccumulationFile::GetPaneCheckpointFilename(Options.CheckpointDirectory, Checkpoint.PassName, Checkpoint.OutputFrameNumber, InPayload.Pane.GetStepIndex());
+	const FString TempFilename = CheckpointFilename + TEXT(".tmp");
+	if (!Checkpoint.Save(TempFilename) || !IFileManager::Get().Move(*CheckpointFilename, *TempFilename))
+	{
+		UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Failed to write panoramic checkpoint %s, this step will be rendered again on resume."), *CheckpointFilename);
+	}
+}
+
+bool FPanoramicBlender::RestorePaneCheckpoint(TArrayView<const TSharedPtr<FPanoramicBlendData>> InBlendDataTargets, TArrayView<TArray64<float>> OutEntryWeights, const FPanoramicImagePixelDataPayload& InPayload) const
+{
+	// The eyes of a shared pane have bounds of their own, every blend data is sized by its own region.
+	for (int32 TargetIndex = 0; TargetIndex < InBlendDataTargets.Num(); TargetIndex++)
+	{
+		OutEntryWeights[TargetIndex].SetNumZeroed(InBlendDataTargets[TargetIndex]->Data.Num());
+	}
+
+	const FString CheckpointFilename = FPanoramicAccumulationFile::GetPaneCheckpointFilename(Options.CheckpointDirectory, InPayload.PassIdentifier.Name, InPayload.SampleState.OutputState.OutputFrameNumber, InPayload.Pane.GetStepIndex());
+	FPanoramicAccumulationFile Checkpoint;
+	if (!Checkpoint.Load(CheckpointFilename))
+	{
+		return false;
+	}
+
+	bool bRestoredAll = true;
+	for (int32 TargetIndex = 0; TargetIndex < InBlendDataTargets.Num(); TargetIndex++)
+	{
+		const TSharedPtr<FPanoramicBlendData>& BlendDataTarget = InBlendDataTargets[TargetIndex];
+		const int64 NumEntries = BlendDataTarget->Data.Num();
+		const FPanoramicAccumulationRegion* Region = Checkpoint.Regions.FindByPredicate([&BlendDataTarget](const FPanoramicAccumulationRegion& InRegion)
+		{
+			return InRegion.EyeIndex == BlendDataTarget->EyeIndex;
+		});
+		if (!Region || Region->Min != BlendDataTarget->OutputBoundsMin || Region->Size != FIntPoint(BlendDataTarget->PixelWidth, BlendDataTarget->PixelHeight))
+		{
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("Panoramic checkpoint %s doesn't match the current rig, its step is left empty."), *CheckpointFilename);
+			bRestoredAll = false;
+			continue;
+		}
+		FMemory::Memcpy(BlendDataTarget->Data.GetData(), Region->Color.GetData(), NumEntries * sizeof(FLinearColor));
+		if (Region->Weight.Num() == NumEntries)
+		{
+			FMemory::Memcpy(OutEntryWeights[TargetIndex].GetData(), Region->Weight.GetData(), NumEntries * sizeof(float));
+		}
+	}
+	return bRestoredAll;
+}
+
+void FPanoramicBlender::DeletePaneCheckpoints(const FPanoramicImagePixelDataPayload& InPayload) const
+{
+	const int32 NumSteps = InPayload.Pane.NumHorizontalSteps * InPayload.Pane.NumVerticalSteps;
+	for (int32 StepIndex = 0; StepIndex < NumSteps; StepIndex++)
+	{
+		const FString CheckpointFilename = FPanoramicAccumulationFile::GetPaneCheckpointFilename(Options.CheckpointDirectory, InPayload.PassIdentifier.Name, InPayload.SampleState.OutputState.OutputFrameNumber, StepIndex);
+		IFileManager::Get().Delete(*CheckpointFilename, /*RequireExists*/ false, /*EvenReadOnly*/ false, /*Quiet*/ true);
 	}
 }
 
@@ -469,22 +1716,62 @@ void FPanoramicBlender::OnSingleSampleDataAvailable_AnyThread(TUniquePtr<FImageP
 	OutputMerger.Pin()->OnSingleSampleDataAvailable_AnyThread(MoveTemp(InData));
 }
 
-// Setting a "Movie pipeline fake output frame" type is a movie pipeline merge output frame,
-// the specific impact of this is unknown. But there is no other way to do it here.
-static FMoviePipelineMergerOutputFrame MoviePipelineDummyOutputFrame;
 FMoviePipelineMergerOutputFrame& FPanoramicBlender::QueueOutputFrame_GameThread(const FMoviePipelineFrameOutputState& CachedOutputState)
 {
-	check(0);
-	return  MoviePipelineDummyOutputFrame;
+	// The blender creates its frames itself when the first pane arrives, the frames the pipeline expects live in the
+	// merger we hand finished panoramas to.
+	TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> PinnedOutputMerger = OutputMerger.Pin();
+	check(PinnedOutputMerger.IsValid());
+	return PinnedOutputMerger->QueueOutputFrame_GameThread(CachedOutputState);
 }
 
 void FPanoramicBlender::AbandonOutstandingWork()
 {
-	check(0);
+	// Running workers notice at their next band of rows and drop their buffers, incoming panes are dropped on arrival.
+	bAbandoned = true;
+
+	// Queued and parked panes hold full pane readbacks, and every pending frame its whole accumulation: free them now
+	// instead of when the blender is destroyed. Workers still blending keep their own frame alive until they stop.
+	TArray<FPanoramicBlendWorkItem> AbandonedWork;
+	TMap<TPair<FIntPoint, FMoviePipelinePassIdentifier>, TUniquePtr<FImagePixelData>> AbandonedStereoPanes;
+	{
+		FScopeLock ScopeLock(&QueuedWorkMutex);
+		AbandonedWork = MoveTemp(QueuedWork);
+		AbandonedStereoPanes = MoveTemp(ParkedStereoPanes);
+		QueuedWork.Reset();
+		ParkedStereoPanes.Reset();
+	}
+	TMap<TPair<FMoviePipelineFrameOutputState, FMoviePipelinePassIdentifier>, TSharedPtr<FPanoramicOutputFrame>> AbandonedFrames;
+	{
+		FScopeLock ScopeLock(&GlobalQueueDataMutex);
+		AbandonedFrames = MoveTemp(PendingData);
+		PendingData.Reset();
+	}
+	TMap<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>> AbandonedHeldFrames;
+	{
+		FScopeLock ScopeLock(&HeldFramesMutex);
+		AbandonedHeldFrames = MoveTemp(HeldFrames);
+		HeldFrames.Reset();
+	}
+	UE_LOG(LogMovieRenderPipeline, Log, TEXT("Abandoned %d queued panes and %d pending panoramic frames."), AbandonedWork.Num() + AbandonedStereoPanes.Num(), AbandonedFrames.Num());
+}
+
+void FPanoramicBlender::WaitForBlendWorkers()
+{
+	FGraphEventArray WorkerEvents;
+	{
+		FScopeLock ScopeLock(&QueuedWorkMutex);
+		WorkerEvents = BlendWorkerEvents;
+	}
+	FTaskGraphInterface::Get().WaitUntilTasksComplete(WorkerEvents);
 }
 
 FPanoramicBlender::~FPanoramicBlender()
 {
+	// Workers capture this, let them drain before we go away.
+	WaitForBlendWorkers();
 	PendingData.Empty(0);
+	// Publishes what is still queued and marks the ring closed for the consumer.
+	FrameStream.Reset();
 }
 
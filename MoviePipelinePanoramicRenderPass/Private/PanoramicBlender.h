@@ -3,15 +3,83 @@
 
 #include "MoviePipelineImagePassBase.h"
 #include "MovieRenderPipelineDataTypes.h"
+#include "HAL/Event.h"
+#include "PanoramicLightingProducts.h"
+#include <atomic>
 
 // Forward Declares
 struct FImagePixelData;
 class UMoviePipeline;
+enum class EPanoramicOutputPixelType : uint8;
+enum class EPanoramicAOVBlendMode : uint8;
+enum class EPanoramicResampleFilter : uint8;
+class FPanoramicRigReprojection;
+struct FPanoramicPaneReprojection;
+class FPanoramicFrameStream;
+struct FPanoPane;
+
+// Settings the pass hands to the blender when it is created.
+struct FPanoramicBlenderOptions
+{
+	// Pane sharding, see UPanoramicPass::NumPaneShards. With more than one shard the weight-carrying accumulation
+	// of every frame is also written to ShardDirectory so the shards can be merged later.
+	int32 NumPaneShards = 1;
+	int32 PaneShardIndex = 0;
+	FString ShardDirectory;
+
+	// How many panes may be blended at the same time. 0 uses half of the task graph workers,
+	// leaving the rest to accumulation and encoding.
+	int32 MaxConcurrentBlends = 0;
+
+	// Pixel type handed to the output merger, produced by the finalize pass directly from the accumulation.
+	EPanoramicOutputPixelType OutputPixelType = (EPanoramicOutputPixelType)0;
+	// Dither 8 bit output while quantizing.
+	bool bDitherQuantizedOutput = true;
+
+	// Filter panes are resampled with, its kernel is tabulated with the rig reprojection.
+	EPanoramicResampleFilter ResampleFilter = (EPanoramicResampleFilter)1; // Bilinear
+	// Prefilter panes where they are denser than the output, see UPanoramicPass::bPrefilterDensePanes.
+	bool bMipFiltering = true;
+	// Project panes row by row while blending instead of keeping per pixel tables, see UPanoramicPass::bLowMemoryBlending.
+	bool bStreamingReprojection = false;
+
+	// Per eye sizes of the extra, box filtered copies of every frame, from the largest to the smallest.
+	TArray<FIntPoint> AdditionalOutputSizes;
+
+	// How every AOV pass is combined across panes. Passes not listed here are the final color.
+	TMap<FMoviePipelinePassIdentifier, EPanoramicAOVBlendMode> AOVBlendModes;
+	// AOV passes holding planar scene depth in RGB, converted to the distance from the camera, see FPanoramicAOV::bPlanarDepth.
+	TSet<FMoviePipelinePassIdentifier> PlanarDepthAOVs;
+
+	// Save every blended rig step to CheckpointDirectory, see UPanoramicPass::bCheckpointPanes.
+	bool bCheckpointPanes = false;
+	FString CheckpointDirectory;
+
+	// Also publish every finished panorama into a shared memory ring named StreamName, see UPanoramicPass::bStreamToSharedMemory.
+	bool bStreamToSharedMemory = false;
+	FString StreamName;
+	int32 StreamSlotCount = 3;
+	int64 StreamSlotSize = 0;
+	// How long an attached consumer may hold every slot before frames are dropped from the stream, see UPanoramicPass::StreamTimeoutSeconds.
+	double StreamTimeoutSeconds = 10.0;
+
+	// Hand on a copy of the previous panorama when every pane of a frame repeats it, see UPanoramicPass::bSkipHeldFrames.
+	bool bSkipHeldFrames = false;
+
+	// Every spatial and temporal sample of a pane arrives on its own and is blended at its sub-pixel position, see
+	// UPanoramicPass::bSplatSamples. A frame is done once all samples of all its panes are in.
+	bool bSplatSamples = false;
+
+	// Lighting sidecars derived from every finished panorama of the final color, written to LightingDirectory.
+	// Not written by the shards of a sharded render, which never see a whole panorama.
+	FPanoramicLightingProducts::FOptions LightingProducts;
+	FString LightingDirectory;
+};
 
 class FPanoramicBlender : public MoviePipeline::IMoviePipelineOutputMerger
 {
 public:
-	FPanoramicBlender(TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> InOutputMerger, const FIntPoint InOutputResolution);
+	FPanoramicBlender(TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> InOutputMerger, const FIntPoint InOutputResolution, const FPanoramicBlenderOptions& InOptions);
 	~FPanoramicBlender();
 
 public:
@@ -19,9 +87,35 @@ public:
 	virtual void OnCompleteRenderPassDataAvailable_AnyThread(TUniquePtr<FImagePixelData>&& InData) override;
 	virtual void OnSingleSampleDataAvailable_AnyThread(TUniquePtr<FImagePixelData>&& InData) override;
 	virtual void AbandonOutstandingWork() override;
-	virtual int32 GetNumOutstandingFrames() const override { return PendingData.Num(); }
+	virtual int32 GetNumOutstandingFrames() const override;
+
+	// Blocks until every blend worker has returned. After AbandonOutstandingWork that is at most a band of rows per worker.
+	void WaitForBlendWorkers();
 	
 private:
+	// A pane waiting for a blend worker.
+	struct FPanoramicBlendWorkItem
+	{
+		TUniquePtr<FImagePixelData> PixelData;
+		int32 OutputFrameNumber;
+		// Arrival order, keeps panes of the same frame first-in first-out.
+		uint64 SequenceNumber;
+	};
+
+	// Heap order for QueuedWork: the oldest output frame is always blended first, so it can finish and release its memory.
+	struct FOlderFrameFirst
+	{
+		bool operator()(const FPanoramicBlendWorkItem& A, const FPanoramicBlendWorkItem& B) const
+		{
+			return A.OutputFrameNumber != B.OutputFrameNumber ? A.OutputFrameNumber < B.OutputFrameNumber : A.SequenceNumber < B.SequenceNumber;
+		}
+	};
+
+	// Runs on a task graph worker and keeps blending queued panes until the queue is empty.
+	void BlendWorker_AnyThread();
+	// Blends the panes of one rig step (a single pane, or both stereo eyes) into their output frame, and hands the frame off if they were the last ones.
+	void BlendPanes_AnyThread(TArrayView<TUniquePtr<FImagePixelData>> InPanes);
+
 	struct FPanoramicBlendData
 	{
 		double BlendStartTime;			
@@ -31,36 +125,206 @@ private:
 		FIntPoint OutputBoundsMax;		
 		int32 PixelWidth;				
 		int32 PixelHeight;				
-		TArray<FLinearColor> Data;
-		TArray<float> AlphaArray;
+		// 64 bit so very wide panes can't overflow, and so the debug output can take it over without a copy.
+		TArray64<FLinearColor> Data;
 		int32 EyeIndex;					
+		// Which of the blended panes this is sampled from. A pane shared by the eyes has a blend data per eye, both sample it.
+		int32 SourcePaneIndex;
+		// The reprojection of the pane into EyeIndex's panorama, owned by the rig. Only used while the pane is blended.
+		const FPanoramicPaneReprojection* Reprojection;
+		// What Data is scaled by when it is merged, 1 over the number of samples for splatted samples.
+		float WeightScale;
 		TSharedPtr<struct FPanoramicImagePixelDataPayload> OriginalDataPayload;
 	};
 
+	// The in-flight map is split into bands of AccumulationBandHeight rows (the last band of an eye may be shorter),
+	// so finalize can release every band as soon as it has been converted.
+	static constexpr int32 AccumulationBandHeight = 64;
+
+	// Inside a band, pixels are kept in tiles of AccumulationTileWidth columns by the band's rows, each tile row-major, the last
+	// tile of a band is narrower when the width isn't a multiple. A pane then writes a few contiguous tiles instead of rows that
+	// are a whole output width apart. Finalize puts the pixels back in scanline order.
+	static constexpr int32 AccumulationTileWidth = 64;
+
+	struct FPanoramicAccumulationBand
+	{
+		// Linear color output isometric cylindrical Map (actually a panoramic array of color information), in tiles.
+		// Pane weights are a partition of unity, so this holds final values and needs no separate weight.
+		TArray<FLinearColor> Color;
+		// Weight of the pane Color was taken from, only for AOVs that select the most weighted pane instead of blending.
+		TArray<float> SelectionWeight;
+		int32 Height = 0;
+		// Held while a pane is merged into this band. Bands are allocated once per frame and never move.
+		FCriticalSection Mutex;
+	};
+
 	// Panoramic output frame
 	struct FPanoramicOutputFrame:FMoviePipelineMergerOutputFrame
 	{
+		// Every pass (the final color and each AOV) of an output frame is blended as an output frame of its own.
+		FMoviePipelinePassIdentifier PassIdentifier;
+		bool bIsAOV = false;
+		EPanoramicAOVBlendMode AOVBlendMode = (EPanoramicAOVBlendMode)0;
+		// Planar depth AOV, every pane is converted to distance from the camera before it is merged.
+		bool bPlanarDepth = false;
+
 		// Eye Index to Blend Data. Eye Index will be -1 when not using Stereo.
 		TMap<int32, TArray<TSharedPtr<FPanoramicBlendData>>> BlendedData;
 
 		// The total number of samples we have to wait for to finish blending before being 'done'.
 		int32 NumSamplesTotal;
 
-		// Linear color output isometric cylindrical Map (actually a panoramic array of color information)
-		TArray<FLinearColor> OutputEquirectangularMap;
-		// 透明通道
-		TArray<float> AlphaArray;
+		// Bands of the output map, eyes stacked: all bands of the left eye, then all bands of the right eye.
+		TArray<FPanoramicAccumulationBand> Bands;
+		// Triggered once the pane that started the frame has zeroed its bands, outside GlobalQueueDataMutex. Panes merge
+		// into the bands only after it.
+		FEventRef BandsReadyEvent{ EEventMode::ManualReset };
+		// Rows touched by the panes blended so far, per eye (X = first row, Y = one past the last row).
+		TArray<FIntPoint> EyeRowBounds;
 	};
 
-	/** Data that is expected but not fully available yet. */
-	TMap<FMoviePipelineFrameOutputState, TSharedPtr<FPanoramicOutputFrame>> PendingData;
+	// Returns the precomputed reprojection of the rig the pane belongs to, building it on first use.
+	TSharedPtr<const FPanoramicRigReprojection, ESPMode::ThreadSafe> GetRigReprojection(const FPanoPane& InPane);
+
+	int32 GetNumBandsPerEye() const
+	{
+		return (OutputEquirectangularMapSize.Y + AccumulationBandHeight - 1) / AccumulationBandHeight;
+	}
+
+	int32 GetBandHeight(int32 InBandIndexInEye) const
+	{
+		return FMath::Min(AccumulationBandHeight, OutputEquirectangularMapSize.Y - InBandIndexInEye * AccumulationBandHeight);
+	}
+
+	// Width of the tile starting at column InTileBegin, the tiles before it are all full width, so it starts at InTileBegin * band height.
+	int32 GetTileWidth(int32 InTileBegin) const
+	{
+		return FMath::Min(AccumulationTileWidth, OutputEquirectangularMapSize.X - InTileBegin);
+	}
+
+	// Copies a row of a band to OutRow in scanline order.
+	void CopyBandRow(const FPanoramicAccumulationBand& InBand, int32 InRowInBand, FLinearColor* OutRow) const;
+
+	// Converts the accumulation to the output pixel type and frees it, in one parallel pass over the bands.
+	// The additional output sizes are box filtered from the accumulation first and returned in OutAdditionalOutputs.
+	// The lighting sidecars of the final color are gathered in the same pass and written right after it.
+	TUniquePtr<FImagePixelData> FinalizeOutputFrame(FPanoramicOutputFrame& InOutputFrame, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload, TArray<TUniquePtr<FImagePixelData>>& OutAdditionalOutputs) const;
+	template<typename PixelType>
+	TUniquePtr<FImagePixelData> FinalizeBands(FPanoramicOutputFrame& InOutputFrame, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload, FPanoramicLightingProducts* InLightingProducts) const;
+
+	bool IsWritingLightingProducts() const
+	{
+		return Options.LightingProducts.IsEnabled() && Options.NumPaneShards <= 1;
+	}
+
+	// Converts a finished (eyes stacked) float image to the output pixel type.
+	TUniquePtr<FImagePixelData> ConvertToOutputPixelType(const TArray64<FLinearColor>& InPixels, const FIntPoint& InSize, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload) const;
+	template<typename PixelType>
+	TUniquePtr<FImagePixelData> ConvertPixels(const TArray64<FLinearColor>& InPixels, const FIntPoint& InSize, bool bInIncludeAlpha, const TSharedRef<FImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload) const;
+
+	// Pane checkpoints: the blended contribution of one rig step, both eyes, exactly as it is added to the bands.
+	// Restoring fills the blend targets and the entry weights of selected layers from it. Returns false if it doesn't fit the rig.
+	// Entry weights are per blend data, and only written for selected layers (InEntryWeights is empty otherwise).
+	void WritePaneCheckpoint(TArrayView<const TSharedPtr<FPanoramicBlendData>> InBlendDataTargets, TArrayView<const float* const> InEntryWeights, const struct FPanoramicImagePixelDataPayload& InPayload) const;
+	bool RestorePaneCheckpoint(TArrayView<const TSharedPtr<FPanoramicBlendData>> InBlendDataTargets, TArrayView<TArray64<float>> OutEntryWeights, const struct FPanoramicImagePixelDataPayload& InPayload) const;
+	// Deletes the checkpoints of a frame's pass once the frame has been handed on.
+	void DeletePaneCheckpoints(const struct FPanoramicImagePixelDataPayload& InPayload) const;
+
+	// Held frames: every pane is hashed when it arrives. While all panes of a frame are identical to the ones of the frame
+	// before it (of the same pass), they are held back instead of being blended; once the last one arrives the previous
+	// panorama is handed on again with the new frame's payload. The first pane that differs releases the held ones.
+	// The latest finished panorama of a pass is kept until the first pane of the next frame that differs from it, and released then.
+	struct FHeldFrameOutput
+	{
+		// The master size first, then the additional sizes.
+		TArray<TUniquePtr<FImagePixelData>> Images;
+	};
+
+	struct FHeldFrame
+	{
+		// Hash of every pane that arrived so far, by FPanoPane::GetAbsoluteIndex. Restored and debug panes have none.
+		TMap<int32, uint64> PaneHashes;
+		int32 NumPanesArrived = 0;
+		int32 NumPanesTotal = 0;
+		// The latest earlier frame of the pass when our first pane arrived, INDEX_NONE if there was none.
+		int32 ReferenceFrameNumber = INDEX_NONE;
+		// Every pane so far repeats the reference, they are held instead of blended.
+		bool bRepeatsReference = false;
+		TArray<TUniquePtr<FImagePixelData>> HeldPanes;
+		// Every pane repeats the reference, but its panorama isn't finished yet.
+		bool bAwaitingReference = false;
+		// The finished panorama, shared with the frames that repeat it.
+		TSharedPtr<const FHeldFrameOutput, ESPMode::ThreadSafe> Output;
+		// The next frame differed from it, its panorama was released (or never kept). Frames that compare against it are blended.
+		bool bOutputDiscarded = false;
+	};
+
+	// A repeated frame ready to be handed on: the payload of one of its panes and the panorama it repeats.
+	struct FRepeatedFrame
+	{
+		TSharedPtr<struct FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> FramePayload;
+		TSharedPtr<const FHeldFrameOutput, ESPMode::ThreadSafe> Output;
+	};
+
+	bool IsHeldFrameDetectionEnabled() const
+	{
+		// Shards hand on their accumulation rather than a panorama, there is nothing to repeat.
+		// Splatted samples of a pane differ by their jitter, they are never compared.
+		return Options.bSkipHeldFrames && Options.NumPaneShards <= 1 && !Options.bSplatSamples;
+	}
+
+	// Holds the pane in InOutPanes back if its frame repeats the previous one so far, or adds the panes held back for its
+	// frame if it is the first that doesn't. Hands the frame on if the pane was its last one.
+	void FilterRepeatedPanes(TArray<TUniquePtr<FImagePixelData>, TInlineAllocator<1>>& InOutPanes);
+	// Keeps a copy of a finished panorama until the next frame differs from it, and hands on the frames that were waiting for it.
+	void SetHeldFrameOutput(const struct FPanoramicImagePixelDataPayload& InPayload, const FImagePixelData& InMasterPixelData, TArrayView<const TUniquePtr<FImagePixelData>> InAdditionalPixelData);
+	// Both need HeldFramesMutex. Resolve marks the frames waiting on InFrameNumber (and, in turn, on those) as done.
+	void ResolveAwaitingFrames(const FMoviePipelinePassIdentifier& InPassIdentifier, int32 InFrameNumber, TArray<FRepeatedFrame>& OutRepeatedFrames);
+	void PruneHeldFrames(const FMoviePipelinePassIdentifier& InPassIdentifier);
+	// Needs HeldFramesMutex. Whether the frame after InFrameNumber has a pane that differs from it already, nothing repeats it then.
+	bool IsHeldFrameOutputRejected(const FMoviePipelinePassIdentifier& InPassIdentifier, int32 InFrameNumber) const;
+	void EmitRepeatedFrames(TArrayView<const FRepeatedFrame> InRepeatedFrames);
+
+	// Writes the weight-carrying accumulation of this process' shard of a frame, before it gets normalized.
+	void WriteShardAccumulation(const FPanoramicOutputFrame& InOutputFrame, const struct FPanoramicImagePixelDataPayload& InPayload) const;
+
+	/** Data that is expected but not fully available yet, per output frame and pass. */
+	TMap<TPair<FMoviePipelineFrameOutputState, FMoviePipelinePassIdentifier>, TSharedPtr<FPanoramicOutputFrame>> PendingData;
 	/** Mutex that protects adding/updating/removing from PendingData */
-	FCriticalSection GlobalQueueDataMutex;		
+	mutable FCriticalSection GlobalQueueDataMutex;		
+	/** Mutex that protects the EyeRowBounds of the pending frames, the bands have locks of their own. */
 	FCriticalSection OutputDataMutex;
+
+	/** Panes waiting to be blended, kept as a heap ordered by FOlderFrameFirst. */
+	TArray<FPanoramicBlendWorkItem> QueuedWork;
+	/** Mutex that protects QueuedWork and the worker bookkeeping below. */
+	mutable FCriticalSection QueuedWorkMutex;
+	/** The first eye of a stereo step, keyed by (output frame number, step index) and pass, until the other eye arrives. */
+	TMap<TPair<FIntPoint, FMoviePipelinePassIdentifier>, TUniquePtr<FImagePixelData>> ParkedStereoPanes;
+	uint64 NextSequenceNumber;
+	int32 NumActiveBlendWorkers;
+	int32 MaxBlendWorkers;
+	/** Worker tasks we launched, waited on before the blender goes away. */
+	FGraphEventArray BlendWorkerEvents;
+	/** Set by AbandonOutstandingWork, everything still in flight is dropped at the next band boundary. */
+	std::atomic<bool> bAbandoned;
 	
 	// Output the dimensions of the isometric cylindrical map, which is actually the output
 	FIntPoint OutputEquirectangularMapSize;
 	
 	// A weak pointer to the movie output merger of a movie pipeline
 	TWeakPtr<MoviePipeline::IMoviePipelineOutputMerger> OutputMerger;
+
+	FPanoramicBlenderOptions Options;
+
+	/** Normalized per pane weights and sample coordinates, shared by every frame and both eyes. */
+	TSharedPtr<const FPanoramicRigReprojection, ESPMode::ThreadSafe> RigReprojection;
+	FCriticalSection RigReprojectionMutex;
+
+	/** Hashes, held panes and finished panoramas of recent frames, keyed by output frame number and pass. */
+	TMap<TPair<int32, FMoviePipelinePassIdentifier>, TSharedPtr<FHeldFrame>> HeldFrames;
+	FCriticalSection HeldFramesMutex;
+
+	/** Shared memory ring finished frames are published to for a local encoder, null unless streaming is enabled. */
+	TUniquePtr<FPanoramicFrameStream> FrameStream;
 };
\ No newline at end of file
@@ -0,0 +1,753 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicBlender.h"
+#include "PanoramicAccumulationFile.h"
+#include "PanoramicPass.h"
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "ImagePixelData.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+// MoviePipeline.Panoramic.Blender
+// Feeds the blender synthetic panes and compares what comes out against a scalar evaluation of the blend that shares no code
+// with it: for every output pixel, the squared angular falloff of every pane and its perspective projection as the original
+// blender computed them (in double, straight from the pane's axes), an exact lookup with the resampling kernel at the unquantized
+// pane coordinate, and the weighted average of those. Every fast path the blender can take (precomputed tables, streaming rows,
+// prefiltered mips, every resampling kernel, selected AOVs, splatted samples, panes shared by the eyes) is run across rigs, mono
+// and stereo, with and without alpha and with F16 and F32 panes. Runs headless, CPU only.
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		namespace Validation
+		{
+			enum class EPattern : uint8
+			{
+				// Smooth ramps, errors come from the math rather than from sampling positions.
+				Gradient,
+				// 8 texel squares, sharp edges make any sampling position error visible.
+				Checkerboard,
+				// Scene depth of a sphere of radius 1 around the camera, in RGB. Blended as a planar depth AOV it has to come out
+				// as 1 everywhere.
+				PlanarDepth
+			};
+
+			enum class EPath : uint8
+			{
+				Tables,
+				Streaming,
+				Mips,
+				SelectMaxWeight
+			};
+
+			struct FCase
+			{
+				FString Name;
+				int32 NumHorizontalSteps = 0;
+				int32 NumVerticalSteps = 0;
+				float HorizontalFieldOfView = 0.f;
+				float VerticalFieldOfView = 0.f;
+				FIntPoint PaneResolution = FIntPoint::ZeroValue;
+				FIntPoint OutputSize = FIntPoint::ZeroValue;
+				bool bStereo = false;
+				bool bIncludeAlpha = false;
+				EImagePixelType PixelType = EImagePixelType::Float32;
+				EPattern Pattern = EPattern::Gradient;
+				EPath Path = EPath::Tables;
+				EPanoramicResampleFilter Filter = EPanoramicResampleFilter::Bilinear;
+				// Stereo only: rows rendered once for both eyes at the top and bottom, and the left eye's convergence yaw.
+				int32 NumMonoPolarRows = 0;
+				float EyeConvergenceYaw = 0.f;
+				// Every pane arrives as this many jittered samples, splatted one by one. 1 blends whole panes.
+				int32 NumSplatSamples = 1;
+				// A pixel is an outlier when any channel is further than this from the reference.
+				float MaxError = 0.f;
+				// Share of the covered pixels that may be outliers. Nearest lookups flip to the neighbouring texel where the
+				// quantized sample phase rounds the other way, that is expected and not a mismatch.
+				float MaxOutlierFraction = 0.f;
+
+				bool IsSharedRow(int32 InVerticalStepIndex) const
+				{
+					return bStereo && (InVerticalStepIndex < NumMonoPolarRows || InVerticalStepIndex >= NumVerticalSteps - NumMonoPolarRows);
+				}
+			};
+
+			// Catches what the blender hands on, standing in for the pipeline's output merger.
+			class FCapturingOutputMerger : public MoviePipeline::IMoviePipelineOutputMerger
+			{
+			public:
+				virtual FMoviePipelineMergerOutputFrame& QueueOutputFrame_GameThread(const FMoviePipelineFrameOutputState& CachedOutputState) override { return UnusedFrame; }
+				virtual void OnCompleteRenderPassDataAvailable_AnyThread(TUniquePtr<FImagePixelData>&& InData) override
+				{
+					FScopeLock ScopeLock(&Mutex);
+					Output = MoveTemp(InData);
+				}
+				virtual void OnSingleSampleDataAvailable_AnyThread(TUniquePtr<FImagePixelData>&& InData) override {}
+				virtual void AbandonOutstandingWork() override {}
+				virtual int32 GetNumOutstandingFrames() const override { return 0; }
+
+				TUniquePtr<FImagePixelData> TakeOutput()
+				{
+					FScopeLock ScopeLock(&Mutex);
+					return MoveTemp(Output);
+				}
+
+			private:
+				FMoviePipelineMergerOutputFrame UnusedFrame;
+				FCriticalSection Mutex;
+				TUniquePtr<FImagePixelData> Output;
+			};
+
+			// The pattern at a position of the pane in texels, texel centers at +0.5. A continuous function, so jittered samples
+			// can show exactly what the pane shows a fraction of a texel away.
+			static FLinearColor GetPatternColor(const FCase& InCase, int32 InPaneIndex, int32 InEyeSlot, double InU, double InV)
+			{
+				FLinearColor Color;
+				if (InCase.Pattern == EPattern::PlanarDepth)
+				{
+					// The view direction of the position, with the original blender's one texel offset in Y. Depth is measured
+					// along the view axis, on a unit sphere that is the cosine to it.
+					const double TanHalfFieldOfView = FMath::Tan(FMath::DegreesToRadians(0.5 * InCase.HorizontalFieldOfView));
+					const double Right = (2.0 * InU / InCase.PaneResolution.X - 1.0) * TanHalfFieldOfView;
+					const double Up = (2.0 * (InCase.PaneResolution.Y - 1.0 - InV) / InCase.PaneResolution.Y - 1.0) * TanHalfFieldOfView * InCase.PaneResolution.Y / InCase.PaneResolution.X;
+					const float Depth = (float)(1.0 / FMath::Sqrt(1.0 + Right * Right + Up * Up));
+					return FLinearColor(Depth, Depth, Depth, 1.f);
+				}
+				if (InCase.Pattern == EPattern::Gradient)
+				{
+					const float U = (float)(InU / InCase.PaneResolution.X);
+					Color = FLinearColor(U, (float)(InV / InCase.PaneResolution.Y), 0.f, 0.25f + 0.5f * U);
+				}
+				else
+				{
+					const bool bOdd = (FMath::FloorToInt(InU / 8.0) + FMath::FloorToInt(InV / 8.0)) % 2 != 0;
+					Color = bOdd ? FLinearColor(0.9f, 0.1f, 0.f, 0.8f) : FLinearColor(0.1f, 0.9f, 0.f, 0.2f);
+				}
+				// Every pane and eye gets its own blue, so mixing up panes or eyes shows.
+				Color.B = 0.1f + 0.6f * InPaneIndex / FMath::Max(InCase.NumHorizontalSteps * InCase.NumVerticalSteps - 1, 1) + 0.2f * InEyeSlot;
+				return Color;
+			}
+
+			// The pane exactly as the blender will read it, F16 panes included. A sample rendered with a sub-pixel shift shows at a
+			// texel what the unshifted pane shows InShift texels before it.
+			static TArray64<FLinearColor> MakePanePixels(const FCase& InCase, int32 InPaneIndex, int32 InEyeSlot, const FVector2D& InShift)
+			{
+				TArray64<FLinearColor> Pixels;
+				Pixels.SetNumUninitialized((int64)InCase.PaneResolution.X * InCase.PaneResolution.Y);
+				for (int32 Y = 0; Y < InCase.PaneResolution.Y; Y++)
+				{
+					for (int32 X = 0; X < InCase.PaneResolution.X; X++)
+					{
+						const FLinearColor Color = GetPatternColor(InCase, InPaneIndex, InEyeSlot, X + 0.5 - InShift.X, Y + 0.5 - InShift.Y);
+						Pixels[X + (int64)Y * InCase.PaneResolution.X] = InCase.PixelType == EImagePixelType::Float16 ? FLinearColor(FFloat16Color(Color)) : Color;
+					}
+				}
+				return Pixels;
+			}
+
+			static TUniquePtr<FImagePixelData> MakePaneData(const FCase& InCase, const TArray64<FLinearColor>& InPixels, const TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe>& InPayload)
+			{
+				if (InCase.PixelType == EImagePixelType::Float16)
+				{
+					TArray64<FFloat16Color> HalfPixels;
+					HalfPixels.SetNumUninitialized(InPixels.Num());
+					for (int64 Index = 0; Index < InPixels.Num(); Index++)
+					{
+						HalfPixels[Index] = FFloat16Color(InPixels[Index]);
+					}
+					return MakeUnique<TImagePixelData<FFloat16Color>>(InCase.PaneResolution, MoveTemp(HalfPixels), InPayload);
+				}
+				return MakeUnique<TImagePixelData<FLinearColor>>(InCase.PaneResolution, TArray64<FLinearColor>(InPixels), InPayload);
+			}
+
+			// Sub-pixel shift of a splatted sample, a fixed spread over the pixel like a sample sequence would give.
+			static FVector2D GetSplatShift(int32 InSampleIndex, int32 InNumSamples)
+			{
+				if (InNumSamples <= 1)
+				{
+					return FVector2D::ZeroVector;
+				}
+				const double Angle = 2.0 * UE_DOUBLE_PI * (InSampleIndex + 0.5) / InNumSamples;
+				const double Radius = 0.15 + 0.3 * InSampleIndex / (InNumSamples - 1);
+				return FVector2D(FMath::Cos(Angle) * Radius, FMath::Sin(Angle) * Radius);
+			}
+
+			// A pane as the reference sees it: its axes relative to the eye's camera, the yaw and pitch the falloff is measured
+			// from, and the pixels it shows.
+			struct FReferencePane
+			{
+				FVector Forward;
+				FVector Right;
+				FVector Up;
+				double YawRadians = 0.0;
+				double PitchRadians = 0.0;
+				const TArray64<FLinearColor>* Pixels = nullptr;
+			};
+
+			// The original blender's weighting and projection, in double: squared product of the horizontal and vertical angular
+			// falloffs, the output direction in the pane's view space projected with its horizontal field of view, the pane's
+			// Y flipped (minus one, as it always was), and no weight where the bilinear footprint leaves the pane.
+			static double GetReferenceWeight(const FCase& InCase, const FReferencePane& InPane, int32 InX, int32 InY, FVector2D& OutSamplePixelCoords)
+			{
+				const double Theta = FMath::DegreesToRadians(360.0 / InCase.OutputSize.X * (InX + 0.5) - 180.0);
+				const double Phi = FMath::DegreesToRadians(180.0 / InCase.OutputSize.Y * ((InCase.OutputSize.Y - InY) + 0.5) - 90.0);
+				const double HalfHorizontalCosine = FMath::Cos(FMath::DegreesToRadians(0.5 * InCase.HorizontalFieldOfView));
+				const double HalfVerticalCosine = FMath::Cos(FMath::DegreesToRadians(0.5 * InCase.VerticalFieldOfView));
+				const double ThetaDot = FMath::Cos(Theta) * FMath::Cos(InPane.YawRadians) + FMath::Sin(Theta) * FMath::Sin(InPane.YawRadians);
+				const double PhiDot = FMath::Cos(Phi) * FMath::Cos(InPane.PitchRadians) + FMath::Sin(Phi) * FMath::Sin(InPane.PitchRadians);
+				const double Weight = FMath::Max(ThetaDot - HalfHorizontalCosine, 0.0) / (1.0 - HalfHorizontalCosine)
+					* FMath::Max(PhiDot - HalfVerticalCosine, 0.0) / (1.0 - HalfVerticalCosine);
+				if (Weight * Weight <= KINDA_SMALL_NUMBER)
+				{
+					return 0.0;
+				}
+
+				const FVector Direction(FMath::Cos(Phi) * FMath::Cos(Theta), FMath::Cos(Phi) * FMath::Sin(Theta), FMath::Sin(Phi));
+				const double ViewForward = FVector::DotProduct(Direction, InPane.Forward);
+				if (ViewForward <= 0.0)
+				{
+					return 0.0;
+				}
+				const double InvTanHalfFieldOfView = 1.0 / FMath::Tan(FMath::DegreesToRadians(0.5 * InCase.HorizontalFieldOfView));
+				const double NDCX = FVector::DotProduct(Direction, InPane.Right) / ViewForward * InvTanHalfFieldOfView;
+				const double NDCY = FVector::DotProduct(Direction, InPane.Up) / ViewForward * InvTanHalfFieldOfView * InCase.PaneResolution.X / InCase.PaneResolution.Y;
+				OutSamplePixelCoords.X = (NDCX + 1.0) / 2.0 * InCase.PaneResolution.X;
+				OutSamplePixelCoords.Y = InCase.PaneResolution.Y - (NDCY + 1.0) / 2.0 * InCase.PaneResolution.Y - 1.0;
+
+				const int32 LowerLeftX = FMath::RoundToInt(OutSamplePixelCoords.X - 0.5);
+				const int32 LowerLeftY = FMath::RoundToInt(OutSamplePixelCoords.Y - 0.5);
+				if (LowerLeftX < 0 || LowerLeftY < 0 || LowerLeftX + 1 > InCase.PaneResolution.X - 1 || LowerLeftY + 1 > InCase.PaneResolution.Y - 1)
+				{
+					return 0.0;
+				}
+				return Weight * Weight;
+			}
+
+			static double EvaluateReferenceKernel(EPanoramicResampleFilter InFilter, double InDistance)
+			{
+				const double X = FMath::Abs(InDistance);
+				switch (InFilter)
+				{
+					case EPanoramicResampleFilter::Bicubic:
+						// Catmull-Rom.
+						return X < 1.0 ? (1.5 * X - 2.5) * X * X + 1.0 : (X < 2.0 ? ((-0.5 * X + 2.5) * X - 4.0) * X + 2.0 : 0.0);
+					case EPanoramicResampleFilter::Lanczos3:
+						return X < UE_DOUBLE_KINDA_SMALL_NUMBER ? 1.0 : (X < 3.0 ? 3.0 * FMath::Sin(UE_DOUBLE_PI * X) * FMath::Sin(UE_DOUBLE_PI * X / 3.0) / (UE_DOUBLE_PI * UE_DOUBLE_PI * X * X) : 0.0);
+					default:
+						return FMath::Max(1.0 - X, 0.0);
+				}
+			}
+
+			// Resamples at the exact pane coordinate, the kernel's taps clamped to the pane and its weights normalized.
+			static FLinearColor SampleReference(const TArray64<FLinearColor>& InPixels, const FIntPoint& InSize, const FVector2D& InSamplePixelCoords, EPanoramicResampleFilter InFilter)
+			{
+				// Pixel coordinates assume that 0.5, 0.5 is the center of the pixel.
+				const double U = InSamplePixelCoords.X - 0.5;
+				const double V = InSamplePixelCoords.Y - 0.5;
+				auto Fetch = [&](int32 InX, int32 InY)
+				{
+					return InPixels[FMath::Clamp(InX, 0, InSize.X - 1) + (int64)FMath::Clamp(InY, 0, InSize.Y - 1) * InSize.X];
+				};
+				if (InFilter == EPanoramicResampleFilter::Nearest)
+				{
+					return Fetch(FMath::FloorToInt(U + 0.5), FMath::FloorToInt(V + 0.5));
+				}
+				const int32 NumTaps = InFilter == EPanoramicResampleFilter::Bicubic ? 4 : (InFilter == EPanoramicResampleFilter::Lanczos3 ? 6 : 2);
+				const int32 FirstX = FMath::FloorToInt(U) + 1 - NumTaps / 2;
+				const int32 FirstY = FMath::FloorToInt(V) + 1 - NumTaps / 2;
+				double WeightSumX = 0.0;
+				double WeightSumY = 0.0;
+				for (int32 Tap = 0; Tap < NumTaps; Tap++)
+				{
+					WeightSumX += EvaluateReferenceKernel(InFilter, FirstX + Tap - U);
+					WeightSumY += EvaluateReferenceKernel(InFilter, FirstY + Tap - V);
+				}
+				FLinearColor Result(0.f, 0.f, 0.f, 0.f);
+				for (int32 TapY = 0; TapY < NumTaps; TapY++)
+				{
+					const double WeightY = EvaluateReferenceKernel(InFilter, FirstY + TapY - V) / WeightSumY;
+					for (int32 TapX = 0; TapX < NumTaps; TapX++)
+					{
+						const double WeightX = EvaluateReferenceKernel(InFilter, FirstX + TapX - U) / WeightSumX;
+						Result += Fetch(FirstX + TapX, FirstY + TapY) * (float)(WeightX * WeightY);
+					}
+				}
+				return Result;
+			}
+
+			static void RunCase(const FCase& InCase, FAutomationTestBase& InTest)
+			{
+				const int32 NumPanes = InCase.NumHorizontalSteps * InCase.NumVerticalSteps;
+				const int32 NumEyes = InCase.bStereo ? 2 : 1;
+				const FMoviePipelinePassIdentifier PassIdentifier(TEXT("PanoramicValidation"));
+
+				// Panes oriented like the pass renders them. Panes shared by the eyes are rendered from the sequence camera.
+				TArray<FPanoPane> Panes;
+				Panes.SetNum(NumPanes);
+				for (int32 PaneIndex = 0; PaneIndex < NumPanes; PaneIndex++)
+				{
+					FPanoPane& Pane = Panes[PaneIndex];
+					Pane.OriginalCameraLocation = FVector::ZeroVector;
+					Pane.PrevOriginalCameraLocation = FVector::ZeroVector;
+					Pane.OriginalCameraRotation = FRotator::ZeroRotator;
+					Pane.PrevOriginalCameraRotation = FRotator::ZeroRotator;
+					Pane.NearClippingPlane = 10.f;
+					Pane.EyeSeparation = 0.f;
+					Pane.EyeConvergenceDistance = 0.f;
+					Pane.HorizontalFieldOfView = InCase.HorizontalFieldOfView;
+					Pane.VerticalFieldOfView = InCase.VerticalFieldOfView;
+					Pane.Resolution = InCase.PaneResolution;
+					Pane.NumHorizontalSteps = InCase.NumHorizontalSteps;
+					Pane.NumVerticalSteps = InCase.NumVerticalSteps;
+					Pane.HorizontalStepIndex = PaneIndex % InCase.NumHorizontalSteps;
+					Pane.VerticalStepIndex = PaneIndex / InCase.NumHorizontalSteps;
+					Pane.EyeIndex = InCase.bStereo ? 0 : -1;
+					Pane.NumMonoPolarRows = InCase.bStereo ? InCase.NumMonoPolarRows : 0;
+					Pane.EyeConvergenceYaw = InCase.EyeConvergenceYaw;
+					Pane.bIncludeAlpha = InCase.bIncludeAlpha;
+					GetCameraOrientationForStereo(Pane.CameraLocation, Pane.CameraRotation, Pane, /*bInPrevPosition*/ false);
+					Pane.PrevCameraLocation = Pane.CameraLocation;
+					Pane.PrevCameraRotation = Pane.CameraRotation;
+				}
+
+				// The unshifted panes of every eye. Shared panes only exist once, both eyes see the left eye's image of them.
+				TArray<TArray64<FLinearColor>> PanePixels;
+				PanePixels.SetNum(NumPanes * NumEyes);
+				ParallelFor(PanePixels.Num(), [&](int32 Index)
+				{
+					const int32 PaneIndex = Index % NumPanes;
+					const int32 EyeSlot = Index / NumPanes;
+					if (EyeSlot == 0 || !InCase.IsSharedRow(PaneIndex / InCase.NumHorizontalSteps))
+					{
+						PanePixels[Index] = MakePanePixels(InCase, PaneIndex, EyeSlot, FVector2D::ZeroVector);
+					}
+				});
+
+				// Every eye's rig relative to that eye's camera: a shared pane is turned by minus the eye's convergence yaw.
+				TArray<FReferencePane> ReferencePanes;
+				ReferencePanes.SetNum(NumPanes * NumEyes);
+				for (int32 Index = 0; Index < ReferencePanes.Num(); Index++)
+				{
+					const int32 PaneIndex = Index % NumPanes;
+					const int32 EyeSlot = Index / NumPanes;
+					const bool bShared = InCase.IsSharedRow(PaneIndex / InCase.NumHorizontalSteps);
+					FRotator Rotation = Panes[PaneIndex].CameraRotation;
+					if (bShared)
+					{
+						const double EyeYaw = EyeSlot == 0 ? InCase.EyeConvergenceYaw : -InCase.EyeConvergenceYaw;
+						Rotation = (FQuat(FRotator(0.0, -EyeYaw, 0.0)) * FQuat(Rotation)).Rotator();
+					}
+					const FRotationMatrix RotationMatrix(Rotation);
+					FReferencePane& ReferencePane = ReferencePanes[Index];
+					ReferencePane.Forward = RotationMatrix.GetUnitAxis(EAxis::X);
+					ReferencePane.Right = RotationMatrix.GetUnitAxis(EAxis::Y);
+					ReferencePane.Up = RotationMatrix.GetUnitAxis(EAxis::Z);
+					ReferencePane.YawRadians = FMath::DegreesToRadians(Rotation.Yaw);
+					ReferencePane.PitchRadians = FMath::DegreesToRadians(Rotation.Pitch);
+					ReferencePane.Pixels = &PanePixels[(bShared ? 0 : EyeSlot) * NumPanes + PaneIndex];
+				}
+
+				// Scalar reference, eyes stacked like the blender's output. Mips and splatted samples of a smooth ramp converge
+				// on the plain resampled pane, they are compared with it.
+				const double ReferenceStartTime = FPlatformTime::Seconds();
+				const bool bSelectMaxWeight = InCase.Path == EPath::SelectMaxWeight;
+				const EPanoramicResampleFilter ReferenceFilter = bSelectMaxWeight ? EPanoramicResampleFilter::Nearest : InCase.Filter;
+				TArray64<FLinearColor> Reference;
+				TArray64<bool> Covered;
+				Reference.SetNumZeroed((int64)InCase.OutputSize.X * InCase.OutputSize.Y * NumEyes);
+				Covered.SetNumZeroed(Reference.Num());
+				ParallelFor(InCase.OutputSize.Y * NumEyes, [&](int32 StackedRow)
+				{
+					const int32 EyeSlot = StackedRow / InCase.OutputSize.Y;
+					const int32 Y = StackedRow % InCase.OutputSize.Y;
+					for (int32 X = 0; X < InCase.OutputSize.X; X++)
+					{
+						FLinearColor Sum = FLinearColor(0.f, 0.f, 0.f, 0.f);
+						double WeightSum = 0.0;
+						double MaxWeight = 0.0;
+						for (int32 PaneIndex = 0; PaneIndex < NumPanes; PaneIndex++)
+						{
+							const FReferencePane& ReferencePane = ReferencePanes[EyeSlot * NumPanes + PaneIndex];
+							FVector2D SamplePixelCoords;
+							const double Weight = GetReferenceWeight(InCase, ReferencePane, X, Y, SamplePixelCoords);
+							if (Weight <= 0.0)
+							{
+								continue;
+							}
+							FLinearColor SampleColor = SampleReference(*ReferencePane.Pixels, InCase.PaneResolution, SamplePixelCoords, ReferenceFilter);
+							if (bSelectMaxWeight)
+							{
+								if (Weight > MaxWeight)
+								{
+									MaxWeight = Weight;
+									Sum = SampleColor;
+								}
+								WeightSum = 1.0;
+								continue;
+							}
+							if (!InCase.bIncludeAlpha)
+							{
+								SampleColor.A = 1.f;
+							}
+							Sum += SampleColor * (float)Weight;
+							WeightSum += Weight;
+						}
+						const int64 Index = X + (int64)StackedRow * InCase.OutputSize.X;
+						if (WeightSum > 0.0)
+						{
+							Reference[Index] = InCase.Pattern == EPattern::PlanarDepth ? FLinearColor(1.f, 1.f, 1.f, 1.f) : Sum / (float)WeightSum;
+							if (!InCase.bIncludeAlpha)
+							{
+								Reference[Index].A = 1.f;
+							}
+							Covered[Index] = true;
+						}
+					}
+				});
+				const double ReferenceTime = FPlatformTime::Seconds() - ReferenceStartTime;
+
+				// The blender, fed the same panes in rig order.
+				FPanoramicBlenderOptions Options;
+				Options.OutputPixelType = EPanoramicOutputPixelType::Float32;
+				Options.ResampleFilter = InCase.Filter;
+				Options.bMipFiltering = InCase.Path == EPath::Mips;
+				Options.bStreamingReprojection = InCase.Path == EPath::Streaming;
+				Options.bSplatSamples = InCase.NumSplatSamples > 1;
+				if (bSelectMaxWeight || InCase.Pattern == EPattern::PlanarDepth)
+				{
+					Options.AOVBlendModes.Add(PassIdentifier, bSelectMaxWeight ? EPanoramicAOVBlendMode::NearestMaxWeight : EPanoramicAOVBlendMode::Blend);
+				}
+				if (InCase.Pattern == EPattern::PlanarDepth)
+				{
+					Options.PlanarDepthAOVs.Add(PassIdentifier);
+				}
+				TSharedPtr<FCapturingOutputMerger> Merger = MakeShared<FCapturingOutputMerger>();
+				TSharedPtr<FPanoramicBlender> Blender = MakeShared<FPanoramicBlender>(Merger, InCase.OutputSize, Options);
+
+				const double BlendStartTime = FPlatformTime::Seconds();
+				for (int32 PaneIndex = 0; PaneIndex < NumPanes; PaneIndex++)
+				{
+					const int32 NumRenderedEyes = InCase.IsSharedRow(PaneIndex / InCase.NumHorizontalSteps) ? 1 : NumEyes;
+					for (int32 EyeSlot = 0; EyeSlot < NumRenderedEyes; EyeSlot++)
+					{
+						for (int32 SampleIndex = 0; SampleIndex < InCase.NumSplatSamples; SampleIndex++)
+						{
+							TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> Payload = MakeShared<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe>();
+							Payload->PassIdentifier = PassIdentifier;
+							Payload->SampleState.OutputState.OutputFrameNumber = 0;
+							Payload->SampleState.bWriteSampleToDisk = false;
+							Payload->Pane = Panes[PaneIndex];
+							Payload->Pane.EyeIndex = InCase.bStereo ? EyeSlot : -1;
+							if (InCase.NumSplatSamples > 1)
+							{
+								// Two temporal samples of half the spatial samples each.
+								const FVector2D Shift = GetSplatShift(SampleIndex, InCase.NumSplatSamples);
+								Payload->bSplatSample = true;
+								Payload->SampleState.SpatialSampleCount = InCase.NumSplatSamples / 2;
+								Payload->SampleState.TemporalSampleCount = 2;
+								Payload->SampleState.SpatialSampleIndex = SampleIndex % (InCase.NumSplatSamples / 2);
+								Payload->SampleState.TemporalSampleIndex = SampleIndex / (InCase.NumSplatSamples / 2);
+								Payload->SampleState.SpatialShiftX = Shift.X;
+								Payload->SampleState.SpatialShiftY = Shift.Y;
+								Blender->OnCompleteRenderPassDataAvailable_AnyThread(MakePaneData(InCase, MakePanePixels(InCase, PaneIndex, EyeSlot, Shift), Payload));
+								continue;
+							}
+							Blender->OnCompleteRenderPassDataAvailable_AnyThread(MakePaneData(InCase, PanePixels[EyeSlot * NumPanes + PaneIndex], Payload));
+						}
+					}
+				}
+				Blender->WaitForBlendWorkers();
+				const double BlendTime = FPlatformTime::Seconds() - BlendStartTime;
+				Blender.Reset();
+
+				TUniquePtr<FImagePixelData> Output = Merger->TakeOutput();
+				const FIntPoint ExpectedSize(InCase.OutputSize.X, InCase.OutputSize.Y * NumEyes);
+				if (!Output.IsValid() || Output->GetType() != EImagePixelType::Float32 || Output->GetSize() != ExpectedSize)
+				{
+					InTest.AddError(FString::Printf(TEXT("%s: the blender didn't produce a %dx%d float frame."), *InCase.Name, ExpectedSize.X, ExpectedSize.Y));
+					return;
+				}
+				const FLinearColor* Result = static_cast<const TImagePixelData<FLinearColor>*>(Output.Get())->Pixels.GetData();
+
+				double MaxError = 0.0;
+				double ErrorSum = 0.0;
+				int64 NumCovered = 0;
+				int64 NumOutliers = 0;
+				for (int64 Index = 0; Index < Reference.Num(); Index++)
+				{
+					if (!Covered[Index])
+					{
+						continue;
+					}
+					const FLinearColor Difference = Result[Index] - Reference[Index];
+					const float Error = FMath::Max(FMath::Max(FMath::Abs(Difference.R), FMath::Abs(Difference.G)), FMath::Max(FMath::Abs(Difference.B), FMath::Abs(Difference.A)));
+					MaxError = FMath::Max<double>(MaxError, Error);
+					ErrorSum += Error;
+					NumCovered++;
+					NumOutliers += (Error > InCase.MaxError || FMath::IsNaN(Error)) ? 1 : 0;
+				}
+				if (!InTest.TestTrue(FString::Printf(TEXT("%s: the reference covers the output"), *InCase.Name), NumCovered > 0))
+				{
+					return;
+				}
+				const double OutlierFraction = (double)NumOutliers / NumCovered;
+				InTest.TestTrue(FString::Printf(TEXT("%s: %.3f%% of pixels over %.4f (%.3f%% allowed), max error %.6f"), *InCase.Name,
+					OutlierFraction * 100.0, InCase.MaxError, InCase.MaxOutlierFraction * 100.0, MaxError), OutlierFraction <= InCase.MaxOutlierFraction);
+				InTest.AddInfo(FString::Printf(TEXT("%s: mean error %.7f, blend %.1f ms, reference %.1f ms."), *InCase.Name, ErrorSum / NumCovered, BlendTime * 1000.0, ReferenceTime * 1000.0));
+			}
+
+			static TArray<FCase> MakeCases()
+			{
+				struct FRig
+				{
+					const TCHAR* Name;
+					int32 NumHorizontalSteps;
+					int32 NumVerticalSteps;
+					float FieldOfView;
+				};
+				const FRig Rigs[] = { { TEXT("8x3"), 8, 3, 90.f }, { TEXT("6x4"), 6, 4, 80.f } };
+				static constexpr int32 OutputWidth = 512;
+				const FIntPoint OutputSize(OutputWidth, OutputWidth / 2);
+				auto GetFilterName = [](EPanoramicResampleFilter InFilter)
+				{
+					switch (InFilter)
+					{
+						case EPanoramicResampleFilter::Nearest: return TEXT("nearest");
+						case EPanoramicResampleFilter::Bicubic: return TEXT("bicubic");
+						case EPanoramicResampleFilter::Lanczos3: return TEXT("lanczos3");
+						default: return TEXT("bilinear");
+					}
+				};
+
+				TArray<FCase> Cases;
+				for (const FRig& Rig : Rigs)
+				{
+					// About as many pane texels per degree as output pixels, so nothing is prefiltered unless asked for.
+					const int32 PaneSize = FMath::Max(FMath::RoundToInt(OutputWidth * Rig.FieldOfView / 360.f), 16);
+					for (int32 Variant = 0; Variant < 8; Variant++)
+					{
+						FCase Case;
+						Case.NumHorizontalSteps = Rig.NumHorizontalSteps;
+						Case.NumVerticalSteps = Rig.NumVerticalSteps;
+						Case.HorizontalFieldOfView = Rig.FieldOfView;
+						Case.VerticalFieldOfView = Rig.FieldOfView;
+						Case.PaneResolution = FIntPoint(PaneSize, PaneSize);
+						Case.OutputSize = OutputSize;
+						Case.bStereo = (Variant & 1) != 0;
+						Case.bIncludeAlpha = (Variant & 2) != 0;
+						Case.PixelType = (Variant & 4) != 0 ? EImagePixelType::Float16 : EImagePixelType::Float32;
+						const FString VariantName = FString::Printf(TEXT("%s %s %s %s"), Rig.Name, Case.bStereo ? TEXT("stereo") : TEXT("mono"),
+							Case.bIncludeAlpha ? TEXT("alpha") : TEXT("opaque"), Case.PixelType == EImagePixelType::Float16 ? TEXT("F16") : TEXT("F32"));
+
+						for (EPattern Pattern : { EPattern::Gradient, EPattern::Checkerboard })
+						{
+							Case.Pattern = Pattern;
+							const bool bSharp = Pattern == EPattern::Checkerboard;
+							const FString Prefix = VariantName + (bSharp ? TEXT(" checker") : TEXT(" gradient"));
+
+							for (EPanoramicResampleFilter Filter : { EPanoramicResampleFilter::Nearest, EPanoramicResampleFilter::Bilinear, EPanoramicResampleFilter::Bicubic, EPanoramicResampleFilter::Lanczos3 })
+							{
+								Case.Filter = Filter;
+								if (Filter == EPanoramicResampleFilter::Nearest)
+								{
+									Case.MaxError = 1e-4f;
+									Case.MaxOutlierFraction = 0.01f;
+								}
+								else
+								{
+									// The tables quantize sample positions to 1/256 texel, the streamed rows step the direction with a
+									// recurrence: both stay within a fraction of a percent of the contrast across an edge. The wider
+									// kernels are steeper across an edge, so the same position error shows a little more.
+									const bool bWideKernel = Filter != EPanoramicResampleFilter::Bilinear;
+									Case.MaxError = bSharp ? (bWideKernel ? 6e-3f : 4e-3f) : 1e-3f;
+									Case.MaxOutlierFraction = 0.f;
+								}
+								for (EPath Path : { EPath::Tables, EPath::Streaming })
+								{
+									Case.Path = Path;
+									Case.Name = FString::Printf(TEXT("%s %s %s"), *Prefix, GetFilterName(Filter), Path == EPath::Tables ? TEXT("tables") : TEXT("streaming"));
+									Cases.Add(Case);
+								}
+							}
+
+							Case.Filter = EPanoramicResampleFilter::Bilinear;
+							Case.Path = EPath::SelectMaxWeight;
+							Case.Name = Prefix + TEXT(" select");
+							Case.MaxError = 1e-4f;
+							Case.MaxOutlierFraction = 0.01f;
+							Cases.Add(Case);
+						}
+
+						// Mip prefiltering only changes panes denser than the output. On a smooth ramp the box filtered levels
+						// match the pane, so only the edges of the panes and the blend between levels may differ.
+						FCase MipCase = Case;
+						MipCase.Name = VariantName + TEXT(" dense gradient mips");
+						MipCase.PaneResolution = FIntPoint(PaneSize * 4, PaneSize * 4);
+						MipCase.Pattern = EPattern::Gradient;
+						MipCase.Path = EPath::Mips;
+						MipCase.Filter = EPanoramicResampleFilter::Bilinear;
+						MipCase.MaxError = 2e-3f;
+						MipCase.MaxOutlierFraction = 0.01f;
+						Cases.Add(MipCase);
+
+						// Splatted samples of a smooth ramp average to the unjittered pane. Where a shifted footprint reaches past
+						// the pane edge the clamped texel differs, that is a thin border of the pane.
+						for (EPath Path : { EPath::Tables, EPath::Streaming })
+						{
+							FCase SplatCase = Case;
+							SplatCase.Name = FString::Printf(TEXT("%s gradient splat %s"), *VariantName, Path == EPath::Tables ? TEXT("tables") : TEXT("streaming"));
+							SplatCase.Pattern = EPattern::Gradient;
+							SplatCase.Path = Path;
+							SplatCase.Filter = EPanoramicResampleFilter::Bilinear;
+							SplatCase.NumSplatSamples = 8;
+							SplatCase.MaxError = 2e-3f;
+							SplatCase.MaxOutlierFraction = 0.01f;
+							Cases.Add(SplatCase);
+						}
+
+						// Scene depth AOVs: every pane measures along its own axis, only the converted distance agrees across
+						// panes. The nearest texel of the selected pane is a fraction of a texel off the output direction,
+						// where the depth changes fastest that is up to about a percent.
+						if (Case.PixelType == EImagePixelType::Float32 && !Case.bIncludeAlpha)
+						{
+							for (EPath Path : { EPath::Tables, EPath::Streaming, EPath::SelectMaxWeight })
+							{
+								FCase DepthCase = Case;
+								DepthCase.Pattern = EPattern::PlanarDepth;
+								DepthCase.Path = Path;
+								DepthCase.Filter = EPanoramicResampleFilter::Bilinear;
+								DepthCase.MaxError = Path == EPath::SelectMaxWeight ? 2e-2f : 1e-3f;
+								DepthCase.MaxOutlierFraction = 0.f;
+								DepthCase.Name = VariantName + (Path == EPath::Tables ? TEXT(" planar depth tables") : (Path == EPath::Streaming ? TEXT(" planar depth streaming") : TEXT(" planar depth select")));
+								Cases.Add(DepthCase);
+							}
+						}
+					}
+				}
+
+				// Stereo rigs whose top and bottom rows are rendered once for both eyes, with a convergence yaw that isn't a
+				// whole number of output columns. Each eye has to see the shared rows turned by its own yaw, with weights that
+				// still sum to one where they meet the rows rendered per eye.
+				for (int32 Variant = 0; Variant < 2; Variant++)
+				{
+					FCase Case;
+					Case.NumHorizontalSteps = 8;
+					Case.NumVerticalSteps = 5;
+					Case.HorizontalFieldOfView = 90.f;
+					Case.VerticalFieldOfView = 90.f;
+					Case.PaneResolution = FIntPoint(128, 128);
+					Case.OutputSize = OutputSize;
+					Case.bStereo = true;
+					Case.bIncludeAlpha = Variant != 0;
+					Case.PixelType = Variant != 0 ? EImagePixelType::Float16 : EImagePixelType::Float32;
+					Case.NumMonoPolarRows = 1;
+					Case.EyeConvergenceYaw = 2.3f;
+					const FString VariantName = FString::Printf(TEXT("8x5 shared polar %s %s"), Case.bIncludeAlpha ? TEXT("alpha") : TEXT("opaque"), Case.PixelType == EImagePixelType::Float16 ? TEXT("F16") : TEXT("F32"));
+					for (EPattern Pattern : { EPattern::Gradient, EPattern::Checkerboard })
+					{
+						Case.Pattern = Pattern;
+						const bool bSharp = Pattern == EPattern::Checkerboard;
+						const FString Prefix = VariantName + (bSharp ? TEXT(" checker") : TEXT(" gradient"));
+						for (EPath Path : { EPath::Tables, EPath::Streaming, EPath::SelectMaxWeight })
+						{
+							Case.Path = Path;
+							Case.MaxError = Path == EPath::SelectMaxWeight ? 1e-4f : (bSharp ? 4e-3f : 1e-3f);
+							Case.MaxOutlierFraction = Path == EPath::SelectMaxWeight ? 0.01f : 0.f;
+							Case.Name = Prefix + (Path == EPath::Tables ? TEXT(" tables") : (Path == EPath::Streaming ? TEXT(" streaming") : TEXT(" select")));
+							Cases.Add(Case);
+						}
+					}
+				}
+				return Cases;
+			}
+		}
+	}
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FPanoramicBlenderTest, "MoviePipeline.Panoramic.Blender", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+void FPanoramicBlenderTest::GetTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands) const
+{
+	for (const MoviePipeline::Panoramic::Validation::FCase& Case : MoviePipeline::Panoramic::Validation::MakeCases())
+	{
+		OutBeautifiedNames.Add(Case.Name);
+		OutTestCommands.Add(Case.Name);
+	}
+}
+
+bool FPanoramicBlenderTest::RunTest(const FString& Parameters)
+{
+	using namespace MoviePipeline::Panoramic::Validation;
+	const TArray<FCase> Cases = MakeCases();
+	const FCase* Case = Cases.FindByPredicate([&Parameters](const FCase& InCase) { return InCase.Name == Parameters; });
+	if (!Case)
+	{
+		AddError(FString::Printf(TEXT("No panoramic blender case named %s."), *Parameters));
+		return false;
+	}
+	RunCase(*Case, *this);
+	return true;
+}
+
+// MoviePipeline.Panoramic.ShardMerge
+// Merges two pre-normalized alpha shards the way PanoramicShardMerge does, through files on disk. Their colors are final, the
+// summed alpha is no coverage: a pixel both shards cover with transparent colors has to keep its color.
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPanoramicShardMergeTest, "MoviePipeline.Panoramic.ShardMerge", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FPanoramicShardMergeTest::RunTest(const FString& Parameters)
+{
+	// Pixel 0 is transparent and covered by both shards, pixel 1 opaque and covered by both, pixel 2 only covered by the first
+	// shard and pixel 3 by none.
+	const FLinearColor Transparent(0.8f, 0.4f, 0.2f, 0.f);
+	const FLinearColor Opaque(0.1f, 0.6f, 0.9f, 1.f);
+	const FLinearColor Single(0.5f, 0.5f, 0.25f, 0.5f);
+	const float Shares[] = { 0.3f, 0.7f };
+
+	const FString Directory = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("PanoramicShardMerge"));
+	TArray64<FLinearColor> Color;
+	TArray64<float> Weight;
+	Color.SetNumZeroed(4);
+	Weight.SetNumZeroed(4);
+	for (int32 ShardIndex = 0; ShardIndex < 2; ShardIndex++)
+	{
+		FPanoramicAccumulationFile Shard;
+		Shard.OutputSize = FIntPoint(4, 1);
+		Shard.NumEyes = 1;
+		Shard.bIncludeAlpha = true;
+		Shard.NumShards = 2;
+		Shard.ShardIndex = ShardIndex;
+		Shard.bPreNormalized = true;
+		Shard.PassName = TEXT("FinalImage");
+
+		FPanoramicAccumulationRegion& Region = Shard.Regions.AddDefaulted_GetRef();
+		Region.Size = FIntPoint(ShardIndex == 0 ? 3 : 2, 1);
+		Region.Color.Add(Transparent * Shares[ShardIndex]);
+		Region.Color.Add(Opaque * Shares[ShardIndex]);
+		if (ShardIndex == 0)
+		{
+			Region.Color.Add(Single);
+		}
+
+		const FString Filename = FPaths::Combine(Directory, FString::Printf(TEXT("Shard%d.%s"), ShardIndex, FPanoramicAccumulationFile::GetFileExtension()));
+		FPanoramicAccumulationFile Loaded;
+		if (!TestTrue(TEXT("Shard saved"), Shard.Save(Filename)) || !TestTrue(TEXT("Shard loaded"), Loaded.Load(Filename)))
+		{
+			IFileManager::Get().DeleteDirectory(*Directory, false, true);
+			return false;
+		}
+		Loaded.AccumulateInto(Color, Weight);
+	}
+	IFileManager::Get().DeleteDirectory(*Directory, false, true);
+
+	FPanoramicAccumulationFile::Normalize(Color, Weight, true, true);
+	const FLinearColor Expected[] = { Transparent, Opaque, Single, FLinearColor(0.f, 0.f, 0.f, 0.f) };
+	for (int32 PixelIndex = 0; PixelIndex < 4; PixelIndex++)
+	{
+		TestTrue(FString::Printf(TEXT("Pixel %d is %s, expected %s"), PixelIndex, *Color[PixelIndex].ToString(), *Expected[PixelIndex].ToString()), Color[PixelIndex].Equals(Expected[PixelIndex], 1e-5f));
+	}
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,70 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicEXROutput.h"
+#include "PanoramicEXRWriter.h"
+#include "Async/Async.h"
+#include "ImagePixelData.h"
+#include "Misc/Paths.h"
+#include "MoviePipeline.h"
+#include "MoviePipelineOutputSetting.h"
+#include "MoviePipelinePrimaryConfig.h"
+#include "MoviePipelineUtils.h"
+#include "MovieRenderPipelineDataTypes.h"
+
+#include UE_INLINE_GENERATED_CPP_BY_NAME(PanoramicEXROutput)
+
+void UMoviePipelinePanoramicEXROutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame)
+{
+	check(InMergedOutputFrame);
+
+	// Multilayer files hold every pass of the frame in one file, and burn ins are composited onto the final image.
+	bool bUseEngineWriter = bMultilayer;
+	for (const TPair<FMoviePipelinePassIdentifier, TUniquePtr<FImagePixelData>>& RenderPassData : InMergedOutputFrame->ImageOutputData)
+	{
+		const EImagePixelType PixelType = RenderPassData.Value->GetType();
+		bUseEngineWriter |= PixelType != EImagePixelType::Float16 && PixelType != EImagePixelType::Float32;
+		bUseEngineWriter |= RenderPassData.Value->GetPayload<FImagePixelDataPayload>()->bCompositeToFinalImage;
+	}
+	if (bUseEngineWriter)
+	{
+		Super::OnReceiveImageDataImpl(InMergedOutputFrame);
+		return;
+	}
+
+	UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelinePrimaryConfig()->FindSetting<UMoviePipelineOutputSetting>();
+	check(OutputSettings);
+	const bool bIncludeRenderPass = InMergedOutputFrame->ImageOutputData.Num() > 1;
+
+	FPanoramicEXRWriter::FOptions WriterOptions;
+	WriterOptions.bCompress = Compression != EEXRCompressionFormat::None;
+	WriterOptions.Metadata = InMergedOutputFrame->FileMetadata;
+
+	for (const TPair<FMoviePipelinePassIdentifier, TUniquePtr<FImagePixelData>>& RenderPassData : InMergedOutputFrame->ImageOutputData)
+	{
+		// Resolved the way the engine's image sequence outputs do, so switching between them keeps the file names.
+		FString FileNameFormatString = OutputSettings->OutputDirectory.Path / OutputSettings->FileNameFormat;
+		UE::MoviePipeline::ValidateOutputFormatString(FileNameFormatString, bIncludeRenderPass, /*bTestFrameNumber*/ true);
+		TMap<FString, FString> FormatOverrides;
+		FormatOverrides.Add(TEXT("render_pass"), RenderPassData.Key.Name);
+		FormatOverrides.Add(TEXT("ext"), TEXT("exr"));
+		FMoviePipelineFormatArgs FinalFormatArgs;
+		FString FinalFilePath;
+		GetPipeline()->ResolveFilenameFormatArguments(FileNameFormatString, FormatOverrides, FinalFilePath, FinalFormatArgs, &InMergedOutputFrame->FrameOutputState);
+		if (FPaths::IsRelative(FinalFilePath))
+		{
+			FinalFilePath = FPaths::ConvertRelativePathToFull(FinalFilePath);
+		}
+
+		// Other outputs may still read the frame, the writer gets a copy of its own like the engine's image write tasks.
+		TSharedPtr<FImagePixelData, ESPMode::ThreadSafe> PixelData(RenderPassData.Value->CopyImageData().Release());
+		TFuture<bool> Future = Async(EAsyncExecution::ThreadPool, [PixelData, FinalFilePath, WriterOptions]()
+		{
+			return FPanoramicEXRWriter::Write(*PixelData, FinalFilePath, WriterOptions);
+		});
+
+		MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+		OutputData.Shot = GetPipeline()->GetActiveShotList()[GetPipeline()->GetCurrentShotIndex()];
+		OutputData.PassIdentifier = RenderPassData.Key;
+		OutputData.FilePath = FinalFilePath;
+		GetPipeline()->AddOutputFuture(MoveTemp(Future), OutputData);
+	}
+}
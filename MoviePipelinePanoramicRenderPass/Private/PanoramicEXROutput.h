@@ -0,0 +1,24 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "MoviePipelineEXROutput.h"
+#include "PanoramicEXROutput.generated.h"
+
+/**
+ * EXR image sequence output for large panoramas. Every float pass of a frame is written by FPanoramicEXRWriter, which
+ * compresses the rows in chunks on all workers instead of on the single thread of the engine's EXR writer.
+ * ZIP compression is used for any compression other than None. Multilayer files, and frames with 8 bit or composited
+ * passes, go through the engine's writer.
+ */
+UCLASS(BlueprintType)
+class UMoviePipelinePanoramicEXROutput : public UMoviePipelineImageSequenceOutput_EXR
+{
+	GENERATED_BODY()
+
+protected:
+	// UMoviePipelineOutputBase API
+	virtual void OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame) override;
+#if WITH_EDITOR
+	virtual FText GetDisplayText() const override { return NSLOCTEXT("MovieRenderPipeline", "PanoramicEXROutput_DisplayName", "Panoramic .exr Sequence (chunked)"); }
+#endif
+};
@@ -0,0 +1,257 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicEXRWriter.h"
+#include "ImagePixelData.h"
+#include "HAL/FileManager.h"
+#include "Misc/Compression.h"
+#include "Misc/Paths.h"
+#include "Async/ParallelFor.h"
+#include "MovieRenderPipelineCoreModule.h"
+
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		// Fixed by the format: ZIP compressed files keep 16 rows per chunk, uncompressed ones a single row.
+		static constexpr int32 EXRZipRowsPerChunk = 16;
+		// Attribute names longer than this need the long names flag in the version field.
+		static constexpr int32 EXRMaxShortNameLength = 31;
+
+		// The header is little endian like every platform we render on, values are appended as they are in memory.
+		template<typename ValueType>
+		static void AppendEXRValue(TArray<uint8>& OutBytes, const ValueType& InValue)
+		{
+			OutBytes.Append(reinterpret_cast<const uint8*>(&InValue), sizeof(ValueType));
+		}
+
+		static void AppendEXRString(TArray<uint8>& OutBytes, const FString& InString, bool bInNullTerminated)
+		{
+			const FTCHARToUTF8 Converter(*InString);
+			OutBytes.Append(reinterpret_cast<const uint8*>(Converter.Get()), Converter.Length());
+			if (bInNullTerminated)
+			{
+				OutBytes.Add(0);
+			}
+		}
+
+		static void AppendEXRAttribute(TArray<uint8>& OutHeader, const FString& InName, const TCHAR* InType, const TArray<uint8>& InValue)
+		{
+			AppendEXRString(OutHeader, InName, true);
+			AppendEXRString(OutHeader, InType, true);
+			AppendEXRValue<int32>(OutHeader, InValue.Num());
+			OutHeader.Append(InValue);
+		}
+
+		// What OpenEXR does to a chunk before deflating it: the even bytes of the rows go to the first half and the odd ones to
+		// the second, then every byte is replaced by its difference to the previous one. Smooth images deflate much better so.
+		static void ApplyEXRZipPredictor(const uint8* InRaw, int64 InNumBytes, uint8* OutPredicted)
+		{
+			uint8* FirstHalf = OutPredicted;
+			uint8* SecondHalf = OutPredicted + (InNumBytes + 1) / 2;
+			for (int64 Index = 0; Index < InNumBytes; Index += 2)
+			{
+				*FirstHalf++ = InRaw[Index];
+				if (Index + 1 < InNumBytes)
+				{
+					*SecondHalf++ = InRaw[Index + 1];
+				}
+			}
+			int32 Previous = OutPredicted[0];
+			for (int64 Index = 1; Index < InNumBytes; Index++)
+			{
+				const int32 Current = OutPredicted[Index];
+				OutPredicted[Index] = (uint8)(Current - Previous + (128 + 256));
+				Previous = Current;
+			}
+		}
+	}
+}
+
+bool FPanoramicEXRWriter::Write(const FImagePixelData& InPixelData, const FString& InFilename, const FOptions& InOptions)
+{
+	using namespace MoviePipeline::Panoramic;
+
+	const EImagePixelType PixelType = InPixelData.GetType();
+	if (PixelType != EImagePixelType::Float16 && PixelType != EImagePixelType::Float32)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Panoramic EXR writer only writes float images, %s is not one."), *InFilename);
+		return false;
+	}
+	const bool bHalf = PixelType == EImagePixelType::Float16;
+	const FIntPoint Size = InPixelData.GetSize();
+	const void* RawData = nullptr;
+	int64 RawSizeInBytes = 0;
+	InPixelData.GetRawData(RawData, RawSizeInBytes);
+	if (Size.X <= 0 || Size.Y <= 0 || !RawData)
+	{
+		return false;
+	}
+
+	/************************************************ Header *************************************************/
+	TArray<uint8> Header;
+	{
+		bool bLongNames = false;
+		for (const TPair<FString, FString>& KVP : InOptions.Metadata)
+		{
+			bLongNames |= FTCHARToUTF8(*KVP.Key).Length() > EXRMaxShortNameLength;
+		}
+		AppendEXRValue<int32>(Header, 20000630);
+		AppendEXRValue<int32>(Header, 2 | (bLongNames ? 0x400 : 0));
+
+		// Channels are stored in alphabetical order.
+		TArray<uint8> Value;
+		for (const TCHAR* ChannelName : { TEXT("A"), TEXT("B"), TEXT("G"), TEXT("R") })
+		{
+			AppendEXRString(Value, ChannelName, true);
+			AppendEXRValue<int32>(Value, bHalf ? 1 : 2);
+			// Linear flag and three reserved bytes.
+			AppendEXRValue<int32>(Value, 0);
+			AppendEXRValue<int32>(Value, 1);
+			AppendEXRValue<int32>(Value, 1);
+		}
+		Value.Add(0);
+		AppendEXRAttribute(Header, TEXT("channels"), TEXT("chlist"), Value);
+
+		Value.Reset();
+		AppendEXRValue<uint8>(Value, InOptions.bCompress ? 3 : 0);
+		AppendEXRAttribute(Header, TEXT("compression"), TEXT("compression"), Value);
+
+		Value.Reset();
+		AppendEXRValue<int32>(Value, 0);
+		AppendEXRValue<int32>(Value, 0);
+		AppendEXRValue<int32>(Value, Size.X - 1);
+		AppendEXRValue<int32>(Value, Size.Y - 1);
+		AppendEXRAttribute(Header, TEXT("dataWindow"), TEXT("box2i"), Value);
+		AppendEXRAttribute(Header, TEXT("displayWindow"), TEXT("box2i"), Value);
+
+		Value.Reset();
+		AppendEXRValue<uint8>(Value, 0);
+		AppendEXRAttribute(Header, TEXT("lineOrder"), TEXT("lineOrder"), Value);
+
+		Value.Reset();
+		AppendEXRValue<float>(Value, 1.f);
+		AppendEXRAttribute(Header, TEXT("pixelAspectRatio"), TEXT("float"), Value);
+		AppendEXRAttribute(Header, TEXT("screenWindowWidth"), TEXT("float"), Value);
+
+		Value.Reset();
+		AppendEXRValue<float>(Value, 0.f);
+		AppendEXRValue<float>(Value, 0.f);
+		AppendEXRAttribute(Header, TEXT("screenWindowCenter"), TEXT("v2f"), Value);
+
+		static const TSet<FString> RequiredAttributes = { TEXT("channels"), TEXT("compression"), TEXT("dataWindow"), TEXT("displayWindow"),
+			TEXT("lineOrder"), TEXT("pixelAspectRatio"), TEXT("screenWindowWidth"), TEXT("screenWindowCenter") };
+		for (const TPair<FString, FString>& KVP : InOptions.Metadata)
+		{
+			if (KVP.Key.IsEmpty() || RequiredAttributes.Contains(KVP.Key))
+			{
+				continue;
+			}
+			Value.Reset();
+			AppendEXRString(Value, KVP.Value, false);
+			AppendEXRAttribute(Header, KVP.Key, TEXT("string"), Value);
+		}
+		Header.Add(0);
+	}
+
+	/************************************************ Chunks *************************************************/
+	// Every chunk is laid out as its rows, each row as all of its A values, then B, G and R, and compressed on its own.
+	const int32 RowsPerChunk = InOptions.bCompress ? EXRZipRowsPerChunk : 1;
+	const int32 NumChunks = FMath::DivideAndRoundUp(Size.Y, RowsPerChunk);
+	const int32 BytesPerValue = bHalf ? sizeof(uint16) : sizeof(float);
+	const int64 BytesPerRow = (int64)Size.X * 4 * BytesPerValue;
+	TArray<TArray64<uint8>> Chunks;
+	Chunks.SetNum(NumChunks);
+	ParallelFor(NumChunks, [&](int32 ChunkIndex)
+	{
+		const int32 FirstRow = ChunkIndex * RowsPerChunk;
+		const int32 NumRows = FMath::Min(RowsPerChunk, Size.Y - FirstRow);
+		TArray64<uint8> Raw;
+		Raw.SetNumUninitialized(BytesPerRow * NumRows);
+		for (int32 RowInChunk = 0; RowInChunk < NumRows; RowInChunk++)
+		{
+			const int64 SourceOffset = (int64)(FirstRow + RowInChunk) * Size.X;
+			uint8* Dest = Raw.GetData() + RowInChunk * BytesPerRow;
+			if (bHalf)
+			{
+				const FFloat16Color* Source = static_cast<const FFloat16Color*>(RawData) + SourceOffset;
+				uint16* DestValues = reinterpret_cast<uint16*>(Dest);
+				for (int32 X = 0; X < Size.X; X++)
+				{
+					DestValues[X] = Source[X].A.Encoded;
+					DestValues[Size.X + X] = Source[X].B.Encoded;
+					DestValues[2 * Size.X + X] = Source[X].G.Encoded;
+					DestValues[3 * Size.X + X] = Source[X].R.Encoded;
+				}
+			}
+			else
+			{
+				const FLinearColor* Source = static_cast<const FLinearColor*>(RawData) + SourceOffset;
+				float* DestValues = reinterpret_cast<float*>(Dest);
+				for (int32 X = 0; X < Size.X; X++)
+				{
+					DestValues[X] = Source[X].A;
+					DestValues[Size.X + X] = Source[X].B;
+					DestValues[2 * Size.X + X] = Source[X].G;
+					DestValues[3 * Size.X + X] = Source[X].R;
+				}
+			}
+		}
+		if (!InOptions.bCompress)
+		{
+			Chunks[ChunkIndex] = MoveTemp(Raw);
+			return;
+		}
+
+		TArray64<uint8> Predicted;
+		Predicted.SetNumUninitialized(Raw.Num());
+		ApplyEXRZipPredictor(Raw.GetData(), Raw.Num(), Predicted.GetData());
+		int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, (int32)Predicted.Num());
+		TArray64<uint8>& Compressed = Chunks[ChunkIndex];
+		Compressed.SetNumUninitialized(CompressedSize);
+		// Readers take a chunk that isn't smaller than its rows as stored uncompressed.
+		if (FCompression::CompressMemory(NAME_Zlib, Compressed.GetData(), CompressedSize, Predicted.GetData(), (int32)Predicted.Num()) && CompressedSize < Raw.Num())
+		{
+			Compressed.SetNum(CompressedSize, EAllowShrinking::No);
+		}
+		else
+		{
+			Compressed = MoveTemp(Raw);
+		}
+	});
+
+	/************************************************ File ***************************************************/
+	// The offset table points at every chunk, each chunk starts with its first row and its size.
+	TArray<uint64> ChunkOffsets;
+	ChunkOffsets.SetNumUninitialized(NumChunks);
+	uint64 ChunkOffset = Header.Num() + (uint64)NumChunks * sizeof(uint64);
+	for (int32 ChunkIndex = 0; ChunkIndex < NumChunks; ChunkIndex++)
+	{
+		ChunkOffsets[ChunkIndex] = ChunkOffset;
+		ChunkOffset += 2 * sizeof(int32) + Chunks[ChunkIndex].Num();
+	}
+
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(InFilename), true);
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*InFilename));
+	if (!Writer)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to open %s for writing."), *InFilename);
+		return false;
+	}
+	Writer->Serialize(Header.GetData(), Header.Num());
+	Writer->Serialize(ChunkOffsets.GetData(), ChunkOffsets.Num() * sizeof(uint64));
+	for (int32 ChunkIndex = 0; ChunkIndex < NumChunks; ChunkIndex++)
+	{
+		int32 FirstRow = ChunkIndex * RowsPerChunk;
+		int32 ChunkSize = (int32)Chunks[ChunkIndex].Num();
+		*Writer << FirstRow;
+		*Writer << ChunkSize;
+		Writer->Serialize(Chunks[ChunkIndex].GetData(), ChunkSize);
+		// The compressed rows are on disk now, nothing else needs them.
+		Chunks[ChunkIndex].Empty();
+	}
+	const bool bSucceeded = !Writer->IsError() && Writer->Close();
+	if (!bSucceeded)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to write %s."), *InFilename);
+	}
+	return bSucceeded;
+}
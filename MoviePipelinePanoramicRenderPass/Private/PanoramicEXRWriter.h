@@ -0,0 +1,26 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FImagePixelData;
+
+// Writes a finished panorama as a single part scanline OpenEXR. The rows are split into the format's independent chunks
+// (16 rows each with ZIP compression) and every chunk is compressed on its own worker, so a 16k stereo frame compresses
+// about as fast as it blends instead of on the one thread of the engine's EXR writer. The chunks are assembled into the file
+// in row order afterwards, readers can't tell it from a file written by OpenEXR itself.
+class FPanoramicEXRWriter
+{
+public:
+	struct FOptions
+	{
+		// ZIP compress every chunk of 16 rows, rows are written uncompressed otherwise.
+		bool bCompress = true;
+		// Written as string attributes of the header.
+		TMap<FString, FString> Metadata;
+	};
+
+	// Float16 pixels are written as half channels, Float32 pixels as float channels, both as RGBA. Returns false for any
+	// other pixel type or if the file couldn't be written. Blocks until the file is closed, call it from a worker.
+	static bool Write(const FImagePixelData& InPixelData, const FString& InFilename, const FOptions& InOptions);
+};
@@ -0,0 +1,221 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicFrameStream.h"
+#include "ImagePixelData.h"
+#include "HAL/PlatformProcess.h"
+#include "MovieRenderPipelineCoreModule.h"
+
+TUniquePtr<FPanoramicFrameStream> FPanoramicFrameStream::Create(const FString& InName, int32 InNumSlots, int64 InSlotSize, double InTimeoutSeconds)
+{
+	if (InNumSlots <= 0 || InSlotSize <= (int64)sizeof(FSlotHeader))
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Panoramic frame stream %s needs at least one slot larger than its header."), *InName);
+		return nullptr;
+	}
+
+	const SIZE_T RegionSize = sizeof(FHeader) + (SIZE_T)InNumSlots * InSlotSize;
+	const uint32 AccessMode = (uint32)FPlatformMemory::ESharedMemoryAccess::Read | (uint32)FPlatformMemory::ESharedMemoryAccess::Write;
+	FPlatformMemory::FSharedMemoryRegion* Region = FPlatformMemory::MapNamedSharedMemoryRegion(InName, /*bCreate*/ true, AccessMode, RegionSize);
+	if (!Region)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to create the %lld MB shared memory region %s for the panoramic frame stream."), (int64)(RegionSize >> 20), *InName);
+		return nullptr;
+	}
+
+	TUniquePtr<FPanoramicFrameStream> Stream(new FPanoramicFrameStream());
+	Stream->Region = Region;
+	Stream->Header = static_cast<FHeader*>(Region->GetAddress());
+	Stream->Slots = static_cast<uint8*>(Region->GetAddress()) + sizeof(FHeader);
+	Stream->TimeoutSeconds = FMath::Max(InTimeoutSeconds, 0.0);
+
+	// The counters start over, a consumer attaching to a reused region sees the new magic only once they are reset.
+	FHeader& Header = *Stream->Header;
+	Header.Magic = 0;
+	Header.Version = Version;
+	Header.NumSlots = (uint32)InNumSlots;
+	Header.bClosed = 0;
+	Header.SlotSize = (uint64)InSlotSize;
+	FPlatformAtomics::AtomicStore(&Header.WriteCount, (int64)0);
+	FPlatformAtomics::AtomicStore(&Header.ReadCount, (int64)0);
+	FPlatformAtomics::AtomicStore(&Header.ConsumerHeartbeat, (int64)0);
+	FPlatformMisc::MemoryBarrier();
+	Header.Magic = Magic;
+
+	UE_LOG(LogMovieRenderPipeline, Log, TEXT("Publishing panoramas to shared memory %s: %d slots of %lld MB."), *InName, InNumSlots, InSlotSize >> 20);
+	return Stream;
+}
+
+FPanoramicFrameStream::~FPanoramicFrameStream()
+{
+	// The publishing task captures this. A consumer that stopped reading makes it drop the rest without waiting.
+	FGraphEventRef LastPublisherEvent;
+	{
+		FScopeLock ScopeLock(&QueueMutex);
+		LastPublisherEvent = PublisherEvent;
+	}
+	if (LastPublisherEvent.IsValid())
+	{
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(LastPublisherEvent);
+	}
+	if (Region)
+	{
+		Header->bClosed = 1;
+		FPlatformMisc::MemoryBarrier();
+		FPlatformMemory::UnmapNamedSharedMemoryRegion(Region);
+	}
+}
+
+void FPanoramicFrameStream::Enqueue(TUniquePtr<FImagePixelData>&& InPixelData, int32 InOutputFrameNumber, int32 InNumEyes, const FString& InPassName)
+{
+	if (!InPixelData.IsValid())
+	{
+		return;
+	}
+
+	bool bLaunchPublisher = false;
+	{
+		FScopeLock ScopeLock(&QueueMutex);
+		if (QueuedFrames.Num() >= (int32)Header->NumSlots)
+		{
+			UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Panoramic frame stream has %d frames waiting for the consumer already, dropping frame %d."), QueuedFrames.Num(), InOutputFrameNumber);
+			return;
+		}
+		FQueuedFrame& Frame = QueuedFrames.AddDefaulted_GetRef();
+		Frame.PixelData = MoveTemp(InPixelData);
+		Frame.OutputFrameNumber = InOutputFrameNumber;
+		Frame.NumEyes = InNumEyes;
+		Frame.PassName = InPassName;
+		if (!bPublisherActive)
+		{
+			bPublisherActive = true;
+			bLaunchPublisher = true;
+		}
+	}
+
+	if (bLaunchPublisher)
+	{
+		// Waiting for the consumer would hold a worker, it runs at background priority so blending isn't held up.
+		FGraphEventRef NewPublisherEvent = FFunctionGraphTask::CreateAndDispatchWhenReady([this]()
+		{
+			Publisher_AnyThread();
+		}, TStatId(), nullptr, ENamedThreads::AnyBackgroundThreadNormalTask);
+
+		FScopeLock ScopeLock(&QueueMutex);
+		PublisherEvent = NewPublisherEvent;
+	}
+}
+
+void FPanoramicFrameStream::Publisher_AnyThread()
+{
+	while (true)
+	{
+		FQueuedFrame Frame;
+		{
+			FScopeLock ScopeLock(&QueueMutex);
+			if (QueuedFrames.Num() == 0)
+			{
+				bPublisherActive = false;
+				return;
+			}
+			Frame = MoveTemp(QueuedFrames[0]);
+			QueuedFrames.RemoveAt(0, 1, EAllowShrinking::No);
+		}
+		Publish(Frame);
+	}
+}
+
+bool FPanoramicFrameStream::WaitForSlot(int64 InWriteCount)
+{
+	double Deadline = 0.0;
+	while (InWriteCount - FPlatformAtomics::AtomicRead(&Header->ReadCount) >= (int64)Header->NumSlots)
+	{
+		const int64 Heartbeat = FPlatformAtomics::AtomicRead(&Header->ConsumerHeartbeat);
+		if (Heartbeat == 0)
+		{
+			// Nobody is attached to free the slot.
+			return false;
+		}
+		if (bConsumerStalled)
+		{
+			if (Heartbeat == StalledHeartbeat && FPlatformAtomics::AtomicRead(&Header->ReadCount) == StalledReadCount)
+			{
+				return false;
+			}
+			UE_LOG(LogMovieRenderPipeline, Log, TEXT("Panoramic frame stream consumer is back, publishing resumes."));
+			bConsumerStalled = false;
+		}
+		if (Deadline == 0.0)
+		{
+			Deadline = FPlatformTime::Seconds() + TimeoutSeconds;
+		}
+		else if (FPlatformTime::Seconds() > Deadline)
+		{
+			UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Panoramic frame stream consumer didn't free a slot within %.1f seconds, frames are dropped until it reads again."), TimeoutSeconds);
+			bConsumerStalled = true;
+			StalledHeartbeat = Heartbeat;
+			StalledReadCount = FPlatformAtomics::AtomicRead(&Header->ReadCount);
+			return false;
+		}
+		FPlatformProcess::SleepNoStats(0.001f);
+	}
+	if (bConsumerStalled)
+	{
+		UE_LOG(LogMovieRenderPipeline, Log, TEXT("Panoramic frame stream consumer is back, publishing resumes."));
+		bConsumerStalled = false;
+	}
+	return true;
+}
+
+bool FPanoramicFrameStream::Publish(const FQueuedFrame& InFrame)
+{
+	const FImagePixelData& PixelData = *InFrame.PixelData;
+	const void* RawData = nullptr;
+	int64 RawSizeInBytes = 0;
+	PixelData.GetRawData(RawData, RawSizeInBytes);
+	const FIntPoint Size = PixelData.GetSize();
+	if (!RawData || Size.X <= 0 || Size.Y <= 0)
+	{
+		return false;
+	}
+
+	const int64 RowBytes = RawSizeInBytes / Size.Y;
+	const int64 SlotDataBytes = (int64)Header->SlotSize - sizeof(FSlotHeader);
+	const int32 RowsPerSlot = (int32)FMath::Min<int64>(SlotDataBytes / RowBytes, Size.Y);
+	if (RowsPerSlot <= 0)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Panoramic frame stream slots are smaller than a single row (%lld bytes), frame %d isn't published."), RowBytes, InFrame.OutputFrameNumber);
+		return false;
+	}
+
+	for (int32 FirstRow = 0; FirstRow < Size.Y; FirstRow += RowsPerSlot)
+	{
+		// We are the only writer, so our own count can be read plainly. Wait for the consumer to free the slot.
+		const int64 WriteCount = Header->WriteCount;
+		if (!WaitForSlot(WriteCount))
+		{
+			UE_LOG(LogMovieRenderPipeline, Verbose, TEXT("Panoramic frame stream has no free slot, dropping rows %d to %d of frame %d."), FirstRow, Size.Y, InFrame.OutputFrameNumber);
+			return false;
+		}
+
+		uint8* Slot = Slots + (WriteCount % Header->NumSlots) * Header->SlotSize;
+		FSlotHeader& SlotHeader = *reinterpret_cast<FSlotHeader*>(Slot);
+		const int32 NumRows = FMath::Min(RowsPerSlot, Size.Y - FirstRow);
+		SlotHeader.OutputFrameNumber = InFrame.OutputFrameNumber;
+		SlotHeader.Width = Size.X;
+		SlotHeader.EyeHeight = Size.Y / FMath::Max(InFrame.NumEyes, 1);
+		SlotHeader.NumEyes = InFrame.NumEyes;
+		SlotHeader.PixelFormat = (int32)PixelData.GetType();
+		SlotHeader.BytesPerPixel = (int32)(RowBytes / Size.X);
+		SlotHeader.FirstRow = FirstRow;
+		SlotHeader.NumRows = NumRows;
+		SlotHeader.TotalRows = Size.Y;
+		SlotHeader.Padding = 0;
+		SlotHeader.DataSize = (uint64)NumRows * RowBytes;
+		FCStringAnsi::Strncpy(SlotHeader.PassName, TCHAR_TO_ANSI(*InFrame.PassName), UE_ARRAY_COUNT(SlotHeader.PassName));
+		FMemory::Memcpy(Slot + sizeof(FSlotHeader), static_cast<const uint8*>(RawData) + FirstRow * RowBytes, NumRows * RowBytes);
+
+		// The slot has to be complete before the consumer can see it.
+		FPlatformMisc::MemoryBarrier();
+		FPlatformAtomics::AtomicStore(&Header->WriteCount, WriteCount + 1);
+	}
+	return true;
+}
@@ -0,0 +1,106 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/PlatformMemory.h"
+#include "Async/TaskGraphInterfaces.h"
+
+struct FImagePixelData;
+
+// Publishes finished panoramas into a ring of slots in a named shared memory region, so a local encoder process can
+// consume them without a round trip through disk. Frames that don't fit a slot are published as strips of whole rows.
+//
+// Layout: an FHeader, then NumSlots slots of SlotSize bytes, each an FSlotHeader followed by its pixel rows.
+// The producer fills slot (WriteCount % NumSlots) and then advances WriteCount. The consumer reads the slots below
+// WriteCount and advances ReadCount when it is done with one, a slot is only overwritten once ReadCount has passed it.
+// Frames are published as they finish, which is not always in frame order.
+//
+// The consumer keeps ConsumerHeartbeat non-zero and advancing while it is attached. The producer only waits for slots
+// while it sees a consumer: with none attached, or once one hasn't freed a slot within the timeout, frames that don't fit
+// are dropped right away until the heartbeat or ReadCount moves again. Publishing happens on a task of its own, the
+// blend workers only queue the frames.
+class FPanoramicFrameStream
+{
+public:
+	static constexpr uint32 Magic = 0x50535452; // 'PSTR'
+	static constexpr uint32 Version = 2;
+
+	struct FHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumSlots;
+		// Set when the producer is gone, nothing is published after it.
+		uint32 bClosed;
+		uint64 SlotSize;
+		// Written by the producer only.
+		volatile int64 WriteCount;
+		// Written by the consumer only.
+		volatile int64 ReadCount;
+		// Written by the consumer only: 0 while none is attached, advanced at least once per second while one is.
+		// A consumer sets it back to 0 when it detaches.
+		volatile int64 ConsumerHeartbeat;
+	};
+
+	struct FSlotHeader
+	{
+		int32 OutputFrameNumber;
+		int32 Width;
+		// Height of a single eye, the eyes are stacked top (left eye) to bottom.
+		int32 EyeHeight;
+		int32 NumEyes;
+		// EImagePixelType: 0 = 8 bit BGRA, 1 = 16 bit float RGBA, 2 = 32 bit float RGBA.
+		int32 PixelFormat;
+		int32 BytesPerPixel;
+		// Rows of the stacked frame in this slot. The frame is complete once FirstRow + NumRows == TotalRows.
+		int32 FirstRow;
+		int32 NumRows;
+		int32 TotalRows;
+		uint32 Padding;
+		uint64 DataSize;
+		ANSICHAR PassName[64];
+	};
+
+	// Creates (or takes over) the region. Returns null if the platform or the system can't provide it.
+	// InTimeoutSeconds is how long an attached consumer may hold every slot before it is considered gone.
+	static TUniquePtr<FPanoramicFrameStream> Create(const FString& InName, int32 InNumSlots, int64 InSlotSize, double InTimeoutSeconds);
+	// Publishes what is still queued, then marks the ring closed.
+	~FPanoramicFrameStream();
+
+	// Queues a finished, eyes stacked frame for the publishing task and returns right away. Frames beyond what the ring
+	// can hold are dropped rather than queued, a consumer that far behind wouldn't see them in time anyway.
+	void Enqueue(TUniquePtr<FImagePixelData>&& InPixelData, int32 InOutputFrameNumber, int32 InNumEyes, const FString& InPassName);
+
+private:
+	struct FQueuedFrame
+	{
+		TUniquePtr<FImagePixelData> PixelData;
+		int32 OutputFrameNumber = 0;
+		int32 NumEyes = 1;
+		FString PassName;
+	};
+
+	FPanoramicFrameStream() = default;
+
+	void Publisher_AnyThread();
+	// Copies the frame into the ring. Returns false if the consumer didn't keep up and the rest of the frame was dropped.
+	bool Publish(const FQueuedFrame& InFrame);
+	// Waits for the slot of InWriteCount to be free, as long as there is a consumer worth waiting for.
+	bool WaitForSlot(int64 InWriteCount);
+
+	FPlatformMemory::FSharedMemoryRegion* Region = nullptr;
+	FHeader* Header = nullptr;
+	uint8* Slots = nullptr;
+	double TimeoutSeconds = 10.0;
+
+	// Frames finish on several blend workers, a single publishing task at a time takes them in order.
+	FCriticalSection QueueMutex;
+	TArray<FQueuedFrame> QueuedFrames;
+	bool bPublisherActive = false;
+	FGraphEventRef PublisherEvent;
+
+	// Only touched by the publishing task. Set once the consumer let a slot time out, until it shows signs of life again.
+	bool bConsumerStalled = false;
+	int64 StalledHeartbeat = 0;
+	int64 StalledReadCount = 0;
+};
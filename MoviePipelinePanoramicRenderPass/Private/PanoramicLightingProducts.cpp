@@ -0,0 +1,241 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicLightingProducts.h"
+#include "Dom/JsonObject.h"
+#include "HAL/FileManager.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Modules/ModuleManager.h"
+#include "MovieRenderPipelineCoreModule.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		static TSharedPtr<FJsonValue> MakeJsonColor(const FVector3d& InColor)
+		{
+			TArray<TSharedPtr<FJsonValue>> Values;
+			Values.Add(MakeShared<FJsonValueNumber>(InColor.X));
+			Values.Add(MakeShared<FJsonValueNumber>(InColor.Y));
+			Values.Add(MakeShared<FJsonValueNumber>(InColor.Z));
+			return MakeShared<FJsonValueArray>(Values);
+		}
+
+		static bool SaveJson(const TSharedRef<FJsonObject>& InObject, const FString& InFilename)
+		{
+			FString Text;
+			TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Text);
+			if (!FJsonSerializer::Serialize(InObject, Writer) || !FFileHelper::SaveStringToFile(Text, *InFilename))
+			{
+				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to write panoramic lighting sidecar: %s"), *InFilename);
+				return false;
+			}
+			return true;
+		}
+	}
+}
+
+FPanoramicLightingProducts::FPanoramicLightingProducts(const FOptions& InOptions, const FIntPoint& InEyeSize, int32 InNumEyes, int32 InNumBands)
+	: Options(InOptions)
+	, EyeSize(InEyeSize)
+	, NumEyes(InNumEyes)
+{
+	ColumnCosTheta.SetNumUninitialized(EyeSize.X);
+	ColumnSinTheta.SetNumUninitialized(EyeSize.X);
+	ColumnEnvironmentColumn.SetNumUninitialized(EyeSize.X);
+	for (int32 X = 0; X < EyeSize.X; X++)
+	{
+		const double Theta = FMath::DegreesToRadians((X + 0.5) * 360.0 / EyeSize.X - 180.0);
+		ColumnCosTheta[X] = (float)FMath::Cos(Theta);
+		ColumnSinTheta[X] = (float)FMath::Sin(Theta);
+		ColumnEnvironmentColumn[X] = Options.EnvironmentMapSize.X > 0 ? (int32)((int64)X * Options.EnvironmentMapSize.X / EyeSize.X) : 0;
+	}
+
+	// A row covers the band of the sphere between the latitudes of its top and bottom edge, split evenly between the columns.
+	RowCosPhi.SetNumUninitialized(EyeSize.Y);
+	RowSinPhi.SetNumUninitialized(EyeSize.Y);
+	RowSolidAngle.SetNumUninitialized(EyeSize.Y);
+	RowEnvironmentRow.SetNumUninitialized(EyeSize.Y);
+	for (int32 Y = 0; Y < EyeSize.Y; Y++)
+	{
+		const double Phi = FMath::DegreesToRadians(90.0 - (Y + 0.5) * 180.0 / EyeSize.Y);
+		const double PhiTop = FMath::DegreesToRadians(90.0 - Y * 180.0 / EyeSize.Y);
+		const double PhiBottom = FMath::DegreesToRadians(90.0 - (Y + 1) * 180.0 / EyeSize.Y);
+		RowCosPhi[Y] = (float)FMath::Cos(Phi);
+		RowSinPhi[Y] = (float)FMath::Sin(Phi);
+		RowSolidAngle[Y] = (2.0 * UE_DOUBLE_PI / EyeSize.X) * (FMath::Sin(PhiTop) - FMath::Sin(PhiBottom));
+		RowEnvironmentRow[Y] = Options.EnvironmentMapSize.Y > 0 ? (int32)((int64)Y * Options.EnvironmentMapSize.Y / EyeSize.Y) : 0;
+	}
+
+	BandPartials.SetNum(InNumBands);
+}
+
+FPanoramicLightingProducts::FBandPartial& FPanoramicLightingProducts::BeginBand(int32 InBandIndex, int32 InEyeSlot, int32 InFirstRowInEye, int32 InNumRows)
+{
+	FBandPartial& Partial = BandPartials[InBandIndex];
+	Partial.EyeSlot = InEyeSlot;
+	if (Options.bLuminanceHistogram)
+	{
+		Partial.Histogram.SetNumZeroed(NumHistogramBins);
+	}
+	if (Options.EnvironmentMapSize.X > 0 && Options.EnvironmentMapSize.Y > 0 && InNumRows > 0)
+	{
+		Partial.FirstEnvironmentRow = RowEnvironmentRow[InFirstRowInEye];
+		Partial.NumEnvironmentRows = RowEnvironmentRow[InFirstRowInEye + InNumRows - 1] - Partial.FirstEnvironmentRow + 1;
+		Partial.EnvironmentColor.SetNumZeroed(Partial.NumEnvironmentRows * Options.EnvironmentMapSize.X);
+		Partial.EnvironmentWeight.SetNumZeroed(Partial.NumEnvironmentRows * Options.EnvironmentMapSize.X);
+	}
+	return Partial;
+}
+
+bool FPanoramicLightingProducts::Write(const FString& InDirectory, const FString& InPassName, int32 InOutputFrameNumber) const
+{
+	IFileManager::Get().MakeDirectory(*InDirectory, true);
+	const bool bEnvironmentMap = Options.EnvironmentMapSize.X > 0 && Options.EnvironmentMapSize.Y > 0;
+	bool bSucceeded = true;
+
+	for (int32 EyeSlot = 0; EyeSlot < NumEyes; EyeSlot++)
+	{
+		FVector3d SH[9];
+		for (int32 Index = 0; Index < 9; Index++)
+		{
+			SH[Index] = FVector3d::ZeroVector;
+		}
+		TArray<double> Histogram;
+		Histogram.SetNumZeroed(NumHistogramBins);
+		double LuminanceSum = 0.0;
+		double LogLuminanceSum = 0.0;
+		double SolidAngleSum = 0.0;
+		TArray64<FLinearColor> EnvironmentColor;
+		TArray<float> EnvironmentWeight;
+		if (bEnvironmentMap)
+		{
+			EnvironmentColor.SetNumZeroed((int64)Options.EnvironmentMapSize.X * Options.EnvironmentMapSize.Y);
+			EnvironmentWeight.SetNumZeroed(Options.EnvironmentMapSize.X * Options.EnvironmentMapSize.Y);
+		}
+
+		for (const FBandPartial& Partial : BandPartials)
+		{
+			if (Partial.EyeSlot != EyeSlot)
+			{
+				continue;
+			}
+			for (int32 Index = 0; Index < 9; Index++)
+			{
+				SH[Index] += Partial.SH[Index];
+			}
+			for (int32 Bin = 0; Bin < Partial.Histogram.Num(); Bin++)
+			{
+				Histogram[Bin] += Partial.Histogram[Bin];
+			}
+			LuminanceSum += Partial.LuminanceSum;
+			LogLuminanceSum += Partial.LogLuminanceSum;
+			SolidAngleSum += Partial.SolidAngleSum;
+			const int32 FirstTexel = Partial.FirstEnvironmentRow * Options.EnvironmentMapSize.X;
+			for (int32 Texel = 0; Texel < Partial.EnvironmentColor.Num(); Texel++)
+			{
+				EnvironmentColor[FirstTexel + Texel] += Partial.EnvironmentColor[Texel];
+				EnvironmentWeight[FirstTexel + Texel] += Partial.EnvironmentWeight[Texel];
+			}
+		}
+
+		if (Options.bIrradianceSH)
+		{
+			// Convolving the radiance with the clamped cosine only scales every band: pi, 2pi/3 and pi/4.
+			static const double CosineLobe[9] = { UE_DOUBLE_PI, 2.0 * UE_DOUBLE_PI / 3.0, 2.0 * UE_DOUBLE_PI / 3.0, 2.0 * UE_DOUBLE_PI / 3.0,
+				UE_DOUBLE_PI / 4.0, UE_DOUBLE_PI / 4.0, UE_DOUBLE_PI / 4.0, UE_DOUBLE_PI / 4.0, UE_DOUBLE_PI / 4.0 };
+			TArray<TSharedPtr<FJsonValue>> Radiance;
+			TArray<TSharedPtr<FJsonValue>> Irradiance;
+			for (int32 Index = 0; Index < 9; Index++)
+			{
+				Radiance.Add(MoviePipeline::Panoramic::MakeJsonColor(SH[Index]));
+				Irradiance.Add(MoviePipeline::Panoramic::MakeJsonColor(SH[Index] * CosineLobe[Index]));
+			}
+			TSharedRef<FJsonObject> Object = MakeShared<FJsonObject>();
+			Object->SetStringField(TEXT("pass"), InPassName);
+			Object->SetNumberField(TEXT("frame"), InOutputFrameNumber);
+			Object->SetStringField(TEXT("basis"), TEXT("real SH, l <= 2, ordered (0,0) (1,-1) (1,0) (1,1) (2,-2) (2,-1) (2,0) (2,1) (2,2), Unreal axes: X forward, Y right, Z up"));
+			Object->SetArrayField(TEXT("radiance"), Radiance);
+			// Irradiance towards a normal N is the sum of these times the basis functions at N.
+			Object->SetArrayField(TEXT("irradiance"), Irradiance);
+			bSucceeded &= MoviePipeline::Panoramic::SaveJson(Object, GetSidecarFilename(InDirectory, InPassName, EyeSlot, NumEyes, InOutputFrameNumber, TEXT("sh9.json")));
+		}
+
+		if (Options.bLuminanceHistogram)
+		{
+			TArray<TSharedPtr<FJsonValue>> Bins;
+			for (int32 Bin = 0; Bin < NumHistogramBins; Bin++)
+			{
+				Bins.Add(MakeShared<FJsonValueNumber>(SolidAngleSum > 0.0 ? Histogram[Bin] / SolidAngleSum : 0.0));
+			}
+			TSharedRef<FJsonObject> Object = MakeShared<FJsonObject>();
+			Object->SetStringField(TEXT("pass"), InPassName);
+			Object->SetNumberField(TEXT("frame"), InOutputFrameNumber);
+			Object->SetNumberField(TEXT("minEV"), HistogramMinEV);
+			Object->SetNumberField(TEXT("maxEV"), HistogramMaxEV);
+			// Fraction of the sphere in every bin, they sum to one.
+			Object->SetArrayField(TEXT("bins"), Bins);
+			Object->SetNumberField(TEXT("averageLuminance"), SolidAngleSum > 0.0 ? LuminanceSum / SolidAngleSum : 0.0);
+			Object->SetNumberField(TEXT("logAverageLuminance"), SolidAngleSum > 0.0 ? FMath::Exp2(LogLuminanceSum / SolidAngleSum) : 0.0);
+			bSucceeded &= MoviePipeline::Panoramic::SaveJson(Object, GetSidecarFilename(InDirectory, InPassName, EyeSlot, NumEyes, InOutputFrameNumber, TEXT("histogram.json")));
+		}
+
+		if (bEnvironmentMap)
+		{
+			for (int32 Texel = 0; Texel < EnvironmentWeight.Num(); Texel++)
+			{
+				FLinearColor& Color = EnvironmentColor[Texel];
+				Color = EnvironmentWeight[Texel] > 0.f ? Color / EnvironmentWeight[Texel] : FLinearColor::Black;
+				Color.A = 1.f;
+			}
+			const FString Filename = GetSidecarFilename(InDirectory, InPassName, EyeSlot, NumEyes, InOutputFrameNumber, TEXT("envmap.exr"));
+			IImageWrapperModule& ImageWrapperModule = FModuleManager::GetModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+			TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::EXR);
+			if (!ImageWrapper.IsValid() || !ImageWrapper->SetRaw(EnvironmentColor.GetData(), EnvironmentColor.Num() * sizeof(FLinearColor), Options.EnvironmentMapSize.X, Options.EnvironmentMapSize.Y, ERGBFormat::RGBAF, 32)
+				|| !FFileHelper::SaveArrayToFile(ImageWrapper->GetCompressed(), *Filename))
+			{
+				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to write panoramic lighting sidecar: %s"), *Filename);
+				bSucceeded = false;
+			}
+		}
+	}
+	return bSucceeded;
+}
+
+void FPanoramicLightingProducts::CopySidecars(const FOptions& InOptions, const FString& InDirectory, const FString& InPassName, int32 InNumEyes, int32 InFromFrameNumber, int32 InToFrameNumber)
+{
+	TArray<const TCHAR*> Suffixes;
+	if (InOptions.bIrradianceSH)
+	{
+		Suffixes.Add(TEXT("sh9.json"));
+	}
+	if (InOptions.bLuminanceHistogram)
+	{
+		Suffixes.Add(TEXT("histogram.json"));
+	}
+	if (InOptions.EnvironmentMapSize.X > 0 && InOptions.EnvironmentMapSize.Y > 0)
+	{
+		Suffixes.Add(TEXT("envmap.exr"));
+	}
+	for (int32 EyeSlot = 0; EyeSlot < InNumEyes; EyeSlot++)
+	{
+		for (const TCHAR* Suffix : Suffixes)
+		{
+			const FString From = GetSidecarFilename(InDirectory, InPassName, EyeSlot, InNumEyes, InFromFrameNumber, Suffix);
+			const FString To = GetSidecarFilename(InDirectory, InPassName, EyeSlot, InNumEyes, InToFrameNumber, Suffix);
+			if (IFileManager::Get().Copy(*To, *From) != COPY_OK)
+			{
+				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to copy panoramic lighting sidecar %s to %s."), *From, *To);
+			}
+		}
+	}
+}
+
+FString FPanoramicLightingProducts::GetSidecarFilename(const FString& InDirectory, const FString& InPassName, int32 InEyeSlot, int32 InNumEyes, int32 InOutputFrameNumber, const TCHAR* InSuffix)
+{
+	const FString BaseName = InNumEyes > 1 ? FString::Printf(TEXT("%s_Eye_%d"), *InPassName, InEyeSlot) : InPassName;
+	return FPaths::Combine(InDirectory, FString::Printf(TEXT("%s.%04d.%s"), *BaseName, InOutputFrameNumber, InSuffix));
+}
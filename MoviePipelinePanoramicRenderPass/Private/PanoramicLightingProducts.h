@@ -0,0 +1,138 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Lighting products derived from a finished panorama while finalize converts it, so nobody has to read the frame back
+// from disk for them: the irradiance as 9 spherical harmonic coefficients, a luminance histogram for exposure checks, and
+// a small prefiltered environment map. Every eye of a stereo frame gets its own.
+// Every pixel counts with the solid angle it covers, the rows near the poles cover much less of the sphere than they
+// cover of the image. Bands are swept in parallel, each into a partial of its own, and the partials are summed in band
+// order so the results don't depend on which worker finished first.
+class FPanoramicLightingProducts
+{
+public:
+	// Luminance range of the histogram in EV (log2 of the luminance), darker and brighter pixels count in the first and last bin.
+	static constexpr int32 NumHistogramBins = 128;
+	static constexpr float HistogramMinEV = -16.f;
+	static constexpr float HistogramMaxEV = 16.f;
+
+	struct FOptions
+	{
+		bool bIrradianceSH = false;
+		bool bLuminanceHistogram = false;
+		// Per eye size of the environment map, none is written when zero.
+		FIntPoint EnvironmentMapSize = FIntPoint::ZeroValue;
+
+		bool IsEnabled() const
+		{
+			return bIrradianceSH || bLuminanceHistogram || (EnvironmentMapSize.X > 0 && EnvironmentMapSize.Y > 0);
+		}
+	};
+
+	// What one band adds to the products of its eye.
+	struct FBandPartial
+	{
+		FBandPartial()
+		{
+			for (int32 Index = 0; Index < 9; Index++)
+			{
+				SH[Index] = FVector3d::ZeroVector;
+			}
+		}
+
+		int32 EyeSlot = 0;
+		// Radiance times solid angle projected on every SH basis function.
+		FVector3d SH[9];
+		// Solid angle per histogram bin.
+		TArray<double> Histogram;
+		double LuminanceSum = 0.0;
+		double LogLuminanceSum = 0.0;
+		double SolidAngleSum = 0.0;
+		// The environment map rows the band's pixels fall in, color times solid angle and the solid angle summed per texel.
+		int32 FirstEnvironmentRow = 0;
+		int32 NumEnvironmentRows = 0;
+		TArray<FLinearColor> EnvironmentColor;
+		TArray<float> EnvironmentWeight;
+	};
+
+	// InEyeSize is the size of a single eye of the panorama, the eyes are swept as InNumBands bands in total.
+	FPanoramicLightingProducts(const FOptions& InOptions, const FIntPoint& InEyeSize, int32 InNumEyes, int32 InNumBands);
+
+	// Sets up the partial of a band before its pixels are added, on the worker that sweeps it.
+	FBandPartial& BeginBand(int32 InBandIndex, int32 InEyeSlot, int32 InFirstRowInEye, int32 InNumRows);
+
+	// Adds a finished pixel of the band, in any order.
+	FORCEINLINE void AddPixel(FBandPartial& InOutPartial, int32 InX, int32 InRowInEye, const FLinearColor& InColor) const
+	{
+		const double SolidAngle = RowSolidAngle[InRowInEye];
+		InOutPartial.SolidAngleSum += SolidAngle;
+		if (Options.bIrradianceSH)
+		{
+			const float CosPhi = RowCosPhi[InRowInEye];
+			float Basis[9];
+			GetSHBasis(CosPhi * ColumnCosTheta[InX], CosPhi * ColumnSinTheta[InX], RowSinPhi[InRowInEye], Basis);
+			const FVector3d Radiance = FVector3d(InColor.R, InColor.G, InColor.B) * SolidAngle;
+			for (int32 Index = 0; Index < 9; Index++)
+			{
+				InOutPartial.SH[Index] += Radiance * Basis[Index];
+			}
+		}
+		if (Options.bLuminanceHistogram)
+		{
+			const float Luminance = FMath::Max(InColor.GetLuminance(), 0.f);
+			const float EV = FMath::Log2(FMath::Max(Luminance, FMath::Exp2(HistogramMinEV)));
+			const int32 Bin = FMath::Clamp(FMath::FloorToInt((EV - HistogramMinEV) * (NumHistogramBins / (HistogramMaxEV - HistogramMinEV))), 0, NumHistogramBins - 1);
+			InOutPartial.Histogram[Bin] += SolidAngle;
+			InOutPartial.LuminanceSum += Luminance * SolidAngle;
+			InOutPartial.LogLuminanceSum += EV * SolidAngle;
+		}
+		if (InOutPartial.NumEnvironmentRows > 0)
+		{
+			const int32 Texel = (RowEnvironmentRow[InRowInEye] - InOutPartial.FirstEnvironmentRow) * Options.EnvironmentMapSize.X + ColumnEnvironmentColumn[InX];
+			InOutPartial.EnvironmentColor[Texel] += InColor * (float)SolidAngle;
+			InOutPartial.EnvironmentWeight[Texel] += (float)SolidAngle;
+		}
+	}
+
+	// Sums the partials of every eye and writes its sidecars to InDirectory: <Pass>.<Frame>.sh9.json, .histogram.json and
+	// .envmap.exr, with _Eye_<Index> after the pass name for stereo. Returns false if any of them couldn't be written.
+	bool Write(const FString& InDirectory, const FString& InPassName, int32 InOutputFrameNumber) const;
+
+	// Writes the sidecars of an earlier frame again for a frame that repeats its panorama.
+	static void CopySidecars(const FOptions& InOptions, const FString& InDirectory, const FString& InPassName, int32 InNumEyes, int32 InFromFrameNumber, int32 InToFrameNumber);
+
+	// Real SH basis of band 0 to 2 for a unit direction, in the usual order (l, m) = (0,0), (1,-1), (1,0), (1,1), (2,-2) ... (2,2).
+	static FORCEINLINE void GetSHBasis(float X, float Y, float Z, float* OutBasis)
+	{
+		OutBasis[0] = 0.282095f;
+		OutBasis[1] = 0.488603f * Y;
+		OutBasis[2] = 0.488603f * Z;
+		OutBasis[3] = 0.488603f * X;
+		OutBasis[4] = 1.092548f * X * Y;
+		OutBasis[5] = 1.092548f * Y * Z;
+		OutBasis[6] = 0.315392f * (3.f * Z * Z - 1.f);
+		OutBasis[7] = 1.092548f * X * Z;
+		OutBasis[8] = 0.546274f * (X * X - Y * Y);
+	}
+
+private:
+	static FString GetSidecarFilename(const FString& InDirectory, const FString& InPassName, int32 InEyeSlot, int32 InNumEyes, int32 InOutputFrameNumber, const TCHAR* InSuffix);
+
+	FOptions Options;
+	FIntPoint EyeSize;
+	int32 NumEyes;
+
+	// Direction and solid angle of the pixels, by column and by row of an eye. Longitude runs from -180 at the left edge,
+	// latitude from +90 at the top row, like the reprojection of the panes.
+	TArray<float> ColumnCosTheta;
+	TArray<float> ColumnSinTheta;
+	TArray<float> RowCosPhi;
+	TArray<float> RowSinPhi;
+	TArray<double> RowSolidAngle;
+	// The environment map texel every column and row falls in.
+	TArray<int32> ColumnEnvironmentColumn;
+	TArray<int32> RowEnvironmentRow;
+
+	TArray<FBandPartial> BandPartials;
+};
@@ -24,6 +24,12 @@
 #include "ImageUtils.h"
 #include "Math/Quat.h"
 #include "PanoramicBlender.h"
+#include "PanoramicAccumulationFile.h"
+#include "PanoramicAccumulatorQueue.h"
+#include "HAL/FileManager.h"
+#include "ImageWriteStream.h"
+#include "Materials/MaterialInterface.h"
+#include "RenderingThread.h"
 
 #include UE_INLINE_GENERATED_CPP_BY_NAME(PanoramicPass)
 
@@ -37,9 +43,25 @@ UPanoramicPass::UPanoramicPass()
 	, EyeConvergenceDistance(EyeSeparation * 30.f) //The focus distance between the eyes is 30 times the eye distance
 	, bAllocateHistoryPerPane(true)
 	, bHasWarnedSettings(false)
+	, ResolvedNumPaneShards(1)
+	, ResolvedPaneShardIndex(0)
+	, bResolvedSplatSamples(false)
 {
 	// ID of the rendering pipeline
 	PassIdentifier = FMoviePipelinePassIdentifier("Panoramic");
+
+	// The common compositing buffers, disabled until asked for. Scene depth is converted from each pane's view to the
+	// distance from the camera. Screen space motion vectors would disagree between panes, they aren't offered.
+	auto AddDefaultAOV = [this](const TCHAR* InMaterialPath, EPanoramicAOVBlendMode InBlendMode, bool bInPlanarDepth = false)
+	{
+		FPanoramicAOV& AOV = AOVs.AddDefaulted_GetRef();
+		AOV.Material = TSoftObjectPtr<UMaterialInterface>(FSoftObjectPath(InMaterialPath));
+		AOV.BlendMode = InBlendMode;
+		AOV.bPlanarDepth = bInPlanarDepth;
+	};
+	AddDefaultAOV(TEXT("/MovieRenderPipeline/Materials/MovieRenderQueue_WorldDepth.MovieRenderQueue_WorldDepth"), EPanoramicAOVBlendMode::NearestMaxWeight, /*bInPlanarDepth*/ true);
+	AddDefaultAOV(TEXT("/Engine/BufferVisualization/WorldNormal.WorldNormal"), EPanoramicAOVBlendMode::Blend);
+	AddDefaultAOV(TEXT("/Engine/BufferVisualization/CustomStencil.CustomStencil"), EPanoramicAOVBlendMode::NearestMaxWeight);
 }
 
 // The movie pipeline, here mainly provides three algorithms
@@ -76,6 +98,41 @@ namespace MoviePipeline
 			}
 			return Results;
 		}
+		// Every pane of every pass accumulates in its own accumulator of the pool, found by this identifier.
+		static FMoviePipelinePassIdentifier GetPanePassIdentifier(const FMoviePipelinePassIdentifier& InPassIdentifier, const FPanoPane& InPane)
+		{
+			return FMoviePipelinePassIdentifier(FString::Printf(TEXT("%s_%d_x%d_y%d"), *InPassIdentifier.Name, InPane.EyeIndex, InPane.HorizontalStepIndex, InPane.VerticalStepIndex));
+		}
+
+		static float GetSampleLuminance(const FImagePixelData& InSample, const void* InRawData, int64 InIndex)
+		{
+			switch (InSample.GetType())
+			{
+				case EImagePixelType::Color:
+				{
+					const FColor& Color = static_cast<const FColor*>(InRawData)[InIndex];
+					return (0.2126f * Color.R + 0.7152f * Color.G + 0.0722f * Color.B) / 255.f;
+				}
+				case EImagePixelType::Float16:
+				{
+					const FFloat16Color& Color = static_cast<const FFloat16Color*>(InRawData)[InIndex];
+					return 0.2126f * Color.R.GetFloat() + 0.7152f * Color.G.GetFloat() + 0.0722f * Color.B.GetFloat();
+				}
+				case EImagePixelType::Float32:
+				{
+					const FLinearColor& Color = static_cast<const FLinearColor*>(InRawData)[InIndex];
+					return Color.GetLuminance();
+				}
+				default:
+					checkNoEntry();
+					return 0.f;
+			}
+		}
+
+		FMoviePipelinePassIdentifier GetOutputSizePassIdentifier(const FMoviePipelinePassIdentifier& InPassIdentifier, const FIntPoint& InSize)
+		{
+			return FMoviePipelinePassIdentifier(FString::Printf(TEXT("%s_%dx%d"), *InPassIdentifier.Name, InSize.X, InSize.Y));
+		}
 		// Gets camera rotation for stereo rendering (position of output, rotation of output, panorama Pane, number of stereo, whether it is on previous position)
 		void GetCameraOrientationForStereo(FVector& OutLocation, FRotator& OutRotation, const FPanoPane& InPane, const bool bInPrevPosition)
 		{
@@ -102,6 +159,76 @@ namespace MoviePipeline
 	}
 }
 
+void FPanoramicPaneConvergence::AddSample(const FImagePixelData& InSample)
+{
+	// Every probe stands for a ProbeSpacing^2 block of the pane, that is plenty to find the noisy areas.
+	static constexpr int32 ProbeSpacing = 8;
+	// Keeps the relative error of near black pixels from dominating, their noise isn't visible.
+	static constexpr float LuminanceFloor = 0.02f;
+	// Share of the probes that have to be below the threshold, a few fireflies shouldn't keep a whole pane sampling.
+	static constexpr float ConvergedProbeFraction = 0.95f;
+
+	if (!bEnabled || bConverged)
+	{
+		return;
+	}
+
+	const void* RawData = nullptr;
+	int64 RawSizeInBytes = 0;
+	InSample.GetRawData(RawData, RawSizeInBytes);
+	const FIntPoint Size = InSample.GetSize();
+	const FIntPoint GridSize(FMath::DivideAndRoundUp(Size.X, ProbeSpacing), FMath::DivideAndRoundUp(Size.Y, ProbeSpacing));
+	if (!RawData || GridSize.X <= 0 || GridSize.Y <= 0)
+	{
+		return;
+	}
+	if (NumSamples == 0)
+	{
+		ProbeGridSize = GridSize;
+		ProbeMeans.SetNumZeroed(GridSize.X * GridSize.Y);
+		ProbeM2.SetNumZeroed(GridSize.X * GridSize.Y);
+	}
+	else if (GridSize != ProbeGridSize)
+	{
+		return;
+	}
+
+	NumSamples++;
+	const float InvNumSamples = 1.f / NumSamples;
+	for (int32 ProbeY = 0; ProbeY < GridSize.Y; ProbeY++)
+	{
+		const int64 RowIndex = (int64)FMath::Min(ProbeY * ProbeSpacing + ProbeSpacing / 2, Size.Y - 1) * Size.X;
+		for (int32 ProbeX = 0; ProbeX < GridSize.X; ProbeX++)
+		{
+			const int32 ProbeIndex = ProbeY * GridSize.X + ProbeX;
+			const float Luminance = MoviePipeline::Panoramic::GetSampleLuminance(InSample, RawData, RowIndex + FMath::Min(ProbeX * ProbeSpacing + ProbeSpacing / 2, Size.X - 1));
+			const float Delta = Luminance - ProbeMeans[ProbeIndex];
+			ProbeMeans[ProbeIndex] += Delta * InvNumSamples;
+			ProbeM2[ProbeIndex] += Delta * (Luminance - ProbeMeans[ProbeIndex]);
+		}
+	}
+
+	if (NumSamples < MinSamples)
+	{
+		return;
+	}
+
+	// Standard error of the mean relative to the brightness, per probe.
+	TArray<float> RelativeErrors;
+	RelativeErrors.SetNumUninitialized(ProbeMeans.Num());
+	const float VarianceOfMeanScale = 1.f / ((NumSamples - 1) * NumSamples);
+	for (int32 ProbeIndex = 0; ProbeIndex < ProbeMeans.Num(); ProbeIndex++)
+	{
+		RelativeErrors[ProbeIndex] = FMath::Sqrt(ProbeM2[ProbeIndex] * VarianceOfMeanScale) / (FMath::Abs(ProbeMeans[ProbeIndex]) + LuminanceFloor);
+	}
+	RelativeErrors.Sort();
+	const float Error = RelativeErrors[FMath::Min((int32)(RelativeErrors.Num() * ConvergedProbeFraction), RelativeErrors.Num() - 1)];
+	if (Error <= NoiseThreshold)
+	{
+		bConverged = true;
+	}
+}
+
 void UPanoramicPass::MoviePipelineRenderShowFlagOverride(FEngineShowFlags& OutShowFlag)
 {
 	// Panoramics can't support any of these.
@@ -134,10 +261,12 @@ void UPanoramicPass::SetupImpl(const MoviePipeline::FMoviePipelineRenderPassInit
 	int32 StereoMultiplier = bStereo ? 2 : 1;
 	int32 NumPanes = NumHorizontalSteps * NumVerticalSteps;
 	int32 NumPanoramicPanes = NumPanes * StereoMultiplier;
+	// All origins of a frame are rendered before the next sample, each needs its panes (and their history) of its own.
+	const int32 NumCaptureOrigins = GetNumCaptureOrigins();
 	if (bAllocateHistoryPerPane)
 	{
 		// Set total
-		OptionalPaneViewStates.SetNum(NumPanoramicPanes);
+		OptionalPaneViewStates.SetNum(NumPanoramicPanes * NumCaptureOrigins);
 		// Walk through the scene view state reference
 		for (int32 Index = 0; Index < OptionalPaneViewStates.Num(); Index++)
 		{
@@ -145,10 +274,52 @@ void UPanoramicPass::SetupImpl(const MoviePipeline::FMoviePipelineRenderPassInit
 		}
 	}
 	
-	// We need one accumulator per pano tile if using accumulation.
-	// Here is equivalent to use TAccumulatorPool created a FImageOverlappedAccumulator types of cumulative pool,
-	// and the number for the () of the total view pane
-	AccumulatorPool = MakeShared<TAccumulatorPool<FImageOverlappedAccumulator>, ESPMode::ThreadSafe>(NumPanoramicPanes);
+	// Every enabled AOV is captured from the same renders through buffer visualization.
+	ActiveAOVMaterials.Reset();
+	ActiveAOVPassIdentifiers.Reset();
+	ActiveAOVs.Reset();
+	for (int32 AOVIndex = 0; AOVIndex < AOVs.Num(); AOVIndex++)
+	{
+		const FPanoramicAOV& AOV = AOVs[AOVIndex];
+		if (!AOV.bEnabled || AOV.Material.IsNull())
+		{
+			continue;
+		}
+		UMaterialInterface* AOVMaterial = AOV.Material.LoadSynchronous();
+		if (!AOVMaterial)
+		{
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to load panoramic AOV material %s, the AOV isn't rendered."), *AOV.Material.ToString());
+			continue;
+		}
+		ActiveAOVMaterials.Add(AOVMaterial);
+		ActiveAOVPassIdentifiers.Add(GetAOVPassIdentifier(AOVIndex));
+		ActiveAOVs.Add(AOV);
+	}
+
+	// We need one accumulator per pano tile if using accumulation, and one more per AOV.
+	// The queue creates that many FImageOverlappedAccumulators up front, like a TAccumulatorPool would.
+	// Mono polar rows are rendered once, they need a single accumulator (and render) per step.
+	const int32 NumMonoPolarPanes = GetNumMonoPolarRows() * 2 * NumHorizontalSteps;
+	if (NumMonoPolarPanes > 0)
+	{
+		UE_LOG(LogMovieRenderPipeline, Log, TEXT("Rendering %d of %d stereo panoramic panes once for both eyes."), NumMonoPolarPanes, NumPanes);
+	}
+	// Splatted samples go straight to the blender, a tile only covers part of the pane so tiles are still accumulated.
+	bResolvedSplatSamples = bSplatSamples;
+	if (bResolvedSplatSamples && InPassInitSettings.TileCount != FIntPoint(1, 1))
+	{
+		UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Panoramic sample splatting doesn't support high-res tiles, accumulating the samples of every pane instead."));
+		bResolvedSplatSamples = false;
+	}
+	if (bResolvedSplatSamples && (bCheckpointPanes || bAdaptivePaneSampling))
+	{
+		UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Panoramic sample splatting blends every sample on its own, pane checkpoints and adaptive sampling are turned off."));
+	}
+	// Panes that find every accumulator busy wait for one in the queue, the game thread only stalls once MaxWaitingPanes are waiting.
+	if (!bResolvedSplatSamples)
+	{
+		AccumulatorQueue = MakeShared<FPanoramicAccumulatorQueue, ESPMode::ThreadSafe>((NumPanoramicPanes - NumMonoPolarPanes) * (1 + ActiveAOVMaterials.Num()) * NumCaptureOrigins, MaxWaitingPanes);
+	}
 	
 	/**
 	 * Create a class to blend the Panes of a panorama into a "columnar isometric" map.
@@ -156,7 +327,69 @@ void UPanoramicPass::SetupImpl(const MoviePipeline::FMoviePipelineRenderPassInit
 	 * it will pass the data to the normal OutputBuilder.
 	 * The latter does not know that we are sending it a complex hybrid image instead of a normal static image.
 	 */
-	PanoramicOutputBlender = MakeShared<FPanoramicBlender>(GetPipeline()->OutputBuilder, InPassInitSettings.BackbufferResolution);
+	// Each process of a sharded render gets its shard from the command line so they can all share one queue.
+	ResolvedNumPaneShards = NumPaneShards;
+	ResolvedPaneShardIndex = PaneShardIndex;
+	FParse::Value(FCommandLine::Get(), TEXT("PanoramicNumShards="), ResolvedNumPaneShards);
+	FParse::Value(FCommandLine::Get(), TEXT("PanoramicShardIndex="), ResolvedPaneShardIndex);
+	ResolvedNumPaneShards = FMath::Max(ResolvedNumPaneShards, 1);
+	if (ResolvedPaneShardIndex < 0 || ResolvedPaneShardIndex >= ResolvedNumPaneShards)
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Panoramic shard index %d is out of range for %d shards, rendering shard 0."), ResolvedPaneShardIndex, ResolvedNumPaneShards);
+		ResolvedPaneShardIndex = 0;
+	}
+
+	FPanoramicBlenderOptions BlenderOptions;
+	BlenderOptions.NumPaneShards = ResolvedNumPaneShards;
+	BlenderOptions.PaneShardIndex = ResolvedPaneShardIndex;
+	BlenderOptions.ShardDirectory = ShardDirectory.Path.IsEmpty() ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("MovieRenderPipeline"), TEXT("PanoramicShards")) : ShardDirectory.Path;
+	BlenderOptions.MaxConcurrentBlends = MaxConcurrentBlendTasks;
+	BlenderOptions.OutputPixelType = OutputPixelType;
+	BlenderOptions.bDitherQuantizedOutput = bDitherQuantizedOutput;
+	BlenderOptions.ResampleFilter = ResampleFilter;
+	BlenderOptions.bMipFiltering = bPrefilterDensePanes;
+	BlenderOptions.bStreamingReprojection = bLowMemoryBlending;
+	BlenderOptions.bSkipHeldFrames = bSkipHeldFrames;
+	BlenderOptions.bSplatSamples = bResolvedSplatSamples;
+	BlenderOptions.LightingProducts.bIrradianceSH = bWriteIrradianceSH;
+	BlenderOptions.LightingProducts.bLuminanceHistogram = bWriteLuminanceHistogram;
+	BlenderOptions.LightingProducts.EnvironmentMapSize = FIntPoint(FMath::Max(EnvironmentMapSize.X, 0), FMath::Max(EnvironmentMapSize.Y, 0));
+	BlenderOptions.LightingDirectory = LightingDirectory.Path.IsEmpty() ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("MovieRenderPipeline"), TEXT("PanoramicLighting")) : LightingDirectory.Path;
+	BlenderOptions.AdditionalOutputSizes = GetResolvedAdditionalOutputSizes();
+	ConvergenceFrameNumber = INDEX_NONE;
+	PaneConvergence.Reset();
+	NumSkippedPaneSamples = 0;
+	ResolvedCheckpointDirectory = CheckpointDirectory.Path.IsEmpty() ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("MovieRenderPipeline"), TEXT("PanoramicCheckpoints")) : CheckpointDirectory.Path;
+	CheckpointedFrameNumber = INDEX_NONE;
+	CheckpointedSteps.Reset();
+	BlenderOptions.bCheckpointPanes = bCheckpointPanes && !bResolvedSplatSamples;
+	BlenderOptions.CheckpointDirectory = ResolvedCheckpointDirectory;
+	BlenderOptions.bStreamToSharedMemory = bStreamToSharedMemory;
+	BlenderOptions.StreamName = StreamName;
+	BlenderOptions.StreamSlotCount = StreamSlotCount;
+	BlenderOptions.StreamSlotSize = (int64)StreamSlotSizeMB << 20;
+	BlenderOptions.StreamTimeoutSeconds = StreamTimeoutSeconds;
+	for (int32 AOVIndex = 0; AOVIndex < ActiveAOVPassIdentifiers.Num(); AOVIndex++)
+	{
+		for (int32 OriginIndex = 0; OriginIndex < NumCaptureOrigins; OriginIndex++)
+		{
+			const FMoviePipelinePassIdentifier AOVPassIdentifier = GetOriginPassIdentifier(ActiveAOVPassIdentifiers[AOVIndex], OriginIndex);
+			BlenderOptions.AOVBlendModes.Add(AOVPassIdentifier, ActiveAOVs[AOVIndex].BlendMode);
+			if (ActiveAOVs[AOVIndex].bPlanarDepth)
+			{
+				BlenderOptions.PlanarDepthAOVs.Add(AOVPassIdentifier);
+			}
+		}
+	}
+	for (const FIntPoint& OutputSize : BlenderOptions.AdditionalOutputSizes)
+	{
+		if (OutputSize.X > InPassInitSettings.BackbufferResolution.X || OutputSize.Y > InPassInitSettings.BackbufferResolution.Y)
+		{
+			UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Panoramic additional output size %dx%d is larger than the output resolution %dx%d, it will be upscaled."),
+				OutputSize.X, OutputSize.Y, InPassInitSettings.BackbufferResolution.X, InPassInitSettings.BackbufferResolution.Y);
+		}
+	}
+	PanoramicOutputBlender = MakeShared<FPanoramicBlender>(GetPipeline()->OutputBuilder, InPassInitSettings.BackbufferResolution, BlenderOptions);
 	
 	// Allocate an OCIO extension to do color grading if needed.
 	OCIOSceneViewExtension = FSceneViewExtensions::NewExtension<FOpenColorIODisplayExtension>();
@@ -167,8 +400,42 @@ void UPanoramicPass::SetupImpl(const MoviePipeline::FMoviePipelineRenderPassInit
 
 void UPanoramicPass::TeardownImpl()
 {
+	// Teardown comes while the last frames of the shot are still being read back, accumulated and blended. A render that
+	// ends normally drains all of it below. Only a cancelled one drops its queued panes and pending frames, and its blend
+	// workers stop at their next band of rows instead of finishing frames nobody will write.
+	TSharedPtr<FPanoramicBlender> Blender = StaticCastSharedPtr<FPanoramicBlender>(PanoramicOutputBlender);
+	const bool bCancelled = GetPipeline()->IsShutdownRequested();
+	if (Blender.IsValid() && bCancelled)
+	{
+		Blender->AbandonOutstandingWork();
+	}
+	// The base pass shuts the surface queues down, which hands over the readbacks still in flight. It has to go before
+	// the accumulations and blends are waited for, or the panes of the last frames would arrive after them.
+	FlushRenderingCommands();
+	Super::TeardownImpl();
+	// Finishing the accumulation of a pane can start the next waiting one, the queue waits for all of them.
+	if (AccumulatorQueue.IsValid())
+	{
+		AccumulatorQueue->Flush();
+	}
+	FTaskGraphInterface::Get().WaitUntilTasksComplete(OutstandingTasks);
+	OutstandingTasks.Reset();
+	if (Blender.IsValid())
+	{
+		Blender->WaitForBlendWorkers();
+	}
+	Blender.Reset();
+	PaneConvergence.Reset();
+	if (bAdaptivePaneSampling)
+	{
+		UE_LOG(LogMovieRenderPipeline, Log, TEXT("Panoramic adaptive sampling skipped %lld pane samples."), NumSkippedPaneSamples);
+	}
+	// With every task done these are the last references, the accumulation and accumulator memory is released right here.
 	PanoramicOutputBlender.Reset();
-	AccumulatorPool.Reset();
+	AccumulatorQueue.Reset();
+	ActiveAOVMaterials.Reset();
+	ActiveAOVPassIdentifiers.Reset();
+	ActiveAOVs.Reset();
 	for (int32 Index = 0; Index < OptionalPaneViewStates.Num(); Index++)
 	{
 		FSceneViewStateInterface* Ref = OptionalPaneViewStates[Index].GetReference();
@@ -182,7 +449,6 @@ void UPanoramicPass::TeardownImpl()
 	OptionalPaneViewStates.Empty();
 	OCIOSceneViewExtension.Reset();
 	OCIOSceneViewExtension = nullptr;
-	Super::TeardownImpl();
 }
 
 // For object collection (memory collection) to GC
@@ -210,7 +476,9 @@ FSceneViewStateInterface* UPanoramicPass::GetSceneViewStateInterface(IViewCalcPa
 	FPanoPane* PanoPane = (FPanoPane*)OptPayload;
 	if (bAllocateHistoryPerPane)
 	{
-		return OptionalPaneViewStates[PanoPane->GetAbsoluteIndex()].GetReference();
+		// Every origin has a history of its own for every pane.
+		const int32 NumPanesPerOrigin = OptionalPaneViewStates.Num() / GetNumCaptureOrigins();
+		return OptionalPaneViewStates[PanoPane->OriginIndex * NumPanesPerOrigin + PanoPane->GetAbsoluteIndex()].GetReference();
 	}
 	return nullptr;
 }
@@ -219,6 +487,88 @@ FSceneViewStateInterface* UPanoramicPass::GetSceneViewStateInterface(IViewCalcPa
 void UPanoramicPass::GatherOutputPassesImpl(TArray<FMoviePipelinePassIdentifier>& ExpectedRenderPasses)
 {
 	Super::GatherOutputPassesImpl(ExpectedRenderPasses);
+
+	// Several capture origins are written as passes of their own, in place of the pass itself.
+	const int32 NumCaptureOrigins = GetNumCaptureOrigins();
+	if (NumCaptureOrigins > 1)
+	{
+		ExpectedRenderPasses.Remove(PassIdentifier);
+	}
+	for (int32 OriginIndex = 0; OriginIndex < NumCaptureOrigins; OriginIndex++)
+	{
+		const FMoviePipelinePassIdentifier OriginPassIdentifier = GetOriginPassIdentifier(PassIdentifier, OriginIndex);
+		if (NumCaptureOrigins > 1)
+		{
+			ExpectedRenderPasses.Add(OriginPassIdentifier);
+		}
+		// The blender hands every additional size to the merger as a pass of its own.
+		for (const FIntPoint& OutputSize : GetResolvedAdditionalOutputSizes())
+		{
+			ExpectedRenderPasses.Add(MoviePipeline::Panoramic::GetOutputSizePassIdentifier(OriginPassIdentifier, OutputSize));
+		}
+		// Only the AOVs whose material loaded in SetupImpl are rendered.
+		for (const FMoviePipelinePassIdentifier& AOVPassIdentifier : ActiveAOVPassIdentifiers)
+		{
+			ExpectedRenderPasses.Add(GetOriginPassIdentifier(AOVPassIdentifier, OriginIndex));
+		}
+	}
+}
+
+FMoviePipelinePassIdentifier UPanoramicPass::GetAOVPassIdentifier(int32 InAOVIndex) const
+{
+	// The first AOV of a material keeps the plain name, so adding an entry doesn't rename the passes of the others.
+	const FString MaterialName = AOVs[InAOVIndex].Material.GetAssetName();
+	bool bNameTaken = false;
+	for (int32 AOVIndex = 0; AOVIndex < InAOVIndex; AOVIndex++)
+	{
+		bNameTaken |= AOVs[AOVIndex].bEnabled && !AOVs[AOVIndex].Material.IsNull() && AOVs[AOVIndex].Material.GetAssetName() == MaterialName;
+	}
+	if (bNameTaken)
+	{
+		return FMoviePipelinePassIdentifier(FString::Printf(TEXT("%s_%s_%d"), *PassIdentifier.Name, *MaterialName, InAOVIndex));
+	}
+	return FMoviePipelinePassIdentifier(FString::Printf(TEXT("%s_%s"), *PassIdentifier.Name, *MaterialName));
+}
+
+int32 UPanoramicPass::GetNumCaptureOrigins() const
+{
+	return FMath::Max(CaptureOrigins.Num(), 1);
+}
+
+FMoviePipelinePassIdentifier UPanoramicPass::GetOriginPassIdentifier(const FMoviePipelinePassIdentifier& InPassIdentifier, int32 InOriginIndex) const
+{
+	if (GetNumCaptureOrigins() <= 1)
+	{
+		return InPassIdentifier;
+	}
+	return FMoviePipelinePassIdentifier(FString::Printf(TEXT("%s_Origin_%d"), *InPassIdentifier.Name, InOriginIndex));
+}
+
+TArray<FMoviePipelinePassIdentifier> UPanoramicPass::GetOriginPasses(int32 InOriginIndex) const
+{
+	TArray<FMoviePipelinePassIdentifier> Result;
+	Result.Add(GetOriginPassIdentifier(PassIdentifier, InOriginIndex));
+	for (const FMoviePipelinePassIdentifier& AOVPassIdentifier : ActiveAOVPassIdentifiers)
+	{
+		Result.Add(GetOriginPassIdentifier(AOVPassIdentifier, InOriginIndex));
+	}
+	return Result;
+}
+
+TArray<FIntPoint> UPanoramicPass::GetResolvedAdditionalOutputSizes() const
+{
+	TArray<FIntPoint> Result;
+	for (const FIntPoint& OutputSize : AdditionalOutputSizes)
+	{
+		if (OutputSize.X <= 0 || OutputSize.Y <= 0)
+		{
+			continue;
+		}
+		Result.AddUnique(OutputSize);
+	}
+	// Largest first, so every size can be filtered from the previous one instead of the full master.
+	Result.Sort([](const FIntPoint& A, const FIntPoint& B) { return (int64)A.X * A.Y > (int64)B.X * B.Y; });
+	return Result;
 }
 
 void UPanoramicPass::AddViewExtensions(FSceneViewFamilyContext& InContext, FMoviePipelineRenderPassMetrics& InOutSampleState)
@@ -261,6 +611,43 @@ void UPanoramicPass::GetFieldOfView(float& OutHorizontal, float& OutVertical) co
 	OutVertical   = VertFieldOfView > 0 ? VertFieldOfView:FMath::Min(180/(NumVerticalSteps)*(1+OverlapPercentage*0.01),179);
 }
 
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		// How far above or below the horizon the center of a row of panes is, rows are spread evenly from pole to pole.
+		static float GetRowAbsolutePitch(int32 InVerticalStepIndex, int32 InNumVerticalSteps)
+		{
+			return FMath::Abs(90.f - (InVerticalStepIndex + 0.5f) * 180.f / InNumVerticalSteps);
+		}
+	}
+}
+
+int32 UPanoramicPass::GetNumMonoPolarRows() const
+{
+	if (!bStereo || !bMonoPolarPanes)
+	{
+		return 0;
+	}
+	// Rows are symmetric around the horizon, count them from the top. The middle row(s) always stay stereo.
+	int32 NumRows = 0;
+	while (NumRows < (NumVerticalSteps - 1) / 2 && MoviePipeline::Panoramic::GetRowAbsolutePitch(NumRows, NumVerticalSteps) >= MonoPolarPitch)
+	{
+		NumRows++;
+	}
+	return NumRows;
+}
+
+float UPanoramicPass::GetRowEyeSeparationScale(int32 InVerticalStepIndex) const
+{
+	if (GetNumMonoPolarRows() == 0)
+	{
+		return 1.f;
+	}
+	const float RowPitch = MoviePipeline::Panoramic::GetRowAbsolutePitch(InVerticalStepIndex, NumVerticalSteps);
+	return 1.f - FMath::SmoothStep(MonoPolarPitch * 0.5f, MonoPolarPitch, RowPitch);
+}
+
 FSceneView* UPanoramicPass::GetSceneViewForSampleState(FSceneViewFamily* ViewFamily, FMoviePipelineRenderPassMetrics& InOutSampleState, IViewCalcPayload* OptPayload)
 {
 	//Super::GetSceneViewForSampleState(ViewFamily,InOutSampleState,OptPayload);
@@ -331,6 +718,12 @@ FSceneView* UPanoramicPass::GetSceneViewForSampleState(FSceneViewFamily* ViewFam
 				YAxisMultiplier,
 				MinZ
 			);
+		// Splatted samples are blended one by one, each has to be rendered at its own sub-pixel offset of the pane.
+		if (bResolvedSplatSamples)
+		{
+			BaseProjMatrix.M[2][0] += InOutSampleState.SpatialShiftX * 2.f / PaneSizeX;
+			BaseProjMatrix.M[2][1] += InOutSampleState.SpatialShiftY * -2.f / PaneSizeY;
+		}
 		ViewInitOptions.ProjectionMatrix = BaseProjMatrix;
 	}
 
@@ -345,6 +738,22 @@ FSceneView* UPanoramicPass::GetSceneViewForSampleState(FSceneViewFamily* ViewFam
 	View->PreviousViewTransform = FTransform(PanoPane->PrevCameraRotation, PanoPane->PrevCameraLocation);
 	View->StartFinalPostprocessSettings(View->ViewLocation);
 	BlendPostProcessSettings(View, InOutSampleState, OptPayload);
+
+	// The AOVs come out of this same render through buffer visualization, each into its own pipe feeding our accumulators.
+	View->FinalPostProcessSettings.BufferVisualizationOverviewMaterials.Empty();
+	View->FinalPostProcessSettings.BufferVisualizationPipes.Empty();
+	if (!InOutSampleState.bDiscardResult)
+	{
+		for (int32 AOVIndex = 0; AOVIndex < ActiveAOVMaterials.Num(); AOVIndex++)
+		{
+			UMaterialInterface* AOVMaterial = ActiveAOVMaterials[AOVIndex];
+			TSharedPtr<FImagePixelPipe, ESPMode::ThreadSafe> AOVPipe = MakeShared<FImagePixelPipe, ESPMode::ThreadSafe>();
+			AOVPipe->AddEndpoint(MakeAOVForwardingEndpoint(GetOriginPassIdentifier(ActiveAOVPassIdentifiers[AOVIndex], PanoPane->OriginIndex), InOutSampleState, *PanoPane));
+			View->FinalPostProcessSettings.BufferVisualizationOverviewMaterials.Add(AOVMaterial);
+			View->FinalPostProcessSettings.BufferVisualizationPipes.Add(AOVMaterial->GetFName(), AOVPipe);
+		}
+	}
+	View->FinalPostProcessSettings.bBufferVisualizationDumpRequired = View->FinalPostProcessSettings.BufferVisualizationPipes.Num() > 0;
 	
 	View->FinalPostProcessSettings.DepthOfFieldSensorWidth *= DofSensorScale;
 
@@ -388,106 +797,290 @@ void UPanoramicPass::RenderSample_GameThreadImpl(const FMoviePipelineRenderPassM
 	Super::RenderSample_GameThreadImpl(InSampleState);
 	
 	const FIntPoint PaneResolution = GetPaneResolution(InSampleState.BackbufferSize);
+	UpdateCheckpointedSteps(InSampleState.OutputState.OutputFrameNumber, InSampleState.BackbufferSize);
 	
 	/***************************************·* Pane information entry *****************************************/
-	int32 NumEyeRenders = bStereo ? 2 : 1;
-	// Number the eyes, so after adjusting it, you render the left eye and then the right eye
-	for (int32 EyeLoopIndex = 0; EyeLoopIndex < NumEyeRenders; EyeLoopIndex++)
+	const int32 NumMonoPolarRows = GetNumMonoPolarRows();
+	// The convergence turns every camera of an eye by the same yaw, shared panes are turned by it in the blender instead.
+	const float EyeConvergenceYaw = bStereo && bEyeConvergenceDistance ? FMath::RadiansToDegrees(FMath::Atan((EyeSeparation / 2.f) / EyeConvergenceDistance)) : 0.f;
+	// The origins are rendered one after another, each as a whole rig. They only differ in where the rig is, so the
+	// blender reprojects all of them with the same tables.
+	for (int32 OriginIndex = 0; OriginIndex < GetNumCaptureOrigins(); OriginIndex++)
 	{
+		const FVector OriginOffset = CaptureOrigins.IsValidIndex(OriginIndex) ? CaptureOrigins[OriginIndex] : FVector::ZeroVector;
 		for(int32 VerticalStepIndex = 0; VerticalStepIndex < NumVerticalSteps; VerticalStepIndex++)
 		{
+			// Rows near the poles of a stereo rig may be rendered once, from between the eyes, see bMonoPolarPanes.
+			const bool bMonoPolarRow = bStereo && (VerticalStepIndex < NumMonoPolarRows || VerticalStepIndex >= NumVerticalSteps - NumMonoPolarRows);
+			const int32 NumEyeRenders = bStereo && !bMonoPolarRow ? 2 : 1;
+			const float RowEyeSeparation = EyeSeparation * GetRowEyeSeparationScale(VerticalStepIndex);
 			for(int32 HorizontalStepIndex = 0; HorizontalStepIndex < NumHorizontalSteps; HorizontalStepIndex++)
 			{
-				FMoviePipelineRenderPassMetrics InOutSampleState = InSampleState;
-				FPanoPane Pane;
+				// Both eyes of a step are rendered back to back, the blender blends them together and only has to hold
+				// the first one until the second one arrives.
+				for (int32 EyeLoopIndex = 0; EyeLoopIndex < NumEyeRenders; EyeLoopIndex++)
 				{
-				    // What I'm doing here is getting some information about the camera from sequnce (the position of the last frame, and the position of this frame)
-					FVector OriginalSequenceLocation = InSampleState.FrameInfo.CurrViewLocation;
-					FVector PrevOriginalSequenceLocation = InSampleState.FrameInfo.PrevViewLocation;
-					FRotator OriginalSequenceRotation = InSampleState.FrameInfo.CurrViewRotation;
-					FRotator PrevOriginalSequenceRotation = InSampleState.FrameInfo.PrevViewRotation;
-					FTransform OriginalSequenceTransform = FTransform(OriginalSequenceRotation,OriginalSequenceLocation,FVector(1.f, 1.f, 1.f));
-					FTransform  PrevOriginalSequenceTransform = FTransform(PrevOriginalSequenceRotation,PrevOriginalSequenceLocation,FVector(1.f, 1.f, 1.f));
-					// Number of stereoscopic eyes (-1, 0, 1)
-					int32 StereoIndex = bStereo ? EyeLoopIndex : -1;
-					Pane.EyeIndex = StereoIndex;
-					if(StereoIndex == -1)
+					FMoviePipelineRenderPassMetrics InOutSampleState = InSampleState;
+					FPanoPane Pane;
 					{
-						Pane.OriginalCameraLocation =OriginalSequenceLocation;
-						Pane.PrevOriginalCameraLocation = PrevOriginalSequenceLocation;
-						Pane.OriginalCameraRotation = OriginalSequenceRotation;
-						Pane.PrevOriginalCameraRotation = PrevOriginalSequenceRotation;
-					}
-					else
-					{
-						check(StereoIndex==0||StereoIndex==1);
-						float EyeOffset = StereoIndex == 0 ? (EyeSeparation / 2.f) : (-EyeSeparation / 2.f);
-						
-						Pane.OriginalCameraLocation = OriginalSequenceTransform.TransformPosition(FVector(0.0f,EyeOffset,0.0f));
-						Pane.PrevOriginalCameraLocation = PrevOriginalSequenceTransform.TransformPosition(FVector(0.0f,EyeOffset,0.0f));
-						if(bEyeConvergenceDistance)
-						{
-							
-							float EyeAngle = FMath::RadiansToDegrees(FMath::Atan(EyeOffset/EyeConvergenceDistance));
-							//UE_LOG(LogMovieRenderPipeline,Warning,TEXT("angel:%f"),EyeAngle);
-							Pane.OriginalCameraRotation = OriginalSequenceTransform.TransformRotation(FRotator(0.0f,EyeAngle,0.0f).Quaternion()).Rotator();
-							Pane.PrevOriginalCameraRotation = PrevOriginalSequenceTransform.TransformRotation(FRotator(0.0f,EyeAngle,0.0f).Quaternion()).Rotator();
-						}else
+					    // What I'm doing here is getting some information about the camera from sequnce (the position of the last frame, and the position of this frame)
+						FVector OriginalSequenceLocation = InSampleState.FrameInfo.CurrViewLocation;
+						FVector PrevOriginalSequenceLocation = InSampleState.FrameInfo.PrevViewLocation;
+						FRotator OriginalSequenceRotation = InSampleState.FrameInfo.CurrViewRotation;
+						FRotator PrevOriginalSequenceRotation = InSampleState.FrameInfo.PrevViewRotation;
+						FTransform OriginalSequenceTransform = FTransform(OriginalSequenceRotation,OriginalSequenceLocation,FVector(1.f, 1.f, 1.f));
+						FTransform  PrevOriginalSequenceTransform = FTransform(PrevOriginalSequenceRotation,PrevOriginalSequenceLocation,FVector(1.f, 1.f, 1.f));
+						// Number of stereoscopic eyes (-1, 0, 1)
+						int32 StereoIndex = bStereo ? EyeLoopIndex : -1;
+						Pane.EyeIndex = StereoIndex;
+						if(StereoIndex == -1 || bMonoPolarRow)
 						{
+							Pane.OriginalCameraLocation = OriginalSequenceTransform.TransformPosition(OriginOffset);
+							Pane.PrevOriginalCameraLocation = PrevOriginalSequenceTransform.TransformPosition(OriginOffset);
 							Pane.OriginalCameraRotation = OriginalSequenceRotation;
 							Pane.PrevOriginalCameraRotation = PrevOriginalSequenceRotation;
 						}
+						else
+						{
+							check(StereoIndex==0||StereoIndex==1);
+							float EyeOffset = StereoIndex == 0 ? (EyeSeparation / 2.f) : (-EyeSeparation / 2.f);
+							// Only the parallax fades towards mono polar rows, the convergence yaw has to stay the same for every row of an eye.
+							const float RowEyeOffset = StereoIndex == 0 ? (RowEyeSeparation / 2.f) : (-RowEyeSeparation / 2.f);
+							
+							Pane.OriginalCameraLocation = OriginalSequenceTransform.TransformPosition(OriginOffset + FVector(0.0f,RowEyeOffset,0.0f));
+							Pane.PrevOriginalCameraLocation = PrevOriginalSequenceTransform.TransformPosition(OriginOffset + FVector(0.0f,RowEyeOffset,0.0f));
+							if(bEyeConvergenceDistance)
+							{
+								
+								float EyeAngle = FMath::RadiansToDegrees(FMath::Atan(EyeOffset/EyeConvergenceDistance));
+								//UE_LOG(LogMovieRenderPipeline,Warning,TEXT("angel:%f"),EyeAngle);
+								Pane.OriginalCameraRotation = OriginalSequenceTransform.TransformRotation(FRotator(0.0f,EyeAngle,0.0f).Quaternion()).Rotator();
+								Pane.PrevOriginalCameraRotation = PrevOriginalSequenceTransform.TransformRotation(FRotator(0.0f,EyeAngle,0.0f).Quaternion()).Rotator();
+							}else
+							{
+								Pane.OriginalCameraRotation = OriginalSequenceRotation;
+								Pane.PrevOriginalCameraRotation = PrevOriginalSequenceRotation;
+							}
+							
+						}
+						Pane.VerticalStepIndex = VerticalStepIndex;
+						Pane.HorizontalStepIndex = HorizontalStepIndex;
+						Pane.OriginIndex = OriginIndex;
+						
+						Pane.NumHorizontalSteps = NumHorizontalSteps;
+						Pane.NumVerticalSteps = NumVerticalSteps;
+						Pane.NumPaneShards = ResolvedNumPaneShards;
+						Pane.PaneShardIndex = ResolvedPaneShardIndex;
+						Pane.EyeSeparation = EyeSeparation;
+						Pane.EyeConvergenceDistance = EyeConvergenceDistance;
+						Pane.NumMonoPolarRows = NumMonoPolarRows;
+						Pane.EyeConvergenceYaw = EyeConvergenceYaw;
+						Pane.bIncludeAlpha = bAccumulatorIncludesAlpha;
+						// Get the actual camera position and rotation for a specific Pane, this data from the global camera
+						MoviePipeline::Panoramic::GetCameraOrientationForStereo(/*Out*/ Pane.PrevCameraLocation, /*Out*/ Pane.PrevCameraRotation, Pane,  /*bInPrevPos*/ true);
+						MoviePipeline::Panoramic::GetCameraOrientationForStereo(/*Out*/ Pane.CameraLocation, /*Out*/ Pane.CameraRotation, Pane, /*bInPrevPos*/ false);
+						GetFieldOfView(Pane.HorizontalFieldOfView, Pane.VerticalFieldOfView);
 						
+						// Copy the backbuffer size of our actual allocated texture into the Pane instead of using the global output resolution, which is the final image size.
+						Pane.Resolution = PaneResolution;
 					}
-					Pane.VerticalStepIndex = VerticalStepIndex;
-					Pane.HorizontalStepIndex = HorizontalStepIndex;
-					
-					Pane.NumHorizontalSteps = NumHorizontalSteps;
-					Pane.NumVerticalSteps = NumVerticalSteps;
-					Pane.EyeSeparation = EyeSeparation;
-					Pane.EyeConvergenceDistance = EyeConvergenceDistance;
-					Pane.bIncludeAlpha = bAccumulatorIncludesAlpha;
-					// Get the actual camera position and rotation for a specific Pane, this data from the global camera
-					MoviePipeline::Panoramic::GetCameraOrientationForStereo(/*Out*/ Pane.PrevCameraLocation, /*Out*/ Pane.PrevCameraRotation, Pane,  /*bInPrevPos*/ true);
-					MoviePipeline::Panoramic::GetCameraOrientationForStereo(/*Out*/ Pane.CameraLocation, /*Out*/ Pane.CameraRotation, Pane, /*bInPrevPos*/ false);
-					GetFieldOfView(Pane.HorizontalFieldOfView, Pane.VerticalFieldOfView);
-					
-					// Copy the backbuffer size of our actual allocated texture into the Pane instead of using the global output resolution, which is the final image size.
-					Pane.Resolution = PaneResolution;
-				}
-				// Create a family of views for this rendering. This will contain only one view to better fit our existing MRQ architecture.
-				// Computing the view family requires computing the FSceneView itself, which is highly customized for panos. So we provide FPanoPlane to be passed as' raw 'data so we can use it when calculating personal views.
-				TSharedPtr<FSceneViewFamilyContext> ViewFamily = CalculateViewFamily(InOutSampleState, &Pane);
-				EAntiAliasingMethod AAMethod = ViewFamily->Views[0]->AntiAliasingMethod;
-				const bool bRequiresHistory = (AAMethod == EAntiAliasingMethod::AAM_TemporalAA) || (AAMethod == EAntiAliasingMethod::AAM_TSR);
-				if (!bAllocateHistoryPerPane && bRequiresHistory)
-				{
-					if (!bHasWarnedSettings)
+					// Panes owned by another shard are rendered by another process.
+					if (!Pane.IsInPaneShard())
+					{
+						continue;
+					}
+					// Panes a previous run already blended are loaded from disk instead.
+					if (CheckpointedSteps.Contains(Pane.GetStepIndex()))
+					{
+						QueueCheckpointRestore(InOutSampleState, Pane);
+						continue;
+					}
+					// Converged panes are blended from what they have accumulated so far.
+					TSharedRef<FPanoramicPaneConvergence, ESPMode::ThreadSafe> Convergence = GetPaneConvergence(InOutSampleState, Pane);
+					if (Convergence->bConverged)
+					{
+						FinishConvergedPane(InOutSampleState, Pane, *Convergence);
+						continue;
+					}
+					// Create a family of views for this rendering. This will contain only one view to better fit our existing MRQ architecture.
+					// Computing the view family requires computing the FSceneView itself, which is highly customized for panos. So we provide FPanoPlane to be passed as' raw 'data so we can use it when calculating personal views.
+					TSharedPtr<FSceneViewFamilyContext> ViewFamily = CalculateViewFamily(InOutSampleState, &Pane);
+					EAntiAliasingMethod AAMethod = ViewFamily->Views[0]->AntiAliasingMethod;
+					const bool bRequiresHistory = (AAMethod == EAntiAliasingMethod::AAM_TemporalAA) || (AAMethod == EAntiAliasingMethod::AAM_TSR);
+					if (!bAllocateHistoryPerPane && bRequiresHistory)
 					{
-						bHasWarnedSettings = true;
-						UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Panoramic Renders do not support TAA without enabling bAllocateHistoryPerPane! Forcing AntiAliasing off."));
+						if (!bHasWarnedSettings)
+						{
+							bHasWarnedSettings = true;
+							UE_LOG(LogMovieRenderPipeline, Warning, TEXT("Panoramic Renders do not support TAA without enabling bAllocateHistoryPerPane! Forcing AntiAliasing off."));
+						}
+						FSceneView* NonConstView = const_cast<FSceneView*>(ViewFamily->Views[0]);
+						// Change the resist tooth mode to no anti-aliasing in the extraordinary view
+						NonConstView->AntiAliasingMethod = EAntiAliasingMethod::AAM_None;
 					}
-					FSceneView* NonConstView = const_cast<FSceneView*>(ViewFamily->Views[0]);
-					// Change the resist tooth mode to no anti-aliasing in the extraordinary view
-					NonConstView->AntiAliasingMethod = EAntiAliasingMethod::AAM_None;
+					
+					// Submit the view for rendering
+					TWeakObjectPtr<UTextureRenderTarget2D> ViewRenderTarget = GetOrCreateViewRenderTarget(PaneResolution);
+					check(ViewRenderTarget.IsValid());
+					
+					FRenderTarget* RenderTarget = ViewRenderTarget->GameThread_GetRenderTargetResource();
+					check(RenderTarget);
+					FCanvas Canvas = FCanvas(RenderTarget, nullptr, GetPipeline()->GetWorld(), ViewFamily->GetFeatureLevel(), FCanvas::CDM_DeferDrawing, 1.0f);
+					//A message is sent from the game thread call to the rendering thread to render the family of views.
+					GetRendererModule().BeginRenderingViewFamily(&Canvas, ViewFamily.Get());
+					ScheduleReadbackAndAccumulation(InOutSampleState, Pane, Canvas);
 				}
-				
-				// Submit the view for rendering
-				TWeakObjectPtr<UTextureRenderTarget2D> ViewRenderTarget = GetOrCreateViewRenderTarget(PaneResolution);
-				check(ViewRenderTarget.IsValid());
-				
-				FRenderTarget* RenderTarget = ViewRenderTarget->GameThread_GetRenderTargetResource();
-				check(RenderTarget);
-				FCanvas Canvas = FCanvas(RenderTarget, nullptr, GetPipeline()->GetWorld(), ViewFamily->GetFeatureLevel(), FCanvas::CDM_DeferDrawing, 1.0f);
-				//A message is sent from the game thread call to the rendering thread to render the family of views.
-				GetRendererModule().BeginRenderingViewFamily(&Canvas, ViewFamily.Get());
-				ScheduleReadbackAndAccumulation(InOutSampleState, Pane, Canvas);
 			}
 		}
 	}
 	
 }
 
+void UPanoramicPass::UpdateCheckpointedSteps(int32 InOutputFrameNumber, const FIntPoint& InOutputSize)
+{
+	if (CheckpointedFrameNumber == InOutputFrameNumber)
+	{
+		return;
+	}
+	CheckpointedFrameNumber = InOutputFrameNumber;
+	CheckpointedSteps.Reset();
+	if (!bCheckpointPanes || bResolvedSplatSamples)
+	{
+		return;
+	}
+
+	// A step is restored for every origin or for none, the origins are rendered together.
+	TArray<FMoviePipelinePassIdentifier> CheckpointedPasses;
+	for (int32 OriginIndex = 0; OriginIndex < GetNumCaptureOrigins(); OriginIndex++)
+	{
+		CheckpointedPasses.Append(GetOriginPasses(OriginIndex));
+	}
+	const int32 NumEyes = bStereo ? 2 : 1;
+	const int32 NumSteps = NumHorizontalSteps * NumVerticalSteps;
+	for (int32 StepIndex = 0; StepIndex < NumSteps; StepIndex++)
+	{
+		bool bAllPassesOnDisk = true;
+		for (const FMoviePipelinePassIdentifier& CheckpointedPass : CheckpointedPasses)
+		{
+			// Only the header is read here, a checkpoint of another output size or eye count would not fit the frame.
+			const FString CheckpointFilename = FPanoramicAccumulationFile::GetPaneCheckpointFilename(ResolvedCheckpointDirectory, CheckpointedPass.Name, InOutputFrameNumber, StepIndex);
+			FPanoramicAccumulationFile Checkpoint;
+			if (!IFileManager::Get().FileExists(*CheckpointFilename) || !Checkpoint.Load(CheckpointFilename, /*bInHeaderOnly*/ true)
+				|| Checkpoint.OutputSize != InOutputSize || Checkpoint.NumEyes != NumEyes || Checkpoint.bIncludeAlpha != bAccumulatorIncludesAlpha)
+			{
+				bAllPassesOnDisk = false;
+				break;
+			}
+		}
+		if (bAllPassesOnDisk)
+		{
+			CheckpointedSteps.Add(StepIndex);
+		}
+	}
+	if (CheckpointedSteps.Num() > 0)
+	{
+		UE_LOG(LogMovieRenderPipeline, Display, TEXT("Resuming panoramic frame %d: %d of %d steps are restored from %s."), InOutputFrameNumber, CheckpointedSteps.Num(), NumSteps, *ResolvedCheckpointDirectory);
+	}
+}
+
+void UPanoramicPass::QueueCheckpointRestore(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane)
+{
+	// The blender expects every pane once per frame, stand in for the final sample the render would have accumulated.
+	if (InSampleState.bDiscardResult)
+	{
+		return;
+	}
+
+	TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> FramePayload = MakeShared<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe>();
+	FramePayload->SampleState = InSampleState;
+	FramePayload->SortingOrder = GetOutputFileSortingOrder();
+	FramePayload->Pane = InPane;
+	FramePayload->bRestoreFromCheckpoint = true;
+	if (!FramePayload->IsLastTile() || !FramePayload->IsLastTemporalSample())
+	{
+		return;
+	}
+
+	for (const FMoviePipelinePassIdentifier& CheckpointedPass : GetOriginPasses(InPane.OriginIndex))
+	{
+		TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> PassPayload = StaticCastSharedRef<FPanoramicImagePixelDataPayload>(FramePayload->Copy());
+		PassPayload->PassIdentifier = CheckpointedPass;
+		PanoramicOutputBlender->OnCompleteRenderPassDataAvailable_AnyThread(MakeUnique<TImagePixelData<FLinearColor>>(FIntPoint::ZeroValue, TArray64<FLinearColor>(), PassPayload));
+	}
+}
+
+TSharedRef<FPanoramicPaneConvergence, ESPMode::ThreadSafe> UPanoramicPass::GetPaneConvergence(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane)
+{
+	// Frames are rendered one after another, the panes of older frames only live on in their accumulation tasks.
+	if (ConvergenceFrameNumber != InSampleState.OutputState.OutputFrameNumber)
+	{
+		ConvergenceFrameNumber = InSampleState.OutputState.OutputFrameNumber;
+		PaneConvergence.Reset();
+	}
+
+	const FIntVector Key(InPane.GetStepIndex(), InPane.EyeIndex, InPane.OriginIndex);
+	if (const TSharedRef<FPanoramicPaneConvergence, ESPMode::ThreadSafe>* Existing = PaneConvergence.Find(Key))
+	{
+		return *Existing;
+	}
+	// Tiles are separate regions of the pane, their samples can't be compared with each other.
+	// Splatted samples are never summed up per pane.
+	// Stopping part way through the temporal samples would cut the shutter interval short for this pane only, its motion
+	// blur would no longer match its neighbours'. Only the spatial samples of a single temporal sample can be skipped.
+	const bool bEnabled = bAdaptivePaneSampling && !bResolvedSplatSamples && InSampleState.TileCounts == FIntPoint(1, 1) && InSampleState.TemporalSampleCount == 1;
+	return PaneConvergence.Add(Key, MakeShared<FPanoramicPaneConvergence, ESPMode::ThreadSafe>(bEnabled, PaneNoiseThreshold, MinPaneSamples));
+}
+
+void UPanoramicPass::FinishConvergedPane(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane, FPanoramicPaneConvergence& InConvergence)
+{
+	if (InSampleState.bDiscardResult)
+	{
+		return;
+	}
+	NumSkippedPaneSamples++;
+
+	FScopeLock ConvergenceLock(&InConvergence.Mutex);
+	if (InConvergence.bFinishQueued)
+	{
+		return;
+	}
+	InConvergence.bFinishQueued = true;
+
+	const TArray<FMoviePipelinePassIdentifier> PanePasses = GetOriginPasses(InPane.OriginIndex);
+	for (const FMoviePipelinePassIdentifier& PanePass : PanePasses)
+	{
+		// The queue hands back the accumulation this pane has been using for this frame.
+		TSharedPtr<FPanoramicAccumulatorQueue::FPaneAccumulation, ESPMode::ThreadSafe> PaneAccumulation;
+		{
+			SCOPE_CYCLE_COUNTER(STAT_MoviePipeline_WaitForAvailableAccumulator);
+			PaneAccumulation = AccumulatorQueue->GetPaneAccumulation_GameThread(InSampleState.OutputState.OutputFrameNumber, MoviePipeline::Panoramic::GetPanePassIdentifier(PanePass, InPane));
+		}
+
+		// Stands in for the final sample, for whoever looks at the sample indices downstream.
+		TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> FramePayload = MakeShared<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe>();
+		FramePayload->PassIdentifier = PanePass;
+		FramePayload->SampleState = InSampleState;
+		FramePayload->SampleState.SpatialSampleIndex = InSampleState.SpatialSampleCount - 1;
+		FramePayload->SampleState.TemporalSampleIndex = InSampleState.TemporalSampleCount - 1;
+		FramePayload->Pane = InPane;
+		const bool bIsAOV = PanePass != PanePasses[0];
+		FramePayload->SortingOrder = GetOutputFileSortingOrder() + (bIsAOV ? 1 : 0);
+		FramePayload->Pane.bIncludeAlpha = bIsAOV ? false : InPane.bIncludeAlpha;
+
+		TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> OutputMerger = PanoramicOutputBlender;
+		AccumulatorQueue->Execute(PaneAccumulation.ToSharedRef(), [FramePayload, OutputMerger](const FPanoramicAccumulatorQueue::FAccumulatorPtr& ImageAccumulator)
+		{
+			// Same as the final sample of AccumulateSample_TaskThread, with what the accumulator holds by now.
+			TUniquePtr<TImagePixelData<FLinearColor>> FinalPixelData = MakeUnique<TImagePixelData<FLinearColor>>(ImageAccumulator->PlaneSize, TArray64<FLinearColor>(), FramePayload);
+			ImageAccumulator->FetchFinalPixelDataLinearColor(FinalPixelData->Pixels);
+			ImageAccumulator->Reset();
+			OutputMerger->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(FinalPixelData));
+		}, true);
+	}
+	UE_LOG(LogMovieRenderPipeline, Verbose, TEXT("Panoramic pane %d (eye %d) of frame %d converged, skipping its remaining samples."),
+		InPane.GetStepIndex(), InPane.EyeIndex, InSampleState.OutputState.OutputFrameNumber);
+}
+
 void UPanoramicPass::ScheduleReadbackAndAccumulation(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane, FCanvas& InCanvas)
 {
 	// First check the sample status to see if the result needs to be discarded
@@ -500,21 +1093,25 @@ void UPanoramicPass::ScheduleReadbackAndAccumulation(const FMoviePipelineRenderP
 	// the task has previous samples as pre-requirements to maintain the order of the accumulations.
 	// However, each accumulator can only process one frame at a time, so we created a pool of accumulators to work concurrently.
 	// This requires a limit, as large accumulations (16k) can take up a lot of system RAM.
-	TSharedPtr<FAccumulatorPool::FAccumulatorInstance, ESPMode::ThreadSafe> SampleAccumulator;
+	// A pane that finds them all busy keeps its samples in the queue until one is free, so we can go on submitting panes.
+	// Splatted samples don't need one.
+	TSharedPtr<FPanoramicAccumulatorQueue::FPaneAccumulation, ESPMode::ThreadSafe> PaneAccumulation;
+	if (!bResolvedSplatSamples)
 	{
 		SCOPE_CYCLE_COUNTER(STAT_MoviePipeline_WaitForAvailableAccumulator);
 		// Generate a unique PassIdentifier for the Panorama pane.
-		FMoviePipelinePassIdentifier PanePassIdentifier = FMoviePipelinePassIdentifier(FString::Printf(TEXT("%s_%d_x%d_y%d"), *PassIdentifier.Name,InPane.EyeIndex, InPane.HorizontalStepIndex, InPane.VerticalStepIndex));
-		SampleAccumulator = AccumulatorPool->BlockAndGetAccumulator_GameThread(InSampleState.OutputState.OutputFrameNumber, PanePassIdentifier);
+		FMoviePipelinePassIdentifier PanePassIdentifier = MoviePipeline::Panoramic::GetPanePassIdentifier(GetOriginPassIdentifier(PassIdentifier, InPane.OriginIndex), InPane);
+		PaneAccumulation = AccumulatorQueue->GetPaneAccumulation_GameThread(InSampleState.OutputState.OutputFrameNumber, PanePassIdentifier);
 	}
 	
 	TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> FramePayload = MakeShared<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe>();
 
 	
-	FramePayload->PassIdentifier = PassIdentifier;
+	FramePayload->PassIdentifier = GetOriginPassIdentifier(PassIdentifier, InPane.OriginIndex);
 	FramePayload->SampleState = InSampleState;
 	FramePayload->SortingOrder = GetOutputFileSortingOrder();
 	FramePayload->Pane = InPane;
+	FramePayload->bSplatSample = bResolvedSplatSamples;
 	
 	if (FramePayload->Pane.EyeIndex >= 0)
 	{
@@ -537,29 +1134,45 @@ void UPanoramicPass::ScheduleReadbackAndAccumulation(const FMoviePipelineRenderP
 	MoviePipeline::FImageSampleAccumulationArgs AccumulationArgs;
 	{
 		AccumulationArgs.OutputMerger = PanoramicOutputBlender;
-		AccumulationArgs.ImageAccumulator = StaticCastSharedPtr<FImageOverlappedAccumulator>(SampleAccumulator->Accumulator);
 		AccumulationArgs.bAccumulateAlpha = bAccumulatorIncludesAlpha;
 	}
 	
-	auto Callback = [this, FramePayload, AccumulationArgs, SampleAccumulator](TUniquePtr<FImagePixelData>&& InPixelData)
+	TFunction<void(TUniquePtr<FImagePixelData>&&)> Callback;
+	if (bResolvedSplatSamples)
 	{
-		bool bFinalSample = FramePayload->IsLastTile() && FramePayload->IsLastTemporalSample();
-		FMoviePipelineBackgroundAccumulateTask Task;
-		Task.LastCompletionEvent = SampleAccumulator->TaskPrereq;
-		FGraphEventRef Event = Task.Execute([PixelData = MoveTemp(InPixelData), AccumulationArgs, bFinalSample, SampleAccumulator]() mutable
+		// The blender places the sample by its jitter and weighs it by the number of samples of the pane.
+		TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> OutputMerger = PanoramicOutputBlender;
+		Callback = [OutputMerger](TUniquePtr<FImagePixelData>&& InPixelData)
 		{
-			// Enqueue a encode for this frame onto our worker thread.
-			MoviePipeline::AccumulateSample_TaskThread(MoveTemp(PixelData), AccumulationArgs);
-			if (bFinalSample)
+			OutputMerger->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(InPixelData));
+		};
+	}
+	else
+	{
+		TSharedRef<FPanoramicPaneConvergence, ESPMode::ThreadSafe> Convergence = GetPaneConvergence(InSampleState, InPane);
+		TSharedRef<FPanoramicAccumulatorQueue, ESPMode::ThreadSafe> Queue = AccumulatorQueue.ToSharedRef();
+		Callback = [Queue, FramePayload, AccumulationArgs, PaneAccumulation, Convergence](TUniquePtr<FImagePixelData>&& InPixelData)
+		{
+			bool bFinalSample = FramePayload->IsLastTile() && FramePayload->IsLastTemporalSample();
+			FScopeLock ConvergenceLock(&Convergence->Mutex);
+			if (Convergence->bFinishQueued)
 			{
-				// Final sample has now been executed, break the pre-req chain and free the accumulator for reuse.
-				SampleAccumulator->bIsActive = false;
-				SampleAccumulator->TaskPrereq = nullptr;
+				// The pane converged while this sample was in flight, it has been handed to the blender already.
+				return;
 			}
-		});
-		SampleAccumulator->TaskPrereq = Event;
-		this->OutstandingTasks.Add(Event);
-	};
+			// Runs once the pane has an accumulator, the final sample frees it for the next waiting pane.
+			Queue->Execute(PaneAccumulation.ToSharedRef(), [PixelData = MoveTemp(InPixelData), AccumulationArgs, bFinalSample, Convergence](const FPanoramicAccumulatorQueue::FAccumulatorPtr& ImageAccumulator) mutable
+			{
+				if (!bFinalSample)
+				{
+					Convergence->AddSample(*PixelData);
+				}
+				AccumulationArgs.ImageAccumulator = ImageAccumulator;
+				// Enqueue a encode for this frame onto our worker thread.
+				MoviePipeline::AccumulateSample_TaskThread(MoveTemp(PixelData), AccumulationArgs);
+			}, bFinalSample);
+		};
+	}
 	
 	FRenderTarget* RenderTarget = InCanvas.GetRenderTarget();
 	
@@ -571,3 +1184,99 @@ void UPanoramicPass::ScheduleReadbackAndAccumulation(const FMoviePipelineRenderP
 		});
 	//InCanvas.Flush_GameThread();
 }
+
+TFunction<void(TUniquePtr<FImagePixelData>&&)> UPanoramicPass::MakeAOVForwardingEndpoint(const FMoviePipelinePassIdentifier& InAOVPassIdentifier, const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane)
+{
+	// Same as the final color: every pane of every AOV accumulates its samples in its own accumulator, or splats them.
+	TSharedPtr<FPanoramicAccumulatorQueue::FPaneAccumulation, ESPMode::ThreadSafe> PaneAccumulation;
+	if (!bResolvedSplatSamples)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_MoviePipeline_WaitForAvailableAccumulator);
+		FMoviePipelinePassIdentifier PanePassIdentifier = MoviePipeline::Panoramic::GetPanePassIdentifier(InAOVPassIdentifier, InPane);
+		PaneAccumulation = AccumulatorQueue->GetPaneAccumulation_GameThread(InSampleState.OutputState.OutputFrameNumber, PanePassIdentifier);
+	}
+
+	TSharedRef<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe> FramePayload = MakeShared<FPanoramicImagePixelDataPayload, ESPMode::ThreadSafe>();
+	FramePayload->PassIdentifier = InAOVPassIdentifier;
+	FramePayload->SampleState = InSampleState;
+	FramePayload->SortingOrder = GetOutputFileSortingOrder() + 1;
+	FramePayload->Pane = InPane;
+	// AOVs don't carry coverage in alpha.
+	FramePayload->Pane.bIncludeAlpha = false;
+	FramePayload->bSplatSample = bResolvedSplatSamples;
+
+	MoviePipeline::FImageSampleAccumulationArgs AccumulationArgs;
+	{
+		AccumulationArgs.OutputMerger = PanoramicOutputBlender;
+		AccumulationArgs.bAccumulateAlpha = false;
+	}
+
+	TSharedPtr<FPanoramicPaneConvergence, ESPMode::ThreadSafe> Convergence;
+	TSharedPtr<FPanoramicAccumulatorQueue, ESPMode::ThreadSafe> Queue = AccumulatorQueue;
+	if (!bResolvedSplatSamples)
+	{
+		Convergence = GetPaneConvergence(InSampleState, InPane);
+	}
+	return [Queue, FramePayload, AccumulationArgs, PaneAccumulation, Convergence](TUniquePtr<FImagePixelData>&& InPixelData)
+	{
+		// Transfer the framePayload to the returned data, buffer visualization hands it over without one.
+		TUniquePtr<FImagePixelData> PixelDataWithPayload = nullptr;
+		switch (InPixelData->GetType())
+		{
+			case EImagePixelType::Color:
+			{
+				TImagePixelData<FColor>* SourceData = static_cast<TImagePixelData<FColor>*>(InPixelData.Get());
+				if (FramePayload->bSplatSample)
+				{
+					// The blender samples float panes only, the accumulator would have converted it as well.
+					TArray64<FLinearColor> LinearPixels;
+					LinearPixels.SetNumUninitialized(SourceData->Pixels.Num());
+					for (int64 PixelIndex = 0; PixelIndex < SourceData->Pixels.Num(); PixelIndex++)
+					{
+						LinearPixels[PixelIndex] = FLinearColor(SourceData->Pixels[PixelIndex]);
+					}
+					PixelDataWithPayload = MakeUnique<TImagePixelData<FLinearColor>>(InPixelData->GetSize(), MoveTemp(LinearPixels), FramePayload);
+				}
+				else
+				{
+					PixelDataWithPayload = MakeUnique<TImagePixelData<FColor>>(InPixelData->GetSize(), MoveTemp(SourceData->Pixels), FramePayload);
+				}
+			}
+			break;
+			case EImagePixelType::Float16:
+			{
+				TImagePixelData<FFloat16Color>* SourceData = static_cast<TImagePixelData<FFloat16Color>*>(InPixelData.Get());
+				PixelDataWithPayload = MakeUnique<TImagePixelData<FFloat16Color>>(InPixelData->GetSize(), MoveTemp(SourceData->Pixels), FramePayload);
+			}
+			break;
+			case EImagePixelType::Float32:
+			{
+				TImagePixelData<FLinearColor>* SourceData = static_cast<TImagePixelData<FLinearColor>*>(InPixelData.Get());
+				PixelDataWithPayload = MakeUnique<TImagePixelData<FLinearColor>>(InPixelData->GetSize(), MoveTemp(SourceData->Pixels), FramePayload);
+			}
+			break;
+			default:
+				checkNoEntry();
+				return;
+		}
+
+		if (FramePayload->bSplatSample)
+		{
+			AccumulationArgs.OutputMerger->OnCompleteRenderPassDataAvailable_AnyThread(MoveTemp(PixelDataWithPayload));
+			return;
+		}
+
+		bool bFinalSample = FramePayload->IsLastTile() && FramePayload->IsLastTemporalSample();
+		FScopeLock ConvergenceLock(&Convergence->Mutex);
+		if (Convergence->bFinishQueued)
+		{
+			// Dropped like the final color of the pane, see ScheduleReadbackAndAccumulation.
+			return;
+		}
+		Queue->Execute(PaneAccumulation.ToSharedRef(), [PixelData = MoveTemp(PixelDataWithPayload), AccumulationArgs](const FPanoramicAccumulatorQueue::FAccumulatorPtr& ImageAccumulator) mutable
+		{
+			AccumulationArgs.ImageAccumulator = ImageAccumulator;
+			MoviePipeline::AccumulateSample_TaskThread(MoveTemp(PixelData), AccumulationArgs);
+		}, bFinalSample);
+	};
+}
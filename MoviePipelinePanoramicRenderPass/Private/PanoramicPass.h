@@ -3,13 +3,76 @@
 
 #include "MoviePipelineImagePassBase.h"
 #include "OpenColorIODisplayExtension.h"
+#include <atomic>
 #include "PanoramicPass.generated.h"
 
 class UTextureRenderTarget2D;
 struct FImageOverlappedAccumulator;
+struct FImagePixelData;
 class FSceneViewFamily;
 class FSceneView;
-struct FAccumulatorPool;
+class FPanoramicAccumulatorQueue;
+class UMaterialInterface;
+
+// Pixel format the panoramic blender hands to the outputs.
+UENUM(BlueprintType)
+enum class EPanoramicOutputPixelType : uint8
+{
+	/** 32 bit float per channel, the precision the panes are blended in. */
+	Float32,
+	/** 16 bit float per channel, what EXR outputs write. Half the memory of Float32. */
+	Float16,
+	/** 8 bit sRGB encoded per channel, for PNG, JPG and video outputs. */
+	Color8 UMETA(DisplayName = "8 bit sRGB")
+};
+
+// Filter the blender resamples panes with.
+UENUM(BlueprintType)
+enum class EPanoramicResampleFilter : uint8
+{
+	/** Nearest texel, fastest, for drafts. */
+	Nearest,
+	/** Bilinear interpolation of the 2x2 closest texels. */
+	Bilinear,
+	/** Catmull-Rom over 4x4 texels, sharper than bilinear. */
+	Bicubic,
+	/** Lanczos over 6x6 texels, the sharpest, for masters. */
+	Lanczos3
+};
+
+// How an AOV is combined where panes overlap.
+UENUM(BlueprintType)
+enum class EPanoramicAOVBlendMode : uint8
+{
+	/** Bilinear samples weighted across the overlapping panes, like the final color. For smooth data such as normals and motion vectors. */
+	Blend,
+	/** The nearest texel of the pane with the highest weight, two values are never mixed. For depth and object IDs. */
+	NearestMaxWeight UMETA(DisplayName = "Nearest (Max Weight)")
+};
+
+// An extra buffer captured with every pane and reprojected like the final color.
+USTRUCT(BlueprintType)
+struct FPanoramicAOV
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AOV")
+	bool bEnabled = false;
+
+	/** Post process material the buffer is captured with, e.g. a buffer visualization material. Its name is appended to the pass name. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AOV", meta = (AllowedClasses = "/Script/Engine.MaterialInterface"))
+	TSoftObjectPtr<UMaterialInterface> Material;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AOV")
+	EPanoramicAOVBlendMode BlendMode = EPanoramicAOVBlendMode::Blend;
+
+	/**
+	* The material outputs scene depth (the distance along the pane's view axis) in RGB. Every pane is converted to the
+	* distance from the camera along the output direction before it is merged, so the panes agree where they overlap.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AOV")
+	bool bPlanarDepth = false;
+};
 
 struct FPanoPane : public UMoviePipelineImagePassBase::IViewCalcPayload
 {
@@ -48,6 +111,8 @@ struct FPanoPane : public UMoviePipelineImagePassBase::IViewCalcPayload
 	int32 HorizontalStepIndex;
 	// Which vertical segment are we?
 	int32 VerticalStepIndex;
+	// Which capture origin of the rig is this pane rendered from, see UPanoramicPass::CaptureOrigins.
+	int32 OriginIndex = 0;
 
 	// When indexing into arrays of Panes, which index is this?
 	int32 GetAbsoluteIndex() const
@@ -64,8 +129,91 @@ struct FPanoPane : public UMoviePipelineImagePassBase::IViewCalcPayload
 	int32 EyeIndex;
 	
 	bool bIncludeAlpha;
+
+	// How many processes split the panes of a frame, and which one of them renders this pane.
+	int32 NumPaneShards = 1;
+	int32 PaneShardIndex = 0;
+
+	// Stereo rigs can render the first and last NumMonoPolarRows rows once, from between the eyes, for both eyes.
+	int32 NumMonoPolarRows = 0;
+	// Yaw of the left eye's cameras relative to the sequence camera from the eye convergence, the right eye's is the opposite.
+	// Panes shared by the eyes are rendered without it and turned by it when they are blended into each eye.
+	float EyeConvergenceYaw = 0.f;
+
+	bool IsMonoPolarRow(int32 InVerticalStepIndex) const
+	{
+		return InVerticalStepIndex < NumMonoPolarRows || InVerticalStepIndex >= NumVerticalSteps - NumMonoPolarRows;
+	}
+
+	// A stereo pane rendered once for both eyes, it comes with EyeIndex 0.
+	bool IsSharedByEyes() const
+	{
+		return EyeIndex != -1 && IsMonoPolarRow(VerticalStepIndex);
+	}
+
+	// Number of panes rendered for the rig steps [InFirstStep, InLastStep), all eyes included.
+	int32 GetNumPanesInSteps(int32 InFirstStep, int32 InLastStep) const
+	{
+		if (EyeIndex == -1)
+		{
+			return InLastStep - InFirstStep;
+		}
+		int32 NumPanes = 0;
+		for (int32 StepIndex = InFirstStep; StepIndex < InLastStep; StepIndex++)
+		{
+			NumPanes += IsMonoPolarRow(StepIndex / NumHorizontalSteps) ? 1 : 2;
+		}
+		return NumPanes;
+	}
+
+	// Total number of panes in a frame, all eyes included.
+	int32 GetNumPanesTotal() const
+	{
+		return GetNumPanesInSteps(0, NumHorizontalSteps * NumVerticalSteps);
+	}
+
+	// Index of the rig step this pane was rendered from, the same for both eyes.
+	int32 GetStepIndex() const
+	{
+		return VerticalStepIndex * NumHorizontalSteps + HorizontalStepIndex;
+	}
+
+	// Shards own contiguous ranges of steps with both of their eyes, so a shard covers a compact band of rows in the output
+	// and the two eyes of a step can always be blended together.
+	void GetPaneShardRange(int32& OutFirstStep, int32& OutLastStep) const
+	{
+		const int32 NumSteps = NumHorizontalSteps * NumVerticalSteps;
+		OutFirstStep = (NumSteps * PaneShardIndex) / NumPaneShards;
+		OutLastStep = (NumSteps * (PaneShardIndex + 1)) / NumPaneShards;
+	}
+
+	bool IsInPaneShard() const
+	{
+		int32 FirstStep, LastStep;
+		GetPaneShardRange(FirstStep, LastStep);
+		const int32 StepIndex = GetStepIndex();
+		return StepIndex >= FirstStep && StepIndex < LastStep;
+	}
+
+	int32 GetNumPanesInShard() const
+	{
+		int32 FirstStep, LastStep;
+		GetPaneShardRange(FirstStep, LastStep);
+		return GetNumPanesInSteps(FirstStep, LastStep);
+	}
 };
 
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		// Gets the camera location and rotation a pane is rendered with, from the sequence camera stored in the pane.
+		void GetCameraOrientationForStereo(FVector& OutLocation, FRotator& OutRotation, const FPanoPane& InPane, const bool bInPrevPosition);
+		// Pass identifier of one of the additional output sizes, e.g. Panoramic_2048x1024.
+		FMoviePipelinePassIdentifier GetOutputSizePassIdentifier(const FMoviePipelinePassIdentifier& InPassIdentifier, const FIntPoint& InSize);
+	}
+}
+
 // Panoramic image data load
 struct FPanoramicImagePixelDataPayload : public FImagePixelDataPayload
 {
@@ -101,6 +249,42 @@ struct FPanoramicImagePixelDataPayload : public FImagePixelDataPayload
 	}
 
 	FPanoPane Pane;
+	// No pixels: the blender loads this pane's step from its checkpoint instead of blending it.
+	bool bRestoreFromCheckpoint = false;
+	// A single jittered sample of the pane that goes to the blender without an accumulator, see UPanoramicPass::bSplatSamples.
+	bool bSplatSample = false;
+};
+
+// Noise estimate of one pane of one frame, see UPanoramicPass::bAdaptivePaneSampling. Luminance is tracked at a sparse grid of
+// probes across the samples, a pane has converged once the standard error of the mean is below the threshold at nearly all of them.
+struct FPanoramicPaneConvergence
+{
+	FPanoramicPaneConvergence(bool bInEnabled, float InNoiseThreshold, int32 InMinSamples)
+		: bEnabled(bInEnabled)
+		, NoiseThreshold(InNoiseThreshold)
+		, MinSamples(FMath::Max(InMinSamples, 2))
+	{}
+
+	// Called from the accumulation tasks of the pane's final color, which run one after another.
+	void AddSample(const FImagePixelData& InSample);
+
+	const bool bEnabled;
+	const float NoiseThreshold;
+	const int32 MinSamples;
+
+	// Set by AddSample, the game thread stops rendering the pane once it sees it.
+	std::atomic<bool> bConverged = false;
+	// Set once the accumulators of the pane have been finished early. Samples still in flight are dropped from then on,
+	// their accumulators may already belong to another pane. Guarded by Mutex, like chaining samples onto the accumulators.
+	bool bFinishQueued = false;
+	FCriticalSection Mutex;
+
+private:
+	int32 NumSamples = 0;
+	FIntPoint ProbeGridSize = FIntPoint::ZeroValue;
+	// Running luminance mean and sum of squared differences (Welford) of every probe.
+	TArray<float> ProbeMeans;
+	TArray<float> ProbeM2;
 };
 
 // Generate a panorama (which may be stereoscopic, stored up and down on the final page) in a cylindrical isometric projection space. 
@@ -139,9 +323,25 @@ protected:
 	static void AddReferencedObjects(UObject* InThis, FReferenceCollector& Collector);
 	
 	void ScheduleReadbackAndAccumulation(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane, FCanvas& InCanvas);
+	// Receives one AOV of a pane from buffer visualization and sends it through an accumulator of its own to the blender.
+	TFunction<void(TUniquePtr<FImagePixelData>&&)> MakeAOVForwardingEndpoint(const FMoviePipelinePassIdentifier& InAOVPassIdentifier, const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane);
+	// <Pass>_<Material>, and the index of the entry in AOVs when an earlier entry uses a material of the same name.
+	FMoviePipelinePassIdentifier GetAOVPassIdentifier(int32 InAOVIndex) const;
 	void GetFieldOfView(float& OutHorizontal, float& OutVertical) const;
+	// Rows rendered once for both eyes at the top and at the bottom of a stereo rig, see bMonoPolarPanes.
+	int32 GetNumMonoPolarRows() const;
+	// Share of EyeSeparation a stereo row is rendered with, 1 unless it approaches the mono polar rows.
+	float GetRowEyeSeparationScale(int32 InVerticalStepIndex) const;
 	FIntPoint GetPaneResolution(const FIntPoint& InSize) const;
 	FIntPoint GetPayloadPaneResolution(const FIntPoint& InSize, IViewCalcPayload* OptPayload) const;
+	// AdditionalOutputSizes without invalid or duplicate entries, from the largest to the smallest.
+	TArray<FIntPoint> GetResolvedAdditionalOutputSizes() const;
+	// At least one, the camera position itself when no CaptureOrigins are set.
+	int32 GetNumCaptureOrigins() const;
+	// The pass a pass of the rig is written as for a capture origin, with _Origin_<Index> after its name when there are several.
+	FMoviePipelinePassIdentifier GetOriginPassIdentifier(const FMoviePipelinePassIdentifier& InPassIdentifier, int32 InOriginIndex) const;
+	// The final color and the active AOVs of a capture origin, the final color first.
+	TArray<FMoviePipelinePassIdentifier> GetOriginPasses(int32 InOriginIndex) const;
 public:
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Settings")
@@ -181,6 +381,29 @@ public:
 	/** When output stereo panorama, it is Used to set the focusing distance of the eyes */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Panoramic Settings")
 	float EyeConvergenceDistance;
+
+	/**
+	* In stereo, render the rows of panes nearest the zenith and nadir once, from between the eyes, and blend them into both
+	* eyes. Parallax is tiny there and those rows are usually faded to mono anyway. On a 3 row rig this saves a third of the renders.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Panoramic Settings", meta = (EditCondition = "bStereo"))
+	bool bMonoPolarPanes = false;
+
+	/**
+	* Rows centered at least this many degrees above or below the horizon are rendered once. The eye separation of the stereo rows
+	* fades out between half this pitch and this pitch, so they meet the mono rows without a jump in parallax.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Panoramic Settings", meta = (EditCondition = "bStereo && bMonoPolarPanes", UIMin = "30", UIMax = "90", ClampMin = "0", ClampMax = "90"))
+	float MonoPolarPitch = 60.f;
+
+	/**
+	* Capture the whole rig from several origins every frame, e.g. a small grid for light field or volumetric video, instead of
+	* running a job per origin. Offsets from the sequence camera in its own space (X forward, Y right, Z up). With more than one
+	* origin every pass is written once per origin, with _Origin_<Index> after its name. The origins share the pass setup, the
+	* accumulators and the blender with its reprojection of the rig. Empty captures from the camera only.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Panoramic Settings")
+	TArray<FVector> CaptureOrigins;
 	
 	
 	
@@ -193,9 +416,187 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Panoramic Settings")
 	bool bAllocateHistoryPerPane=false;
 
+	/**
+	* Split the panes of every frame across this many processes. Each process only renders its own shard and writes
+	* the weight-carrying accumulation of it to ShardDirectory, the PanoramicShardMerge commandlet sums them into the final panorama.
+	* Can be overridden per process with -PanoramicNumShards=.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Sharding", meta = (UIMin = "1", ClampMin = "1", ClampMax = "64"))
+	int32 NumPaneShards = 1;
+
+	/** Which shard this process renders, from 0 to NumPaneShards - 1. Can be overridden per process with -PanoramicShardIndex=. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Sharding", meta = (UIMin = "0", ClampMin = "0"))
+	int32 PaneShardIndex = 0;
+
+	/** Where the shard accumulations are written. Defaults to Saved/MovieRenderPipeline/PanoramicShards when empty. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Sharding")
+	FDirectoryPath ShardDirectory;
+
+	/**
+	* Save the blended contribution of every pane to CheckpointDirectory as soon as it is blended. When a frame is rendered
+	* again after a crash, panes already on disk aren't rendered, their contribution is loaded instead. The checkpoints of a
+	* frame are deleted once it has been handed to the outputs. Clear the directory after changing the rig.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Checkpoint")
+	bool bCheckpointPanes = false;
+
+	/** Where pane checkpoints are written. Defaults to Saved/MovieRenderPipeline/PanoramicCheckpoints when empty. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Checkpoint")
+	FDirectoryPath CheckpointDirectory;
+
+	/**
+	* Also publish every finished panorama into a ring of slots in the named shared memory region StreamName, so a local
+	* encoder can consume the frames without reading them back from disk. Frames larger than a slot are published as strips
+	* of rows. The layout is described in PanoramicFrameStream.h. The regular outputs are still written.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Streaming")
+	bool bStreamToSharedMemory = false;
+
+	/** Name of the shared memory region the encoder opens. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Streaming", meta = (EditCondition = "bStreamToSharedMemory"))
+	FString StreamName = TEXT("UnrealPanoramicStream");
+
+	/** Number of slots in the ring. More slots let the encoder fall further behind before frames are dropped from the stream. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Streaming", meta = (EditCondition = "bStreamToSharedMemory", UIMin = "1", ClampMin = "1"))
+	int32 StreamSlotCount = 3;
+
+	/** Size of every slot in megabytes. A slot that holds a whole frame avoids splitting it into strips. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Streaming", meta = (EditCondition = "bStreamToSharedMemory", UIMin = "1", ClampMin = "1"))
+	int32 StreamSlotSizeMB = 256;
+
+	/**
+	* How long the encoder may hold every slot before it is considered stalled. Frames are then dropped from the stream
+	* without waiting until it reads again, blending never waits for it. Frames are dropped right away while no encoder is attached.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Streaming", meta = (EditCondition = "bStreamToSharedMemory", UIMin = "0", ClampMin = "0"))
+	float StreamTimeoutSeconds = 10.f;
+
+	/**
+	* Also write the irradiance of every finished panorama as 9 spherical harmonic coefficients per color channel,
+	* <Pass>.<Frame>.sh9.json in LightingDirectory. Gathered while the panorama is finalized, weighted by solid angle.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Lighting")
+	bool bWriteIrradianceSH = false;
+
+	/** Also write a solid angle weighted luminance histogram of every finished panorama for exposure checks, <Pass>.<Frame>.histogram.json. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Lighting")
+	bool bWriteLuminanceHistogram = false;
+
+	/** Per eye size of a small area filtered environment map written as <Pass>.<Frame>.envmap.exr for every frame. None when zero. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Lighting")
+	FIntPoint EnvironmentMapSize = FIntPoint(0, 0);
+
+	/** Where the lighting sidecars are written. Defaults to Saved/MovieRenderPipeline/PanoramicLighting when empty. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Lighting")
+	FDirectoryPath LightingDirectory;
+
+	/**
+	* Pixel format of the finished panorama. Conversion happens while normalizing the blend, so Float16 and 8 bit
+	* outputs never hold a full float copy of the frame. 8 bit is already sRGB encoded.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Settings")
+	EPanoramicOutputPixelType OutputPixelType = EPanoramicOutputPixelType::Float32;
+
+	/**
+	* Filter the panes are resampled with. Kernel weights are precomputed with the reprojection, so the sharper filters
+	* mostly cost the extra texel fetches. Sharper filters keep more detail, allowing lower pane resolutions.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Settings")
+	EPanoramicResampleFilter ResampleFilter = EPanoramicResampleFilter::Bilinear;
+
+	/**
+	* Where many pane pixels fall into one output pixel (pane edges, poles), sample a box filtered mip of the pane chosen from
+	* the local footprint of the projection, like trilinear texture filtering. Removes that aliasing without raising spatial samples.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Settings")
+	bool bPrefilterDensePanes = true;
+
+	/**
+	* Extra copies of the panorama at other sizes (per eye, like the output resolution), e.g. 8192x4096 for review and
+	* 2048x1024 for thumbnails. They are box filtered from the same accumulation while the master is finalized, so they
+	* cost no extra rendering. Each one is written as its own pass named <Pass>_<Width>x<Height>.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Settings")
+	TArray<FIntPoint> AdditionalOutputSizes;
+
+	/** Dither 8 bit output while quantizing to hide banding in smooth gradients like skies. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Settings", meta = (EditCondition = "OutputPixelType == EPanoramicOutputPixelType::Color8"))
+	bool bDitherQuantizedOutput = true;
+
+	/**
+	* Extra buffers (world normals, stencil IDs...) captured from the same render as every pane, each written as its own
+	* equirectangular pass named <Pass>_<Material> (followed by the index of the entry if an earlier one uses a material of
+	* the same name). They are always output as 32 bit float. Scene depth is converted to the distance from the camera when
+	* the AOV is marked as planar depth, other values are merged as the material outputs them. Screen space motion vectors
+	* are not converted to the panorama and don't agree where panes overlap, they need a material that outputs world space
+	* velocity.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AOVs")
+	TArray<FPanoramicAOV> AOVs;
+
+	/**
+	* How many panes may be blended into panoramas at the same time. Panes of the oldest frame are always blended first.
+	* 0 uses half of the task graph worker threads, leaving the rest for accumulation and encoding.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Performance", meta = (UIMin = "0", ClampMin = "0"))
+	int32 MaxConcurrentBlendTasks = 0;
+
+	/**
+	* How many panes may wait for an accumulator while all of them are busy, keeping their samples in memory until one frees up.
+	* Meanwhile panes (and frames) go on being submitted to the GPU. 0 stalls until an accumulator is free, like the default pool.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Performance", meta = (UIMin = "0", ClampMin = "0"))
+	int32 MaxWaitingPanes = 16;
+
+	/**
+	* Don't keep the per pixel reprojection tables of the rig (several bytes per output pixel and overlapping pane), only the
+	* summed coverage, and project every pane while blending it. For nodes that can't afford the tables at very high output
+	* resolutions; blending is somewhat slower and dense panes are not prefiltered.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Performance")
+	bool bLowMemoryBlending = false;
+
+	/**
+	* Hash every pane as it arrives, and when all panes of a frame are identical to the previous frame's (held shots, static
+	* inserts) hand on a copy of the previous panorama instead of blending it again. Every finished panorama is copied and
+	* kept until a pane of the next frame differs from it, so it costs a copy per frame and holds at most one or two
+	* panoramas per pass. Not used for sharded renders.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Performance")
+	bool bSkipHeldFrames = false;
+
+	/**
+	* Blend every spatial and temporal sample of a pane into the panorama as soon as it is read back, at its own sub-pixel
+	* jitter, instead of accumulating the samples of the pane first. The panes are filtered once instead of twice and no
+	* pane accumulators are allocated. Not used with high-res tiles; checkpoints, adaptive sampling and held frame skipping
+	* are turned off.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Performance")
+	bool bSplatSamples = false;
+
+	/**
+	* Stop rendering samples of a pane once its noise is below PaneNoiseThreshold, instead of giving every pane the full spatial
+	* sample count. Simple panes like the sky finish after a few samples, the accumulation so far is blended right away.
+	* Only used with a single temporal sample: a pane that stopped part way through the shutter interval would have shorter
+	* motion blur than its neighbours. Not used with high-res tiles.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Adaptive Sampling")
+	bool bAdaptivePaneSampling = false;
+
+	/**
+	* Relative standard error of the accumulated luminance a pane has to reach (at 95% of its pixels) to stop sampling.
+	* 0.01 is about 1% of the local brightness, lower values sample longer.
+	*/
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Adaptive Sampling", meta = (EditCondition = "bAdaptivePaneSampling", UIMin = "0.001", ClampMin = "0.0"))
+	float PaneNoiseThreshold = 0.01f;
+
+	/** Samples every pane renders before its noise is considered, the estimate is unreliable with very few samples. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Adaptive Sampling", meta = (EditCondition = "bAdaptivePaneSampling", UIMin = "2", ClampMin = "2"))
+	int32 MinPaneSamples = 4;
+
 protected:
-	// Shared pointer of the accumulation pool
-	TSharedPtr<FAccumulatorPool, ESPMode::ThreadSafe> AccumulatorPool;
+	// Hands the accumulators to the panes as they free up, see MaxWaitingPanes
+	TSharedPtr<FPanoramicAccumulatorQueue, ESPMode::ThreadSafe> AccumulatorQueue;
 	// ToDo: One per high-res tile per pano-pane?
 	// Reference to scene view state Optional Pane view state
 	TArray<FSceneViewStateReference> OptionalPaneViewStates;
@@ -205,5 +606,37 @@ protected:
 	TSharedPtr<MoviePipeline::IMoviePipelineOutputMerger> PanoramicOutputBlender;
 	
 	bool bHasWarnedSettings;
+
+	// Materials, pass identifiers and settings of the enabled AOVs whose material loaded, resolved in SetupImpl.
+	// Only these passes are ever produced, everything that expects AOV passes is built from them.
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UMaterialInterface>> ActiveAOVMaterials;
+	TArray<FMoviePipelinePassIdentifier> ActiveAOVPassIdentifiers;
+	TArray<FPanoramicAOV> ActiveAOVs;
+
+	// Shard settings after command line overrides, resolved in SetupImpl.
+	int32 ResolvedNumPaneShards;
+	int32 ResolvedPaneShardIndex;
+	// bSplatSamples unless the render uses tiles, resolved in SetupImpl.
+	bool bResolvedSplatSamples;
+
+	// Looks for the checkpoints of a frame (every pass of a step has to be on disk) when the first sample of it is rendered.
+	void UpdateCheckpointedSteps(int32 InOutputFrameNumber, const FIntPoint& InOutputSize);
+	// Hands the checkpointed contribution of a pane to the blender, in place of rendering it.
+	void QueueCheckpointRestore(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane);
+	FString ResolvedCheckpointDirectory;
+	int32 CheckpointedFrameNumber;
+	// Rig steps (FPanoPane::GetStepIndex) of CheckpointedFrameNumber that are restored instead of rendered.
+	TSet<int32> CheckpointedSteps;
+
+	// Noise estimate of a pane of the frame being rendered, created with its first sample.
+	TSharedRef<FPanoramicPaneConvergence, ESPMode::ThreadSafe> GetPaneConvergence(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane);
+	// Hands the accumulation of a converged pane (and of its AOVs) to the blender, in place of its remaining samples.
+	void FinishConvergedPane(const FMoviePipelineRenderPassMetrics& InSampleState, const FPanoPane& InPane, FPanoramicPaneConvergence& InConvergence);
+	int32 ConvergenceFrameNumber;
+	// Keyed by (FPanoPane::GetStepIndex, FPanoPane::EyeIndex, FPanoPane::OriginIndex).
+	TMap<FIntVector, TSharedRef<FPanoramicPaneConvergence, ESPMode::ThreadSafe>> PaneConvergence;
+	// Pane renders adaptive sampling saved over the whole render, for the log.
+	int64 NumSkippedPaneSamples;
 	
 };
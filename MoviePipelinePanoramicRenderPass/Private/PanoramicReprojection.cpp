@@ -0,0 +1,550 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicReprojection.h"
+#include "PanoramicPass.h"
+#include "Async/ParallelFor.h"
+
+void FPanoramicPaneProjection::Init(const FRotator& InSampleRotation, float InHorizontalFieldOfView, float InVerticalFieldOfView, const FIntPoint& InSampleSize, float InNearClippingPlane, const FIntPoint& InOutputSize)
+{
+	SampleRotation = InSampleRotation;
+	SampleSize = InSampleSize;
+	OutputSize = InOutputSize;
+
+	// Half horizontal FOV Angle of sample
+	const float SampleHalfHorizontalFoVDegrees = 0.5f * InHorizontalFieldOfView;
+	// half the vertical FOV angle of the sample
+	const float SampleHalfVerticalFoVDegrees = 0.5f * InVerticalFieldOfView;
+
+	SampleHalfHorizontalFoVCosine = FMath::Cos(FMath::DegreesToRadians(SampleHalfHorizontalFoVDegrees));
+	SampleHalfVerticalFoVCosine = FMath::Cos(FMath::DegreesToRadians(SampleHalfVerticalFoVDegrees));
+
+	// Now calculate the direction in which the panoramic pane (represented by this example) was originally oriented.
+	const float SampleYawRad = FMath::DegreesToRadians(SampleRotation.Yaw);
+	const float SamplePitchRad = FMath::DegreesToRadians(SampleRotation.Pitch);
+	// Sample direction vector, Z axis rotation theta, scalar. Based on world coordinates
+	SampleDirectionOnTheta = FVector(FMath::Cos(SampleYawRad), FMath::Sin(SampleYawRad), 0);
+	// Sample direction vector, Y axis rotation φ, quantized. Based on world coordinates
+	SampleDirectionOnPhi = FVector(FMath::Cos(SamplePitchRad), 0.f, FMath::Sin(SamplePitchRad));
+
+	// Now construct a projection matrix that represents the samples that match the original perspective.
+	SampleProjectionMatrix = FReversedZPerspectiveMatrix(FMath::DegreesToRadians(SampleHalfHorizontalFoVDegrees), SampleSize.X, SampleSize.Y, InNearClippingPlane);
+
+	// For a given output size, figure out how many degrees each pixel represents.
+	EquiRectMapThetaStep = 360.f / (float)OutputSize.X;
+	EquiRectMapPhiStep = 180.f / (float)OutputSize.Y;
+
+	// What is calculated here is the maximum and minimum Yaw of the sample: there is a problem here. When it rotates to 45 degrees, it is diagonally.
+	const float SampleYawMin = SampleRotation.Yaw - SampleHalfHorizontalFoVDegrees;
+	const float SampleYawMax = SampleRotation.Yaw + SampleHalfHorizontalFoVDegrees;
+	OutputBoundsMin.X = FMath::FloorToInt(((SampleYawMin) + 180.f) / EquiRectMapThetaStep);
+	OutputBoundsMax.X = FMath::FloorToInt(((SampleYawMax) + 180.f) / EquiRectMapThetaStep);
+
+	// About restrictions in the vertical direction
+	const float SamplePitchMin = FMath::Max(SampleRotation.Pitch - SampleHalfVerticalFoVDegrees, -90.f); // Clamped to [-90, 90]
+	const float SamplePitchMax = FMath::Min(SampleRotation.Pitch + SampleHalfVerticalFoVDegrees, 90.f); // Clamped to [-90, 90]
+	OutputBoundsMin.Y = FMath::Max((OutputSize.Y) - FMath::FloorToInt((SamplePitchMax + 90.f) / EquiRectMapPhiStep), 0);
+	OutputBoundsMax.Y = FMath::Min((OutputSize.Y) - FMath::FloorToInt((SamplePitchMin + 90.f) / EquiRectMapPhiStep), OutputSize.Y);
+
+	// Unrotation, axis swap and projection are all linear in the direction, fold them into one transform for ProjectRow.
+	ClipOffset = DirectionToClip(FVector::ZeroVector);
+	ClipPerDirectionX = DirectionToClip(FVector(1.f, 0.f, 0.f)) - ClipOffset;
+	ClipPerDirectionY = DirectionToClip(FVector(0.f, 1.f, 0.f)) - ClipOffset;
+	ClipPerDirectionZ = DirectionToClip(FVector(0.f, 0.f, 1.f)) - ClipOffset;
+}
+
+FVector FPanoramicPaneProjection::DirectionToClip(const FVector& InDirection) const
+{
+	FVector4 DirectionInSampleWorldSpace = FVector4(SampleRotation.UnrotateVector(InDirection), 1.0f);
+	static const FMatrix UnrealCoordinateConversion = FMatrix(
+		FPlane(0, 0, 1, 0),
+		FPlane(1, 0, 0, 0),
+		FPlane(0, 1, 0, 0),
+		FPlane(0, 0, 0, 1));
+	DirectionInSampleWorldSpace = UnrealCoordinateConversion.TransformFVector4(DirectionInSampleWorldSpace);
+	// Then project that direction into sample clip space
+	const FVector4 DirectionInSampleClipSpace = SampleProjectionMatrix.TransformFVector4(DirectionInSampleWorldSpace);
+	return FVector(DirectionInSampleClipSpace.X, DirectionInSampleClipSpace.Y, DirectionInSampleClipSpace.W);
+}
+
+float FPanoramicPaneProjection::GetRawWeight(int32 InOutputPixelX, int32 InOutputPixelY, FVector2D& OutSamplePixelCoords) const
+{
+	// Obtain the spherical coordinates (Theta and Phi) corresponding to the X and Y of the isometric map coordinates,
+	// converted to the [-180,180] and [-90, 90] coordinate Spaces, respectively.
+	// The half-pixel offset is used so that the center of the pixel is treated as that coordinate, and Phi increases in the opposite direction to Y.
+	const float Theta = EquiRectMapThetaStep * (((float)InOutputPixelX) + 0.5f) - 180.f;
+	const float Phi = EquiRectMapPhiStep * (((float)OutputSize.Y - InOutputPixelY) + 0.5f) - 90.f;
+
+	// Convert to radians for subsequent calculations
+	const float ThetaDeg = FMath::DegreesToRadians(Theta);
+	const float PhiDeg = FMath::DegreesToRadians(Phi);
+	// The output direction of the pixel
+	const FVector OutputDirectionTheta = FVector(FMath::Cos(ThetaDeg), FMath::Sin(ThetaDeg), 0);
+	const FVector OutputDirectionPhi = FVector(FMath::Cos(PhiDeg), 0.f, FMath::Sin(PhiDeg));
+
+	// Now we can compute how much the sample should influence this pixel. It is weighted by angular distance to the direction
+	// so that the edges have less influence (where they'd be more distorted anyways).
+	const float DirectionThetaDot = FVector::DotProduct(OutputDirectionTheta, SampleDirectionOnTheta);
+	const float DirectionPhiDot = FVector::DotProduct(OutputDirectionPhi, SampleDirectionOnPhi);
+	const float WeightTheta = FMath::Max(DirectionThetaDot - SampleHalfHorizontalFoVCosine, 0.0f) / (1.0f - SampleHalfHorizontalFoVCosine);
+	const float WeightPhi = FMath::Max(DirectionPhiDot - SampleHalfVerticalFoVCosine, 0.0f) / (1.0f - SampleHalfVerticalFoVCosine);
+	const float SampleWeight = WeightTheta * WeightPhi;
+	const float SampleWeightSquared = SampleWeight * SampleWeight; // Exponential falloff produces a nicer blending result.
+
+	// The sample weight may be very small and not worth influencing this pixel.
+	if (SampleWeightSquared <= KINDA_SMALL_NUMBER)
+	{
+		return 0.f;
+	}
+
+	OutSamplePixelCoords = ProjectToSamplePixel((float)InOutputPixelX, (float)InOutputPixelY);
+
+	// Samples whose footprint leaves the pane are left to the neighbouring panes.
+	return IsSampleClipped(OutSamplePixelCoords, SampleSize) ? 0.f : SampleWeightSquared;
+}
+
+FVector2D FPanoramicPaneProjection::ProjectToSamplePixel(float InOutputPixelX, float InOutputPixelY) const
+{
+	// Same spherical coordinates as GetRawWeight, pixel centers included.
+	const float ThetaDeg = FMath::DegreesToRadians(EquiRectMapThetaStep * (InOutputPixelX + 0.5f) - 180.f);
+	const float PhiDeg = FMath::DegreesToRadians(EquiRectMapPhiStep * (((float)OutputSize.Y - InOutputPixelY) + 0.5f) - 90.f);
+	const FVector OutputDirection(FMath::Cos(PhiDeg) * FMath::Cos(ThetaDeg), FMath::Cos(PhiDeg) * FMath::Sin(ThetaDeg), FMath::Sin(PhiDeg));
+
+	const FVector DirectionInSampleClipSpace = DirectionToClip(OutputDirection);
+	// Converted into normalized device space (Divide by w for perspective)
+	const FVector2D DirectionInSampleNDSpace = FVector2D(DirectionInSampleClipSpace.X, DirectionInSampleClipSpace.Y) / DirectionInSampleClipSpace.Z;
+
+	// Get the final pixel coordinates (direction in screen space)
+	FVector2D SamplePixelCoords = ((DirectionInSampleNDSpace + 1.0f) / 2.0f) * FVector2D(SampleSize.X, SampleSize.Y);
+	// Flip the Y value due to Y's zero coordinate being top left.
+	SamplePixelCoords.Y = ((float)SampleSize.Y - SamplePixelCoords.Y) - 1.0f;
+	return SamplePixelCoords;
+}
+
+float FPanoramicPaneProjection::GetRadialDepthScale(int32 InOutputPixelX, int32 InOutputPixelY) const
+{
+	// Same spherical coordinates as GetRawWeight. Depth is the distance along the pane's forward axis, the unit direction
+	// covers 1 / cos of it per unit of depth.
+	const float ThetaDeg = FMath::DegreesToRadians(EquiRectMapThetaStep * (((float)InOutputPixelX) + 0.5f) - 180.f);
+	const float PhiDeg = FMath::DegreesToRadians(EquiRectMapPhiStep * (((float)OutputSize.Y - InOutputPixelY) + 0.5f) - 90.f);
+	const FVector OutputDirection(FMath::Cos(PhiDeg) * FMath::Cos(ThetaDeg), FMath::Cos(PhiDeg) * FMath::Sin(ThetaDeg), FMath::Sin(PhiDeg));
+	const float ForwardCosine = FVector::DotProduct(OutputDirection, SampleRotation.Vector());
+	// Directions that far off the pane's axis have no weight anyway.
+	return ForwardCosine > KINDA_SMALL_NUMBER ? 1.f / ForwardCosine : 0.f;
+}
+
+void FPanoramicPaneProjection::ProjectRow(int32 InOutputPixelY, float* OutRawWeights, FPanoramicSampleTap* OutSampleTaps) const
+{
+	const int32 PixelWidth = GetPixelWidth();
+
+	// Everything that only depends on phi, see GetRawWeight for the weighting itself.
+	const float PhiRad = FMath::DegreesToRadians(EquiRectMapPhiStep * (((float)OutputSize.Y - InOutputPixelY) + 0.5f) - 90.f);
+	float SinPhi, CosPhi;
+	FMath::SinCos(&SinPhi, &CosPhi, PhiRad);
+	const float DirectionPhiDot = CosPhi * SampleDirectionOnPhi.X + SinPhi * SampleDirectionOnPhi.Z;
+	const float WeightPhi = FMath::Max(DirectionPhiDot - SampleHalfVerticalFoVCosine, 0.0f) / (1.0f - SampleHalfVerticalFoVCosine);
+	if (WeightPhi <= 0.f)
+	{
+		FMemory::Memzero(OutRawWeights, PixelWidth * sizeof(float));
+		return;
+	}
+	// Direction = (CosPhi * CosTheta, CosPhi * SinTheta, SinPhi), so along the row clip space is a fixed point plus
+	// CosTheta and SinTheta times two fixed vectors.
+	const FVector RowClipOffset = ClipOffset + ClipPerDirectionZ * SinPhi;
+	const FVector RowClipPerCosTheta = ClipPerDirectionX * CosPhi;
+	const FVector RowClipPerSinTheta = ClipPerDirectionY * CosPhi;
+
+	const float FirstThetaRad = FMath::DegreesToRadians(EquiRectMapThetaStep * ((float)OutputBoundsMin.X + 0.5f) - 180.f);
+	const float ThetaStepRad = FMath::DegreesToRadians(EquiRectMapThetaStep);
+	float SinThetaStep, CosThetaStep;
+	FMath::SinCos(&SinThetaStep, &CosThetaStep, ThetaStepRad);
+
+	// The recurrence drifts slowly in float, restart it from the exact angle every so often.
+	static constexpr int32 ReseedInterval = 64;
+	float SinTheta = 0.f;
+	float CosTheta = 1.f;
+	for (int32 LocalX = 0; LocalX < PixelWidth; LocalX++)
+	{
+		if (LocalX % ReseedInterval == 0)
+		{
+			FMath::SinCos(&SinTheta, &CosTheta, FirstThetaRad + LocalX * ThetaStepRad);
+		}
+
+		const float DirectionThetaDot = CosTheta * SampleDirectionOnTheta.X + SinTheta * SampleDirectionOnTheta.Y;
+		const float WeightTheta = FMath::Max(DirectionThetaDot - SampleHalfHorizontalFoVCosine, 0.0f) / (1.0f - SampleHalfHorizontalFoVCosine);
+		const float SampleWeight = WeightTheta * WeightPhi;
+		const float SampleWeightSquared = SampleWeight * SampleWeight;
+
+		OutRawWeights[LocalX] = 0.f;
+		if (SampleWeightSquared > KINDA_SMALL_NUMBER)
+		{
+			const FVector Clip = RowClipOffset + RowClipPerCosTheta * CosTheta + RowClipPerSinTheta * SinTheta;
+			FVector2D SamplePixelCoords = ((FVector2D(Clip.X, Clip.Y) / Clip.Z + 1.0f) / 2.0f) * FVector2D(SampleSize.X, SampleSize.Y);
+			SamplePixelCoords.Y = ((float)SampleSize.Y - SamplePixelCoords.Y) - 1.0f;
+			if (!IsSampleClipped(SamplePixelCoords, SampleSize))
+			{
+				OutRawWeights[LocalX] = SampleWeightSquared;
+				OutSampleTaps[LocalX] = FPanoramicSampleTap::FromPixelCoords(SamplePixelCoords);
+			}
+		}
+
+		// Rotate (CosTheta, SinTheta) on to the next pixel.
+		const float NextCosTheta = CosTheta * CosThetaStep - SinTheta * SinThetaStep;
+		SinTheta = SinTheta * CosThetaStep + CosTheta * SinThetaStep;
+		CosTheta = NextCosTheta;
+	}
+}
+
+float FPanoramicPaneProjection::GetSampleLod(int32 InOutputPixelX, int32 InOutputPixelY) const
+{
+	// Central differences of the projection across one output pixel give the Jacobian. Like trilinear filtering the longest
+	// axis picks the level, so strongly anisotropic areas (near the poles) err on the blurry side instead of aliasing.
+	const FVector2D DerivativeX = (ProjectToSamplePixel(InOutputPixelX + 0.5f, InOutputPixelY) - ProjectToSamplePixel(InOutputPixelX - 0.5f, InOutputPixelY));
+	const FVector2D DerivativeY = (ProjectToSamplePixel(InOutputPixelX, InOutputPixelY + 0.5f) - ProjectToSamplePixel(InOutputPixelX, InOutputPixelY - 0.5f));
+	const float Footprint = FMath::Max(DerivativeX.Size(), DerivativeY.Size());
+	return Footprint > 1.f ? FMath::Log2(Footprint) : 0.f;
+}
+
+bool FPanoramicPaneProjection::IsSampleClipped(const FVector2D& InSamplePixelCoords, const FIntPoint& InSampleSize)
+{
+	// The rounded lower-left pixel and its right/upper neighbours must all be inside. This doesn't depend on the resampling
+	// filter, so every filter sees the same coverage and weights. Wider kernels clamp their outer taps to the pane.
+	const FVector2D PixelCoordinateIndex = InSamplePixelCoords - 0.5f;
+	const FIntPoint LowerLeftPixelIndex = FIntPoint(FMath::RoundToInt(PixelCoordinateIndex.X), FMath::RoundToInt(PixelCoordinateIndex.Y));
+	return LowerLeftPixelIndex.X < 0 || LowerLeftPixelIndex.Y < 0
+		|| LowerLeftPixelIndex.X + 1 > InSampleSize.X - 1 || LowerLeftPixelIndex.Y + 1 > InSampleSize.Y - 1;
+}
+
+FPanoramicSampleTap FPanoramicSampleTap::FromPixelCoords(const FVector2D& InSamplePixelCoords)
+{
+	// Pixel coordinates assume that 0.5, 0.5 is the center of the pixel, so we subtract half to make it indexable.
+	const FVector2D PixelCoordinateIndex = InSamplePixelCoords - 0.5f;
+	int32 BaseX = FMath::FloorToInt(PixelCoordinateIndex.X);
+	int32 BaseY = FMath::FloorToInt(PixelCoordinateIndex.Y);
+	int32 PhaseX = FMath::RoundToInt((PixelCoordinateIndex.X - BaseX) * NumPhases);
+	int32 PhaseY = FMath::RoundToInt((PixelCoordinateIndex.Y - BaseY) * NumPhases);
+	// Rounding up to a full texel moves on to the next one.
+	if (PhaseX >= NumPhases)
+	{
+		BaseX++;
+		PhaseX = 0;
+	}
+	if (PhaseY >= NumPhases)
+	{
+		BaseY++;
+		PhaseY = 0;
+	}
+
+	FPanoramicSampleTap Result;
+	Result.BaseX = (int16)FMath::Clamp(BaseX, (int32)MIN_int16, (int32)MAX_int16);
+	Result.BaseY = (int16)FMath::Clamp(BaseY, (int32)MIN_int16, (int32)MAX_int16);
+	Result.PhaseX = (uint8)PhaseX;
+	Result.PhaseY = (uint8)PhaseY;
+	return Result;
+}
+
+namespace MoviePipeline
+{
+	namespace Panoramic
+	{
+		static float EvaluateResampleKernel(EPanoramicResampleFilter InFilter, float InDistance)
+		{
+			const float X = FMath::Abs(InDistance);
+			switch (InFilter)
+			{
+				case EPanoramicResampleFilter::Bicubic:
+				{
+					// Catmull-Rom, sharp and interpolating (passes through the texel values).
+					if (X < 1.f)
+					{
+						return 1.5f * X * X * X - 2.5f * X * X + 1.f;
+					}
+					if (X < 2.f)
+					{
+						return -0.5f * X * X * X + 2.5f * X * X - 4.f * X + 2.f;
+					}
+					return 0.f;
+				}
+				case EPanoramicResampleFilter::Lanczos3:
+				{
+					if (X < KINDA_SMALL_NUMBER)
+					{
+						return 1.f;
+					}
+					if (X >= 3.f)
+					{
+						return 0.f;
+					}
+					const float PiX = PI * X;
+					return 3.f * FMath::Sin(PiX) * FMath::Sin(PiX / 3.f) / (PiX * PiX);
+				}
+				case EPanoramicResampleFilter::Bilinear:
+				default:
+					return FMath::Max(1.f - X, 0.f);
+			}
+		}
+	}
+}
+
+void FPanoramicResampleKernel::Init(EPanoramicResampleFilter InFilter)
+{
+	bNearest = InFilter == EPanoramicResampleFilter::Nearest;
+	switch (InFilter)
+	{
+		case EPanoramicResampleFilter::Nearest:
+			NumTaps = 1;
+			break;
+		case EPanoramicResampleFilter::Bicubic:
+			NumTaps = 4;
+			break;
+		case EPanoramicResampleFilter::Lanczos3:
+			NumTaps = 6;
+			break;
+		case EPanoramicResampleFilter::Bilinear:
+		default:
+			NumTaps = 2;
+			break;
+	}
+	check(NumTaps <= MaxTaps);
+
+	PhaseWeights.SetNumZeroed(FPanoramicSampleTap::NumPhases * NumTaps);
+	if (bNearest)
+	{
+		return;
+	}
+	for (int32 Phase = 0; Phase < FPanoramicSampleTap::NumPhases; Phase++)
+	{
+		const float Fraction = (float)Phase / FPanoramicSampleTap::NumPhases;
+		float* Weights = PhaseWeights.GetData() + Phase * NumTaps;
+		float TotalWeight = 0.f;
+		for (int32 TapIndex = 0; TapIndex < NumTaps; TapIndex++)
+		{
+			Weights[TapIndex] = MoviePipeline::Panoramic::EvaluateResampleKernel(InFilter, (GetFirstTapOffset() + TapIndex) - Fraction);
+			TotalWeight += Weights[TapIndex];
+		}
+		// Windowed kernels don't sum to exactly one, normalize so flat areas stay flat.
+		for (int32 TapIndex = 0; TapIndex < NumTaps; TapIndex++)
+		{
+			Weights[TapIndex] /= TotalWeight;
+		}
+	}
+}
+
+FPanoramicRigReprojection::FRigDesc FPanoramicRigReprojection::FRigDesc::FromPane(const FPanoPane& InPane, const FIntPoint& InOutputSize, EPanoramicResampleFilter InFilter, bool bInMipFiltering)
+{
+	FRigDesc Result;
+	Result.NumHorizontalSteps = InPane.NumHorizontalSteps;
+	Result.NumVerticalSteps = InPane.NumVerticalSteps;
+	Result.HorizontalFieldOfView = InPane.HorizontalFieldOfView;
+	Result.VerticalFieldOfView = InPane.VerticalFieldOfView;
+	Result.PaneResolution = InPane.Resolution;
+	Result.NearClippingPlane = InPane.NearClippingPlane;
+	Result.OutputSize = InOutputSize;
+	Result.Filter = InFilter;
+	Result.bMipFiltering = bInMipFiltering;
+	if (InPane.EyeIndex != -1)
+	{
+		Result.NumSharedRows = InPane.NumMonoPolarRows;
+		Result.EyeConvergenceYaw = InPane.EyeConvergenceYaw;
+	}
+	return Result;
+}
+
+bool FPanoramicRigReprojection::FRigDesc::operator==(const FRigDesc& InOther) const
+{
+	// The near plane doesn't influence where directions land on the pane, only their depth.
+	return NumHorizontalSteps == InOther.NumHorizontalSteps
+		&& NumVerticalSteps == InOther.NumVerticalSteps
+		&& HorizontalFieldOfView == InOther.HorizontalFieldOfView
+		&& VerticalFieldOfView == InOther.VerticalFieldOfView
+		&& PaneResolution == InOther.PaneResolution
+		&& OutputSize == InOther.OutputSize
+		&& Filter == InOther.Filter
+		&& bMipFiltering == InOther.bMipFiltering
+		&& bStreaming == InOther.bStreaming
+		&& NumSharedRows == InOther.NumSharedRows
+		&& EyeConvergenceYaw == InOther.EyeConvergenceYaw;
+}
+
+void FPanoramicRigReprojection::Build(const FRigDesc& InDesc)
+{
+	LLM_SCOPE_BYNAME(TEXT("MoviePipeline/PanoReprojection"));
+	Desc = InDesc;
+	Kernel.Init(Desc.Filter);
+	const int32 NumSteps = Desc.NumHorizontalSteps * Desc.NumVerticalSteps;
+	const int32 NumSharedSteps = 2 * Desc.NumSharedRows * Desc.NumHorizontalSteps;
+	Panes.SetNum(NumSteps + NumSharedSteps);
+	// Eyes see the shared panes turned differently, so each eye sums its own coverage. Mono rigs and stereo rigs without
+	// shared rows weigh both eyes the same.
+	const int32 NumCoverageEyes = NumSharedSteps > 0 ? 2 : 1;
+
+	// First the raw weights and sample coordinates of every pane, independently.
+	ParallelFor(Panes.Num(), [&](int32 PaneIndex)
+	{
+		// The panes of all steps (the left eye's for shared rows), then the right eye's panes of the shared rows.
+		int32 StepIndex = PaneIndex;
+		int32 EyeIndex = 0;
+		if (PaneIndex >= NumSteps)
+		{
+			const int32 SharedRowIndex = (PaneIndex - NumSteps) / Desc.NumHorizontalSteps;
+			const int32 VerticalStepIndex = SharedRowIndex < Desc.NumSharedRows ? SharedRowIndex : SharedRowIndex + Desc.NumVerticalSteps - 2 * Desc.NumSharedRows;
+			StepIndex = VerticalStepIndex * Desc.NumHorizontalSteps + (PaneIndex - NumSteps) % Desc.NumHorizontalSteps;
+			EyeIndex = 1;
+		}
+
+		// Orient the pane exactly like the pass does, relative to an identity camera.
+		FPanoPane RigPane;
+		RigPane.OriginalCameraLocation = FVector::ZeroVector;
+		RigPane.PrevOriginalCameraLocation = FVector::ZeroVector;
+		RigPane.OriginalCameraRotation = FRotator::ZeroRotator;
+		RigPane.PrevOriginalCameraRotation = FRotator::ZeroRotator;
+		RigPane.NumHorizontalSteps = Desc.NumHorizontalSteps;
+		RigPane.NumVerticalSteps = Desc.NumVerticalSteps;
+		RigPane.HorizontalStepIndex = StepIndex % Desc.NumHorizontalSteps;
+		RigPane.VerticalStepIndex = StepIndex / Desc.NumHorizontalSteps;
+		if (IsSharedRow(RigPane.VerticalStepIndex))
+		{
+			// Shared panes were rendered from the sequence camera, which is turned by minus the eye's yaw relative to the eye.
+			const float EyeYaw = EyeIndex == 0 ? Desc.EyeConvergenceYaw : -Desc.EyeConvergenceYaw;
+			RigPane.OriginalCameraRotation = FRotator(0.f, -EyeYaw, 0.f);
+		}
+		FVector PaneLocation;
+		FRotator PaneRotation;
+		MoviePipeline::Panoramic::GetCameraOrientationForStereo(PaneLocation, PaneRotation, RigPane, /*bInPrevPos*/ false);
+
+		FPanoramicPaneReprojection& Pane = Panes[PaneIndex];
+		Pane.Projection.Init(PaneRotation, Desc.HorizontalFieldOfView, Desc.VerticalFieldOfView, Desc.PaneResolution, Desc.NearClippingPlane, Desc.OutputSize);
+		if (Desc.bStreaming)
+		{
+			return;
+		}
+
+		const int32 PixelWidth = Pane.Projection.GetPixelWidth();
+		const int32 PixelHeight = Pane.Projection.GetPixelHeight();
+		float MaxLod = 0.f;
+		Pane.SampleTaps.SetNumUninitialized((int64)PixelWidth * PixelHeight);
+		Pane.Weights.SetNumUninitialized((int64)PixelWidth * PixelHeight);
+		for (int32 LocalY = 0; LocalY < PixelHeight; LocalY++)
+		{
+			for (int32 LocalX = 0; LocalX < PixelWidth; LocalX++)
+			{
+				const int32 OutputPixelX = ((LocalX + Pane.Projection.OutputBoundsMin.X) % Desc.OutputSize.X + Desc.OutputSize.X) % Desc.OutputSize.X;
+				const int32 OutputPixelY = LocalY + Pane.Projection.OutputBoundsMin.Y;
+				const int64 EntryIndex = LocalX + (int64)LocalY * PixelWidth;
+
+				FVector2D SamplePixelCoords = FVector2D::ZeroVector;
+				Pane.Weights[EntryIndex] = Pane.Projection.GetRawWeight(OutputPixelX, OutputPixelY, SamplePixelCoords);
+				FPanoramicSampleTap& Tap = Pane.SampleTaps[EntryIndex];
+				Tap = FPanoramicSampleTap::FromPixelCoords(SamplePixelCoords);
+				if (Desc.bMipFiltering && Pane.Weights[EntryIndex] > 0.f)
+				{
+					Tap.SetLod(Pane.Projection.GetSampleLod(OutputPixelX, OutputPixelY));
+					MaxLod = FMath::Max(MaxLod, Tap.GetLod());
+				}
+			}
+		}
+
+		// Only build as many levels as the densest spot of the pane needs (trilinear reads the next level too),
+		// and never smaller than a single texel.
+		const int32 MaxUsefulLevels = FMath::FloorLog2(FMath::Max(FMath::Min(Desc.PaneResolution.X, Desc.PaneResolution.Y), 1)) + 1;
+		Pane.NumMipLevels = FMath::Clamp(FMath::CeilToInt(MaxLod) + 1, 1, MaxUsefulLevels);
+	});
+
+	// Then the summed coverage of the whole rig at every output pixel, per eye. Rows are independent, so no locking is needed.
+	TArray64<float> Coverage[2];
+	for (int32 EyeIndex = 0; EyeIndex < NumCoverageEyes; EyeIndex++)
+	{
+		Coverage[EyeIndex].SetNumZeroed((int64)Desc.OutputSize.X * Desc.OutputSize.Y);
+	}
+	ParallelFor(Desc.OutputSize.Y, [&](int32 OutputPixelY)
+	{
+		TArray<float> StreamedWeightRow;
+		TArray<FPanoramicSampleTap> StreamedTapRow;
+		for (int32 EyeIndex = 0; EyeIndex < NumCoverageEyes; EyeIndex++)
+		{
+			float* CoverageRow = Coverage[EyeIndex].GetData() + (int64)OutputPixelY * Desc.OutputSize.X;
+			for (int32 StepIndex = 0; StepIndex < NumSteps; StepIndex++)
+			{
+				const FPanoramicPaneReprojection& Pane = GetPane(StepIndex % Desc.NumHorizontalSteps, StepIndex / Desc.NumHorizontalSteps, EyeIndex);
+				if (OutputPixelY < Pane.Projection.OutputBoundsMin.Y || OutputPixelY >= Pane.Projection.OutputBoundsMax.Y)
+				{
+					continue;
+				}
+				const int32 PixelWidth = Pane.Projection.GetPixelWidth();
+				const float* WeightRow = nullptr;
+				if (Desc.bStreaming)
+				{
+					StreamedWeightRow.SetNumUninitialized(PixelWidth);
+					StreamedTapRow.SetNumUninitialized(PixelWidth);
+					Pane.Projection.ProjectRow(OutputPixelY, StreamedWeightRow.GetData(), StreamedTapRow.GetData());
+					WeightRow = StreamedWeightRow.GetData();
+				}
+				else
+				{
+					WeightRow = Pane.Weights.GetData() + (int64)(OutputPixelY - Pane.Projection.OutputBoundsMin.Y) * PixelWidth;
+				}
+				for (int32 LocalX = 0; LocalX < PixelWidth; LocalX++)
+				{
+					const int32 OutputPixelX = ((LocalX + Pane.Projection.OutputBoundsMin.X) % Desc.OutputSize.X + Desc.OutputSize.X) % Desc.OutputSize.X;
+					CoverageRow[OutputPixelX] += WeightRow[LocalX];
+				}
+			}
+		}
+	});
+
+	if (Desc.bStreaming)
+	{
+		// Only the coverage is kept, inverted so the blender multiplies. Pixels no pane covers are never read.
+		for (int32 EyeIndex = 0; EyeIndex < NumCoverageEyes; EyeIndex++)
+		{
+			ParallelFor(Desc.OutputSize.Y, [&](int32 OutputPixelY)
+			{
+				float* CoverageRow = Coverage[EyeIndex].GetData() + (int64)OutputPixelY * Desc.OutputSize.X;
+				for (int32 OutputPixelX = 0; OutputPixelX < Desc.OutputSize.X; OutputPixelX++)
+				{
+					CoverageRow[OutputPixelX] = CoverageRow[OutputPixelX] > 0.f ? 1.f / CoverageRow[OutputPixelX] : 0.f;
+				}
+			});
+		}
+		InverseCoverage = MoveTemp(Coverage[0]);
+		RightEyeInverseCoverage = MoveTemp(Coverage[1]);
+		return;
+	}
+
+	// Finally divide every weight by the coverage at its pixel. Pixels no pane covers keep a weight of 0 instead of producing NaNs.
+	// The panes of the steps are the left eye's (or mono), the ones after them the right eye's panes of the shared rows.
+	// Unshared panes are used by both eyes and also get the right eye's weights where the shared panes make them differ.
+	ParallelFor(Panes.Num(), [&](int32 PaneIndex)
+	{
+		FPanoramicPaneReprojection& Pane = Panes[PaneIndex];
+		const int32 PixelWidth = Pane.Projection.GetPixelWidth();
+		const bool bRightEyeOnly = PaneIndex >= NumSteps;
+		const bool bUsedByBothEyes = NumCoverageEyes == 2 && !bRightEyeOnly && !IsSharedRow(PaneIndex / Desc.NumHorizontalSteps);
+		const TArray64<float>& PaneCoverage = bRightEyeOnly ? Coverage[1] : Coverage[0];
+		bool bRightEyeDiffers = false;
+		if (bUsedByBothEyes)
+		{
+			Pane.RightEyeWeights.SetNumZeroed(Pane.Weights.Num());
+		}
+		for (int64 EntryIndex = 0; EntryIndex < Pane.Weights.Num(); EntryIndex++)
+		{
+			float& Weight = Pane.Weights[EntryIndex];
+			if (Weight <= 0.f)
+			{
+				continue;
+			}
+			const int32 OutputPixelX = (((int32)(EntryIndex % PixelWidth) + Pane.Projection.OutputBoundsMin.X) % Desc.OutputSize.X + Desc.OutputSize.X) % Desc.OutputSize.X;
+			const int32 OutputPixelY = (int32)(EntryIndex / PixelWidth) + Pane.Projection.OutputBoundsMin.Y;
+			const int64 OutputPixelIndex = OutputPixelX + (int64)OutputPixelY * Desc.OutputSize.X;
+			if (bUsedByBothEyes)
+			{
+				Pane.RightEyeWeights[EntryIndex] = Weight / Coverage[1][OutputPixelIndex];
+				bRightEyeDiffers |= Coverage[1][OutputPixelIndex] != Coverage[0][OutputPixelIndex];
+			}
+			Weight /= PaneCoverage[OutputPixelIndex];
+		}
+		// Both eyes sum the same panes away from the shared rows, in the same order, so the coverage is exactly equal there.
+		if (!bRightEyeDiffers)
+		{
+			Pane.RightEyeWeights.Empty();
+		}
+	});
+}
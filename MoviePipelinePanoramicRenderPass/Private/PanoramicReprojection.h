@@ -0,0 +1,215 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FPanoPane;
+struct FPanoramicSampleTap;
+enum class EPanoramicResampleFilter : uint8;
+
+// Where a pane of the rig lands in the equirectangular map. This is pure geometry: it is the same for every frame,
+// and for both stereo eyes since each eye's panorama is expressed relative to its own (converged) camera. Panes shared by
+// the eyes are the exception, see FPanoramicRigReprojection::FRigDesc::NumSharedRows.
+struct FPanoramicPaneProjection
+{
+	void Init(const FRotator& InSampleRotation, float InHorizontalFieldOfView, float InVerticalFieldOfView, const FIntPoint& InSampleSize, float InNearClippingPlane, const FIntPoint& InOutputSize);
+
+	// Weight of this pane for an output pixel (squared angular falloff), 0 if the pane doesn't contribute to it.
+	// Also returns the pane pixel coordinate the output pixel maps to.
+	float GetRawWeight(int32 InOutputPixelX, int32 InOutputPixelY, FVector2D& OutSamplePixelCoords) const;
+
+	// Pane pixel coordinate a (sub pixel) position of the output map projects to, 0.5 being the center of the first pixel.
+	FVector2D ProjectToSamplePixel(float InOutputPixelX, float InOutputPixelY) const;
+
+	// Ratio of the distance along an output pixel's direction to the distance along the pane's forward axis, to turn the
+	// pane's planar scene depth into the distance from the camera.
+	float GetRadialDepthScale(int32 InOutputPixelX, int32 InOutputPixelY) const;
+
+	// GetRawWeight and the sample tap of every pixel of one output row, across the pane bounds (GetPixelWidth() entries from
+	// OutputBoundsMin.X). Phi is constant along a row and theta moves in fixed steps, so the direction is advanced with a rotation
+	// recurrence and projected with a 3x3 multiply and a divide: no per pixel sin/cos or matrix products, and no tables.
+	void ProjectRow(int32 InOutputPixelY, float* OutRawWeights, FPanoramicSampleTap* OutSampleTaps) const;
+
+	// Mip level matching how many pane texels one output pixel spans around a position: log2 of the longest side of
+	// the projected pixel footprint (the projection's Jacobian), 0 where the pane is not denser than the output.
+	float GetSampleLod(int32 InOutputPixelX, int32 InOutputPixelY) const;
+
+	// True if the bilinear footprint of a sample coordinate leaves the pane.
+	static bool IsSampleClipped(const FVector2D& InSamplePixelCoords, const FIntPoint& InSampleSize);
+
+	int32 GetPixelWidth() const { return OutputBoundsMax.X - OutputBoundsMin.X; }
+	int32 GetPixelHeight() const { return OutputBoundsMax.Y - OutputBoundsMin.Y; }
+
+	// Rotation of the pane relative to the camera of its eye.
+	FRotator SampleRotation;
+	FIntPoint SampleSize;
+	FIntPoint OutputSize;
+	float SampleHalfHorizontalFoVCosine;
+	float SampleHalfVerticalFoVCosine;
+	FVector SampleDirectionOnTheta;
+	FVector SampleDirectionOnPhi;
+	FMatrix SampleProjectionMatrix;
+	float EquiRectMapThetaStep;
+	float EquiRectMapPhiStep;
+	// Rectangle of the output map the pane can touch. X may run past the map width, it wraps around horizontally.
+	FIntPoint OutputBoundsMin;
+	FIntPoint OutputBoundsMax;
+	// The whole output direction to clip space (X, Y, W) transform, one column per direction axis plus the constant part.
+	FVector ClipPerDirectionX;
+	FVector ClipPerDirectionY;
+	FVector ClipPerDirectionZ;
+	FVector ClipOffset;
+
+private:
+	// Clip space X, Y and W of an output direction, before the perspective divide.
+	FVector DirectionToClip(const FVector& InDirection) const;
+};
+
+// Where an output pixel samples its pane: the texel left of / above the sample position (texel centers are at +0.5),
+// and how far past that texel center the position is, in 1/NumPhases of a texel.
+struct FPanoramicSampleTap
+{
+	int16 BaseX;
+	int16 BaseY;
+	uint8 PhaseX;
+	uint8 PhaseY;
+	// Mip level to sample, in 1/LodSteps of a level.
+	uint8 Lod = 0;
+
+	static constexpr int32 NumPhases = 256;
+	static constexpr int32 LodSteps = 32;
+
+	float GetLod() const { return (float)Lod / LodSteps; }
+	void SetLod(float InLod) { Lod = (uint8)FMath::Clamp(FMath::RoundToInt(InLod * LodSteps), 0, 255); }
+
+	static FPanoramicSampleTap FromPixelCoords(const FVector2D& InSamplePixelCoords);
+
+	// The tap of the position InOffset (in 1/NumPhases of a texel) further, for samples rendered with a sub-pixel jitter.
+	FPanoramicSampleTap GetOffset(const FIntPoint& InOffset) const
+	{
+		FPanoramicSampleTap Result = *this;
+		const int32 FixedX = BaseX * NumPhases + PhaseX + InOffset.X;
+		const int32 FixedY = BaseY * NumPhases + PhaseY + InOffset.Y;
+		Result.BaseX = (int16)FMath::FloorToInt((float)FixedX / NumPhases);
+		Result.BaseY = (int16)FMath::FloorToInt((float)FixedY / NumPhases);
+		Result.PhaseX = (uint8)(FixedX - Result.BaseX * NumPhases);
+		Result.PhaseY = (uint8)(FixedY - Result.BaseY * NumPhases);
+		return Result;
+	}
+
+	// The texel whose center is closest to the sample position.
+	FIntPoint GetNearestTexel() const
+	{
+		return FIntPoint(BaseX + (PhaseX >= NumPhases / 2 ? 1 : 0), BaseY + (PhaseY >= NumPhases / 2 ? 1 : 0));
+	}
+};
+
+// Separable resampling kernel tabulated for every sub-texel phase, so sampling a pane is only fetches and multiply-adds.
+struct FPanoramicResampleKernel
+{
+	void Init(EPanoramicResampleFilter InFilter);
+
+	// Taps per axis, the first one is NumTaps / 2 - 1 texels before the base texel. Nearest uses the nearest texel instead.
+	int32 NumTaps = 0;
+	bool bNearest = false;
+
+	// Normalized weights of the taps for a phase.
+	const float* GetWeights(int32 InPhase) const { return PhaseWeights.GetData() + InPhase * NumTaps; }
+	int32 GetFirstTapOffset() const { return 1 - NumTaps / 2; }
+
+	static constexpr int32 MaxTaps = 6;
+
+private:
+	TArray<float> PhaseWeights;
+};
+
+// Precomputed per pixel reprojection of a single pane.
+struct FPanoramicPaneReprojection
+{
+	FPanoramicPaneProjection Projection;
+	// One entry per output pixel of the pane bounds, row-major and GetPixelWidth() wide: where to sample the pane,
+	// and the normalized weight of the pane there (0 where it doesn't contribute). Empty for streaming rigs.
+	TArray64<FPanoramicSampleTap> SampleTaps;
+	TArray64<float> Weights;
+	// Stereo rigs with shared panes only: the right eye's weights, where its coverage differs from the left eye's because
+	// the shared panes are turned the other way. Empty where both eyes weigh the pane the same, see GetWeights.
+	TArray64<float> RightEyeWeights;
+	// How many mip levels (the pane itself included) the taps of this pane reach into. 1 if it never needs prefiltering.
+	int32 NumMipLevels = 1;
+
+	const float* GetWeights(int32 InEyeIndex) const
+	{
+		return InEyeIndex == 1 && RightEyeWeights.Num() > 0 ? RightEyeWeights.GetData() : Weights.GetData();
+	}
+};
+
+// Reprojection of every pane of a fixed rig. The weights are divided by the summed coverage of all panes, so they form
+// a partition of unity: pane contributions add straight into final values, with no weight buffer or division afterwards.
+class FPanoramicRigReprojection
+{
+public:
+	struct FRigDesc
+	{
+		int32 NumHorizontalSteps = 0;
+		int32 NumVerticalSteps = 0;
+		float HorizontalFieldOfView = 0.f;
+		float VerticalFieldOfView = 0.f;
+		FIntPoint PaneResolution = FIntPoint::ZeroValue;
+		float NearClippingPlane = 0.f;
+		FIntPoint OutputSize = FIntPoint::ZeroValue;
+		EPanoramicResampleFilter Filter = (EPanoramicResampleFilter)0;
+		bool bMipFiltering = false;
+		// Keep only the projections and the rig coverage, the blender projects every row itself (see ProjectRow).
+		// Much less memory for very large outputs, at the cost of some math per pane. No mip filtering.
+		bool bStreaming = false;
+		// Stereo rigs only: the first and last NumSharedRows rows are rendered once from between the eyes (see
+		// FPanoPane::IsSharedByEyes). Relative to an eye's camera their panes are turned by minus the eye's convergence yaw,
+		// EyeConvergenceYaw for the left eye, so each eye gets panes of its own for them and a coverage of its own.
+		int32 NumSharedRows = 0;
+		float EyeConvergenceYaw = 0.f;
+
+		static FRigDesc FromPane(const FPanoPane& InPane, const FIntPoint& InOutputSize, EPanoramicResampleFilter InFilter, bool bInMipFiltering);
+		bool operator==(const FRigDesc& InOther) const;
+		bool operator!=(const FRigDesc& InOther) const { return !(*this == InOther); }
+	};
+
+	void Build(const FRigDesc& InDesc);
+
+	const FRigDesc& GetDesc() const { return Desc; }
+	const FPanoramicResampleKernel& GetKernel() const { return Kernel; }
+	bool IsStreaming() const { return Desc.bStreaming; }
+	// Streaming rigs only: what raw weights are multiplied by at an output pixel of an eye so they sum to one across the rig.
+	float GetInverseCoverage(int32 InOutputPixelX, int32 InOutputPixelY, int32 InEyeIndex = -1) const
+	{
+		const TArray64<float>& EyeInverseCoverage = InEyeIndex == 1 && RightEyeInverseCoverage.Num() > 0 ? RightEyeInverseCoverage : InverseCoverage;
+		return EyeInverseCoverage[InOutputPixelX + (int64)InOutputPixelY * Desc.OutputSize.X];
+	}
+	bool IsSharedRow(int32 InVerticalStepIndex) const
+	{
+		return InVerticalStepIndex < Desc.NumSharedRows || InVerticalStepIndex >= Desc.NumVerticalSteps - Desc.NumSharedRows;
+	}
+	// The reprojection of a rig step into the panorama of an eye (-1 for mono rigs). Only shared rows differ between the eyes.
+	const FPanoramicPaneReprojection& GetPane(int32 InHorizontalStepIndex, int32 InVerticalStepIndex, int32 InEyeIndex = -1) const
+	{
+		if (InEyeIndex == 1 && IsSharedRow(InVerticalStepIndex))
+		{
+			return Panes[GetRightEyePaneIndex(InHorizontalStepIndex, InVerticalStepIndex)];
+		}
+		return Panes[InVerticalStepIndex * Desc.NumHorizontalSteps + InHorizontalStepIndex];
+	}
+
+private:
+	// The right eye's panes of the shared rows follow the panes of all steps (which hold the left eye's), top rows first.
+	int32 GetRightEyePaneIndex(int32 InHorizontalStepIndex, int32 InVerticalStepIndex) const
+	{
+		const int32 SharedRowIndex = InVerticalStepIndex < Desc.NumSharedRows ? InVerticalStepIndex : InVerticalStepIndex - (Desc.NumVerticalSteps - 2 * Desc.NumSharedRows);
+		return Desc.NumHorizontalSteps * Desc.NumVerticalSteps + SharedRowIndex * Desc.NumHorizontalSteps + InHorizontalStepIndex;
+	}
+
+	FRigDesc Desc;
+	FPanoramicResampleKernel Kernel;
+	TArray<FPanoramicPaneReprojection> Panes;
+	TArray64<float> InverseCoverage;
+	// Streaming stereo rigs with shared rows only, the right eye's.
+	TArray64<float> RightEyeInverseCoverage;
+};
@@ -0,0 +1,133 @@
+// Copyright MonsterGuoGuo. All Rights Reserved.2023
+#include "PanoramicShardMergeCommandlet.h"
+#include "PanoramicAccumulationFile.h"
+#include "PanoramicEXRWriter.h"
+#include "ImagePixelData.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "MovieRenderPipelineCoreModule.h"
+
+#include UE_INLINE_GENERATED_CPP_BY_NAME(PanoramicShardMergeCommandlet)
+
+UPanoramicShardMergeCommandlet::UPanoramicShardMergeCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UPanoramicShardMergeCommandlet::Main(const FString& Params)
+{
+	FString ShardDirectory;
+	if (!FParse::Value(*Params, TEXT("ShardDir="), ShardDirectory))
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("PanoramicShardMerge: missing -ShardDir=<directory containing .%s files>."), FPanoramicAccumulationFile::GetFileExtension());
+		return 1;
+	}
+	FString OutputDirectory = ShardDirectory;
+	FParse::Value(*Params, TEXT("OutputDir="), OutputDirectory);
+	const bool bDeleteShards = FParse::Param(*Params, TEXT("DeleteShards"));
+
+	// Shards are named <Pass>.<Frame>.Shard<i>of<n>.panoacc, group them by everything before the shard suffix.
+	TArray<FString> ShardFilenames;
+	IFileManager::Get().FindFiles(ShardFilenames, *ShardDirectory, FPanoramicAccumulationFile::GetFileExtension());
+	TMap<FString, TArray<FString>> FramesToShards;
+	for (const FString& ShardFilename : ShardFilenames)
+	{
+		const int32 ShardSuffixIndex = ShardFilename.Find(TEXT(".Shard"), ESearchCase::CaseSensitive, ESearchDir::FromEnd);
+		if (ShardSuffixIndex == INDEX_NONE)
+		{
+			continue;
+		}
+		FramesToShards.FindOrAdd(ShardFilename.Left(ShardSuffixIndex)).Add(FPaths::Combine(ShardDirectory, ShardFilename));
+	}
+	FramesToShards.KeySort(TLess<FString>());
+
+	int32 NumFailedFrames = 0;
+	for (TPair<FString, TArray<FString>>& KVP : FramesToShards)
+	{
+		KVP.Value.Sort();
+
+		FPanoramicAccumulationFile FirstShard;
+		TArray64<FLinearColor> Color;
+		TArray64<float> Weight;
+		TSet<int32> MergedShardIndices;
+		bool bFrameFailed = false;
+
+		for (const FString& ShardPath : KVP.Value)
+		{
+			FPanoramicAccumulationFile Shard;
+			if (!Shard.Load(ShardPath))
+			{
+				bFrameFailed = true;
+				break;
+			}
+
+			if (MergedShardIndices.Num() == 0)
+			{
+				FirstShard.OutputSize = Shard.OutputSize;
+				FirstShard.NumEyes = Shard.NumEyes;
+				FirstShard.OutputFrameNumber = Shard.OutputFrameNumber;
+				FirstShard.bIncludeAlpha = Shard.bIncludeAlpha;
+				FirstShard.NumShards = Shard.NumShards;
+				FirstShard.bPreNormalized = Shard.bPreNormalized;
+				FirstShard.PassName = Shard.PassName;
+
+				const int64 NumPixels = (int64)Shard.OutputSize.X * Shard.OutputSize.Y * Shard.NumEyes;
+				Color.SetNumZeroed(NumPixels);
+				Weight.SetNumZeroed(NumPixels);
+			}
+			else if (!FirstShard.IsCompatibleWith(Shard))
+			{
+				UE_LOG(LogMovieRenderPipeline, Error, TEXT("PanoramicShardMerge: %s was rendered with different settings than the other shards of %s."), *ShardPath, *KVP.Key);
+				bFrameFailed = true;
+				break;
+			}
+
+			if (MergedShardIndices.Contains(Shard.ShardIndex))
+			{
+				UE_LOG(LogMovieRenderPipeline, Warning, TEXT("PanoramicShardMerge: skipping duplicate shard %d in %s."), Shard.ShardIndex, *ShardPath);
+				continue;
+			}
+			MergedShardIndices.Add(Shard.ShardIndex);
+			Shard.AccumulateInto(Color, Weight);
+		}
+
+		if (!bFrameFailed && MergedShardIndices.Num() != FirstShard.NumShards)
+		{
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("PanoramicShardMerge: %s only has %d of %d shards, not merging it yet."), *KVP.Key, MergedShardIndices.Num(), FirstShard.NumShards);
+			bFrameFailed = true;
+		}
+		if (bFrameFailed)
+		{
+			NumFailedFrames++;
+			continue;
+		}
+
+		FPanoramicAccumulationFile::Normalize(Color, Weight, FirstShard.bIncludeAlpha, FirstShard.bPreNormalized);
+		Weight.Empty();
+
+		// Compressed in chunks on all cores, the merged frames are as large as the ones the render writes.
+		const FIntPoint ImageSize = FIntPoint(FirstShard.OutputSize.X, FirstShard.OutputSize.Y * FirstShard.NumEyes);
+		const TImagePixelData<FLinearColor> PixelData(ImageSize, MoveTemp(Color));
+		const FString OutputPath = FPaths::Combine(OutputDirectory, KVP.Key + TEXT(".exr"));
+		if (!FPanoramicEXRWriter::Write(PixelData, OutputPath, FPanoramicEXRWriter::FOptions()))
+		{
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("PanoramicShardMerge: failed to write %s."), *OutputPath);
+			NumFailedFrames++;
+			continue;
+		}
+		UE_LOG(LogMovieRenderPipeline, Display, TEXT("PanoramicShardMerge: merged %d shards into %s."), MergedShardIndices.Num(), *OutputPath);
+
+		if (bDeleteShards)
+		{
+			for (const FString& ShardPath : KVP.Value)
+			{
+				IFileManager::Get().Delete(*ShardPath);
+			}
+		}
+	}
+
+	return NumFailedFrames > 0 ? 1 : 0;
+}
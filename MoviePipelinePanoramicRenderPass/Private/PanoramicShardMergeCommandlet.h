@@ -0,0 +1,22 @@
+//Copyright MonsterGuoGuo. All Rights Reserved.2023
+#pragma once
+
+#include "Commandlets/Commandlet.h"
+#include "PanoramicShardMergeCommandlet.generated.h"
+
+/**
+ * Merges the pane shards written by UPanoramicPass (NumPaneShards > 1) into finished panoramas.
+ * Every shard of a frame is summed, normalized by the summed weight and written as an EXR.
+ *
+ * Usage: -run=PanoramicShardMerge -ShardDir="D:/Shards" [-OutputDir="D:/Merged"] [-DeleteShards]
+ */
+UCLASS()
+class UPanoramicShardMergeCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UPanoramicShardMergeCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};